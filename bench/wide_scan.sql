@@ -0,0 +1,92 @@
+--
+-- Scan throughput of a wide layer, in rows per second.
+--
+-- Writes a CSV with :ncols integer columns and :nrows rows
+-- to /tmp, maps it as a foreign table and reads every column
+-- of it :runs times. Run it against builds before and after
+-- a change to the scan path and compare the best run:
+--
+--   psql -X -f bench/wide_scan.sql
+--   psql -X -v ncols=200 -v nrows=50000 -f bench/wide_scan.sql
+--
+-- The CSV is written by the server, so the user needs to be
+-- allowed to COPY to a file.
+--
+
+\set ON_ERROR_STOP on
+
+\if :{?ncols}
+\else
+\set ncols 120
+\endif
+\if :{?nrows}
+\else
+\set nrows 100000
+\endif
+\if :{?runs}
+\else
+\set runs 5
+\endif
+
+SET client_min_messages = notice;
+SET ogr_fdw_bench.ncols = :ncols;
+SET ogr_fdw_bench.nrows = :nrows;
+SET ogr_fdw_bench.runs = :runs;
+
+CREATE EXTENSION IF NOT EXISTS ogr_fdw;
+DROP SERVER IF EXISTS ogr_fdw_bench CASCADE;
+
+DO $$
+DECLARE
+	ncols integer := current_setting('ogr_fdw_bench.ncols')::integer;
+	nrows integer := current_setting('ogr_fdw_bench.nrows')::integer;
+	exprs text;
+	cols text;
+BEGIN
+	SELECT string_agg(format('g + %s AS c%s', i, i), ', ' ORDER BY i),
+	       string_agg(format('c%s integer', i), ', ' ORDER BY i)
+	INTO exprs, cols
+	FROM generate_series(1, ncols) i;
+
+	EXECUTE format('COPY (SELECT %s FROM generate_series(1, %s) g) TO %L WITH (FORMAT csv, HEADER)',
+	               exprs, nrows, '/tmp/ogr_fdw_bench_wide.csv');
+
+	CREATE SERVER ogr_fdw_bench
+		FOREIGN DATA WRAPPER ogr_fdw
+		OPTIONS (
+			datasource '/tmp/ogr_fdw_bench_wide.csv',
+			format 'CSV',
+			open_options 'AUTODETECT_TYPE=YES' );
+
+	EXECUTE format('CREATE FOREIGN TABLE bench_wide (fid bigint, %s) SERVER ogr_fdw_bench OPTIONS (layer %L)',
+	               cols, 'ogr_fdw_bench_wide');
+END;
+$$;
+
+--
+-- The whole-row reference makes the scan convert every
+-- column, while keeping the per-row work above the scan
+-- to a minimum.
+--
+DO $$
+DECLARE
+	ncols integer := current_setting('ogr_fdw_bench.ncols')::integer;
+	runs integer := current_setting('ogr_fdw_bench.runs')::integer;
+	t0 timestamptz;
+	secs float8;
+	n bigint;
+	best float8 := 0;
+BEGIN
+	FOR r IN 1..runs LOOP
+		t0 := clock_timestamp();
+		SELECT count(w.*) INTO n FROM bench_wide w;
+		secs := extract(epoch FROM clock_timestamp() - t0);
+		best := greatest(best, n / secs);
+		RAISE NOTICE 'run %: % rows of % columns in % s, % rows/sec',
+			r, n, ncols, round(secs::numeric, 3), round(n / secs);
+	END LOOP;
+	RAISE NOTICE 'best: % rows/sec', round(best);
+END;
+$$;
+
+DROP SERVER ogr_fdw_bench CASCADE;
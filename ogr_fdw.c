@@ -15,6 +15,7 @@
 /*
  * System
  */
+#include <math.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -72,6 +73,13 @@ struct OgrFdwOption
 #define OPT_OPEN_OPTIONS "open_options"
 #define OPT_UPDATEABLE "updateable"
 #define OPT_CHAR_ENCODING "character_encoding"
+#define OPT_ARROW_STREAM "arrow_stream"
+#define OPT_ASYNC_CAPABLE "async_capable"
+#define OPT_PREFETCH "prefetch"
+#define OPT_PREFETCH_SIZE "prefetch_size"
+#define OPT_KEY_BATCH_SIZE "key_batch_size"
+#define OPT_BATCH_SIZE "batch_size"
+#define OPT_SPATIAL_INDEX "spatial_index"
 
 #define OGR_FDW_FRMT_INT64	 "%lld"
 #define OGR_FDW_CAST_INT64(x)	 (long long)(x)
@@ -97,17 +105,77 @@ static struct OgrFdwOption valid_options[] =
 	{OPT_UPDATEABLE, ForeignServerRelationId, false, false},
 	{OPT_CONFIG_OPTIONS, ForeignServerRelationId, false, false},
 	{OPT_CHAR_ENCODING, ForeignServerRelationId, false, false},
+	{OPT_ASYNC_CAPABLE, ForeignServerRelationId, false, false},
+	{OPT_PREFETCH, ForeignServerRelationId, false, false},
+	{OPT_PREFETCH_SIZE, ForeignServerRelationId, false, false},
+	{OPT_KEY_BATCH_SIZE, ForeignServerRelationId, false, false},
+	{OPT_SPATIAL_INDEX, ForeignServerRelationId, false, false},
+	{OPT_BATCH_SIZE, ForeignServerRelationId, false, false},
 #if GDAL_VERSION_MAJOR >= 2
 	{OPT_OPEN_OPTIONS, ForeignServerRelationId, false, false},
 #endif
 	/* OGR layer options */
 	{OPT_LAYER, ForeignTableRelationId, true, false},
 	{OPT_UPDATEABLE, ForeignTableRelationId, false, false},
+	{OPT_ARROW_STREAM, ForeignTableRelationId, false, false},
+	{OPT_ASYNC_CAPABLE, ForeignTableRelationId, false, false},
+	{OPT_KEY_BATCH_SIZE, ForeignTableRelationId, false, false},
+	{OPT_SPATIAL_INDEX, ForeignTableRelationId, false, false},
+	{OPT_BATCH_SIZE, ForeignTableRelationId, false, false},
 
 	/* EOList marker */
 	{NULL, InvalidOid, false, false}
 };
 
+/*
+ * Indexes of the items in the fdw_private list of an ogr_fdw
+ * ForeignScan plan node. Both ogrGetForeignPlan and
+ * ogrGetForeignPushdownPlan build all of them, in this order.
+ */
+enum OgrFdwScanPrivateIndex
+{
+	/* OGR SQL attribute filter, or NULL (as a String node) */
+	OgrFdwScanPrivateAttributeFilter,
+	/* Expressions for the Params in the attribute filter */
+	OgrFdwScanPrivateParams,
+	/* Spatial filter, as made by ogrSpatialFilterToList */
+	OgrFdwScanPrivateSpatialFilter,
+	/* Integer list of the attribute numbers the scan reads */
+	OgrFdwScanPrivateRetrievedAttrs,
+	/* Row limit, or -1 for none (as an Integer node) */
+	OgrFdwScanPrivateLimit,
+	/* Aggregates answered from layer metadata */
+	OgrFdwScanPrivateAggs,
+	/* Foreign table to connect through (as an Integer node) */
+	OgrFdwScanPrivateForeignTableId,
+	/* Aggregate or join SQL the data source runs, or NULL */
+	OgrFdwScanPrivateRemoteSQL,
+	/* OGR SQL dialect of that SQL, or NULL */
+	OgrFdwScanPrivateDialect,
+	/* Position of the FID lookup value in fdw_exprs, or -1 */
+	OgrFdwScanPrivateFidIndex,
+	/* Param number of a key list read in batches, or 0 */
+	OgrFdwScanPrivateBatchParam,
+	/* Number of items, not an item */
+	OgrFdwScanPrivateCount
+};
+
+/*
+ * Indexes of the items in the fdw_private list of an aggregate
+ * or join ForeignPath, for ogrGetForeignPushdownPlan.
+ */
+enum OgrFdwPathPrivateIndex
+{
+	/* Target list of the scan tuple */
+	OgrFdwPathPrivateScanTlist,
+	/* Aggregates answered from layer metadata */
+	OgrFdwPathPrivateAggs,
+	/* SQL the data source runs, or NULL (as a String node) */
+	OgrFdwPathPrivateRemoteSQL,
+	/* OGR SQL dialect of that SQL, or NULL */
+	OgrFdwPathPrivateDialect
+};
+
 /*
  * SQL functions
  */
@@ -137,10 +205,52 @@ static ForeignScan* ogrGetForeignPlan(PlannerInfo* root,
                                       , Plan* outer_plan
 #endif
                                      );
+#if PG_VERSION_NUM >= 120000
+static void ogrGetForeignUpperPaths(PlannerInfo* root,
+                                    UpperRelationKind stage,
+                                    RelOptInfo* input_rel,
+                                    RelOptInfo* output_rel,
+                                    void* extra);
+static void ogrGetForeignJoinPaths(PlannerInfo* root,
+                                   RelOptInfo* joinrel,
+                                   RelOptInfo* outerrel,
+                                   RelOptInfo* innerrel,
+                                   JoinType jointype,
+                                   JoinPathExtraData* extra);
+#endif
 static void ogrBeginForeignScan(ForeignScanState* node, int eflags);
 static TupleTableSlot* ogrIterateForeignScan(ForeignScanState* node);
 static void ogrReScanForeignScan(ForeignScanState* node);
 static void ogrEndForeignScan(ForeignScanState* node);
+static void ogrExplainForeignScan(ForeignScanState* node, ExplainState* es);
+
+/*
+ * FDW parallel scan callback routines
+ */
+static bool ogrIsForeignScanParallelSafe(PlannerInfo* root,
+                                         RelOptInfo* rel,
+                                         RangeTblEntry* rte);
+static Size ogrEstimateDSMForeignScan(ForeignScanState* node,
+                                      ParallelContext* pcxt);
+static void ogrInitializeDSMForeignScan(ForeignScanState* node,
+                                        ParallelContext* pcxt,
+                                        void* coordinate);
+static void ogrReInitializeDSMForeignScan(ForeignScanState* node,
+                                          ParallelContext* pcxt,
+                                          void* coordinate);
+static void ogrInitializeWorkerForeignScan(ForeignScanState* node,
+                                           shm_toc* toc,
+                                           void* coordinate);
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * FDW async execution callback routines
+ */
+static bool ogrIsForeignPathAsyncCapable(ForeignPath* path);
+static void ogrForeignAsyncRequest(AsyncRequest* areq);
+static void ogrForeignAsyncConfigureWait(AsyncRequest* areq);
+static void ogrForeignAsyncNotify(AsyncRequest* areq);
+#endif
 
 /*
  * FDW modify callback routines
@@ -175,6 +285,14 @@ static TupleTableSlot* ogrExecForeignDelete(EState* estate,
         TupleTableSlot* planSlot);
 static void ogrEndForeignModify(EState* estate,
                                 ResultRelInfo* rinfo);
+#if PG_VERSION_NUM >= 140000
+static int ogrGetForeignModifyBatchSize(ResultRelInfo* rinfo);
+static TupleTableSlot** ogrExecForeignBatchInsert(EState* estate,
+        ResultRelInfo* rinfo,
+        TupleTableSlot** slots,
+        TupleTableSlot** planSlots,
+        int* numSlots);
+#endif
 static int ogrIsForeignRelUpdatable(Relation rel);
 
 
@@ -187,7 +305,18 @@ static List* ogrImportForeignSchema(ImportForeignSchemaStmt* stmt, Oid serverOid
  */
 static OgrConnection ogrGetConnectionFromTable(Oid foreigntableid, OgrUpdateable updateable);
 static void ogr_fdw_exit(int code, Datum arg);
+static void ogrConnCacheInvalCallback(Datum arg, int cacheid, uint32 hashvalue);
+static void ogrConnCacheXactCallback(XactEvent event, void* arg);
+static void ogrConnCacheSubXactCallback(SubXactEvent event, SubTransactionId mySubid, SubTransactionId parentSubid, void* arg);
+static void ogrBeginTransaction(OgrConnection* ogr);
+static void ogrConnCacheCloseAll(void);
 static void ogrReadColumnData(OgrFdwState* state);
+static void ogrBuildConvertProgram(OgrFdwExecState* execstate, const Bitmapset* retrieved_attrs);
+static void ogrSetIgnoredFields(OgrFdwExecState* execstate, const Bitmapset* retrieved_attrs);
+static void ogrScanSpatialIndex(ForeignScanState* node, OgrFdwExecState* execstate, const OgrFdwSpatialFilter* spatial_filter);
+static OGRErr ogrConvertText(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull);
+static OGRErr ogrConvertGeometry(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull);
+static OGRErr ogrConvertGeometryBytea(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull);
 
 /* Global to hold GEOMETRYOID */
 Oid GEOMETRYOID = InvalidOid;
@@ -259,6 +388,12 @@ _PG_init(void)
 {
 	on_proc_exit(&ogr_fdw_exit, PointerGetDatum(NULL));
 
+	/* Keep the connection cache in sync with server changes and transactions */
+	CacheRegisterSyscacheCallback(FOREIGNSERVEROID, ogrConnCacheInvalCallback, (Datum) 0);
+	CacheRegisterSyscacheCallback(USERMAPPINGOID, ogrConnCacheInvalCallback, (Datum) 0);
+	RegisterXactCallback(ogrConnCacheXactCallback, NULL);
+	RegisterSubXactCallback(ogrConnCacheSubXactCallback, NULL);
+
 #if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,1,0)
 	/* Hook up the GDAL error handlers to PgSQL elog() */
 	CPLSetErrorHandler(ogrErrorHandler);
@@ -272,6 +407,8 @@ _PG_init(void)
 static void
 ogr_fdw_exit(int code, Datum arg)
 {
+	ogrReaderStopAll();
+	ogrConnCacheCloseAll();
 	OGRCleanupAll();
 }
 
@@ -395,10 +532,30 @@ ogr_fdw_handler(PG_FUNCTION_ARGS)
 	fdwroutine->GetForeignRelSize = ogrGetForeignRelSize;
 	fdwroutine->GetForeignPaths = ogrGetForeignPaths;
 	fdwroutine->GetForeignPlan = ogrGetForeignPlan;
+#if PG_VERSION_NUM >= 120000
+	fdwroutine->GetForeignUpperPaths = ogrGetForeignUpperPaths;
+	fdwroutine->GetForeignJoinPaths = ogrGetForeignJoinPaths;
+#endif
 	fdwroutine->BeginForeignScan = ogrBeginForeignScan;
 	fdwroutine->IterateForeignScan = ogrIterateForeignScan;
 	fdwroutine->ReScanForeignScan = ogrReScanForeignScan;
 	fdwroutine->EndForeignScan = ogrEndForeignScan;
+	fdwroutine->ExplainForeignScan = ogrExplainForeignScan;
+
+	/* Parallel scan support */
+	fdwroutine->IsForeignScanParallelSafe = ogrIsForeignScanParallelSafe;
+	fdwroutine->EstimateDSMForeignScan = ogrEstimateDSMForeignScan;
+	fdwroutine->InitializeDSMForeignScan = ogrInitializeDSMForeignScan;
+	fdwroutine->ReInitializeDSMForeignScan = ogrReInitializeDSMForeignScan;
+	fdwroutine->InitializeWorkerForeignScan = ogrInitializeWorkerForeignScan;
+
+#if PG_VERSION_NUM >= 140000
+	/* Async execution support */
+	fdwroutine->IsForeignPathAsyncCapable = ogrIsForeignPathAsyncCapable;
+	fdwroutine->ForeignAsyncRequest = ogrForeignAsyncRequest;
+	fdwroutine->ForeignAsyncConfigureWait = ogrForeignAsyncConfigureWait;
+	fdwroutine->ForeignAsyncNotify = ogrForeignAsyncNotify;
+#endif
 
 	/* Write support */
 	fdwroutine->AddForeignUpdateTargets = ogrAddForeignUpdateTargets;
@@ -407,6 +564,10 @@ ogr_fdw_handler(PG_FUNCTION_ARGS)
 	fdwroutine->ExecForeignUpdate = ogrExecForeignUpdate;
 	fdwroutine->ExecForeignDelete = ogrExecForeignDelete;
 	fdwroutine->EndForeignModify = ogrEndForeignModify;
+#if PG_VERSION_NUM >= 140000
+	fdwroutine->GetForeignModifyBatchSize = ogrGetForeignModifyBatchSize;
+	fdwroutine->ExecForeignBatchInsert = ogrExecForeignBatchInsert;
+#endif
 	fdwroutine->IsForeignRelUpdatable = ogrIsForeignRelUpdatable;
 
 #if PG_VERSION_NUM >= 90500
@@ -480,6 +641,39 @@ ogrGetDataSourceAttempt(OgrConnection* ogr, bool bUpdateable, char** open_option
 	return ogr->ds ? OGRERR_NONE : OGRERR_FAILURE;
 }
 
+/*
+ * Set the GDAL config options for a connection into the
+ * environment. Done on every connection, including ones
+ * served from the cache, since some drivers read their
+ * config options at query time rather than open time.
+ */
+static void
+ogrSetConfigOptions(const OgrConnection* ogr)
+{
+	char** option_iter;
+	char** option_list;
+
+	if (!ogr->config_options)
+		return;
+
+	option_list = CSLTokenizeString(ogr->config_options);
+	for (option_iter = option_list; option_iter && *option_iter; option_iter++)
+	{
+		char* key;
+		const char* value;
+		value = CPLParseNameValue(*option_iter, &key);
+		if (!(key && value))
+		{
+			elog(ERROR, "bad config option string '%s'", ogr->config_options);
+		}
+
+		elog(DEBUG1, "GDAL config option '%s' set to '%s'", key, value);
+		CPLSetConfigOption(key, value);
+		CPLFree(key);
+	}
+	CSLDestroy(option_list);
+}
+
 /*
  * Given a connection string and (optional) driver string, try to connect
  * with appropriate error handling and reporting. Used in query startup,
@@ -493,27 +687,7 @@ ogrGetDataSource(OgrConnection* ogr, OgrUpdateable updateable)
 	OGRErr err;
 
 	/* Set the GDAL config options into the environment */
-	if (ogr->config_options)
-	{
-		char** option_iter;
-		char** option_list = CSLTokenizeString(ogr->config_options);
-
-		for (option_iter = option_list; option_iter && *option_iter; option_iter++)
-		{
-			char* key;
-			const char* value;
-			value = CPLParseNameValue(*option_iter, &key);
-			if (!(key && value))
-			{
-				elog(ERROR, "bad config option string '%s'", ogr->config_options);
-			}
-
-			elog(DEBUG1, "GDAL config option '%s' set to '%s'", key, value);
-			CPLSetConfigOption(key, value);
-			CPLFree(key);
-		}
-		CSLDestroy(option_list);
-	}
+	ogrSetConfigOptions(ogr);
 
 	/* Parse the GDAL layer open options */
 	if (ogr->open_options)
@@ -574,7 +748,48 @@ ogrCanReallyCountFast(const OgrConnection* con)
 
 	if (streq(dr_str, "ESRI Shapefile") ||
 	    streq(dr_str, "FileGDB") ||
-	    streq(dr_str, "OpenFileGDB"))
+	    streq(dr_str, "OpenFileGDB") ||
+	    streq(dr_str, "GPKG"))
+	{
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Drivers whose layer extent is the extent of the features
+ * now in the layer. Others keep it in metadata (a Shapefile
+ * header, the GeoPackage contents table) that edits can leave
+ * larger than the features.
+ */
+static bool
+ogrCanReallyGetExtentExactly(const OgrConnection* con)
+{
+	GDALDriverH dr = GDALGetDatasetDriver(con->ds);
+	const char* dr_str = GDALGetDriverShortName(dr);
+
+	if (streq(dr_str, "PostgreSQL") ||
+	    streq(dr_str, "FlatGeobuf"))
+	{
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Drivers whose FIDs are the positions OGR_L_SetNextByIndex
+ * jumps to, counted from zero, including the positions of
+ * deleted records, so parallel scans can split them into
+ * FID ranges.
+ */
+static bool
+ogrCanSplitByFid(const OgrConnection* con)
+{
+	GDALDriverH dr = GDALGetDatasetDriver(con->ds);
+	const char* dr_str = GDALGetDriverShortName(dr);
+
+	if (streq(dr_str, "ESRI Shapefile") ||
+	    streq(dr_str, "FlatGeobuf"))
 	{
 		return true;
 	}
@@ -600,1218 +815,4441 @@ ogrEreportError(const char* errstr)
 	}
 }
 
+/* ======================================================== */
+/* CONNECTION CACHE */
+/* ======================================================== */
+
 /*
- * Make sure the datasource is cleaned up when we're done
- * with a connection.
+ * Opening a datasource can take longer than running a small
+ * query against it, so opened GDAL datasets are kept in a
+ * per-backend cache keyed on the server options used to open
+ * them. A cached dataset is leased to one user (planner,
+ * scan, modify) at a time, since the OGR layers hanging off
+ * it carry reading position and filter state.
  */
+typedef struct OgrConnCacheEntry
+{
+	char* ds_str;              /* datasource connection string */
+	char* dr_str;              /* driver (format) name */
+	char* config_options;      /* GDAL config options */
+	char* open_options;        /* GDAL open options */
+	bool update;               /* opened in update mode? */
+	bool update_failed;        /* update open attempted, fell back to readonly */
+	uint32 server_hashvalue;   /* syscache hash of the owning foreign server */
+	GDALDatasetH ds;           /* open dataset, NULL for an empty slot */
+	bool in_use;               /* currently leased? */
+	bool invalid;              /* server changed, close instead of re-using */
+	TimestampTz last_used;     /* for idle expiry and LRU eviction */
+	bool xact;                 /* GDAL transaction open for the statement writing */
+	int xact_level;            /* subtransaction level the statement runs at */
+} OgrConnCacheEntry;
+
+static OgrConnCacheEntry ogr_conn_cache[OGR_FDW_CONNECTION_CACHE_SIZE];
+
+static bool
+ogrStrEqualNullable(const char* s1, const char* s2)
+{
+	if (s1 == NULL || s2 == NULL)
+		return s1 == s2;
+	return streq(s1, s2);
+}
+
+static char*
+ogrConnCacheStrdup(const char* str)
+{
+	return str ? MemoryContextStrdup(TopMemoryContext, str) : NULL;
+}
+
 static void
-ogrFinishConnection(OgrConnection* ogr)
+ogrConnCacheEntryClose(OgrConnCacheEntry* entry)
 {
-	elog(DEBUG3, "%s: entered function", __func__);
+	GDALDatasetH ds = entry->ds;
 
-	if (ogr->lyr && OGR_L_SyncToDisk(ogr->lyr) != OGRERR_NONE)
-	{
-		elog(NOTICE, "failed to flush writes to OGR data source");
-	}
+	if (entry->ds_str) pfree(entry->ds_str);
+	if (entry->dr_str) pfree(entry->dr_str);
+	if (entry->config_options) pfree(entry->config_options);
+	if (entry->open_options) pfree(entry->open_options);
+	memset(entry, 0, sizeof(OgrConnCacheEntry));
 
-	if (ogr->ds)
+	/* Empty the slot before closing, in case GDAL errors out */
+	if (ds)
 	{
-		GDALClose(ogr->ds);
+		GDALClose(ds);
 	}
-
-	ogr->ds = NULL;
 }
 
-static OgrConnection
-ogrGetConnectionFromServer(Oid foreignserverid, OgrUpdateable updateable)
+/*
+ * Can this cache entry serve a request for a connection
+ * with these options in this mode?
+ */
+static bool
+ogrConnCacheEntryMatches(const OgrConnCacheEntry* entry, const OgrConnection* ogr, OgrUpdateable updateable)
 {
-	ForeignServer* server;
-	OgrConnection ogr;
-	ListCell* cell;
-	OGRErr err;
-
-	elog(DEBUG3, "%s: entered function", __func__);
+	/* Datasets in a transaction stay in use until it ends */
+	if (!entry->ds || entry->in_use || (entry->invalid && !entry->xact))
+		return false;
 
-	/* Null all values */
-	memset(&ogr, 0, sizeof(OgrConnection));
-	ogr.ds_updateable = OGR_UPDATEABLE_UNSET;
-	ogr.lyr_updateable = OGR_UPDATEABLE_UNSET;
+	if (!(ogrStrEqualNullable(entry->ds_str, ogr->ds_str) &&
+	      ogrStrEqualNullable(entry->dr_str, ogr->dr_str) &&
+	      ogrStrEqualNullable(entry->config_options, ogr->config_options) &&
+	      ogrStrEqualNullable(entry->open_options, ogr->open_options)))
+		return false;
 
-	server = GetForeignServer(foreignserverid);
+	switch (updateable)
+	{
+	case OGR_UPDATEABLE_TRUE:
+		return entry->update;
+	case OGR_UPDATEABLE_TRY:
+		return entry->update || entry->update_failed;
+	default:
+		return !entry->update;
+	}
+}
 
-	foreach (cell, server->options)
+/*
+ * Close cached datasets that are invalid or have sat unused
+ * for too long.
+ */
+static void
+ogrConnCacheExpire(TimestampTz now)
+{
+	int i;
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
 	{
-		DefElem* def = (DefElem*) lfirst(cell);
-		if (streq(def->defname, OPT_SOURCE))
-		{
-			ogr.ds_str = defGetString(def);
-		}
-		if (streq(def->defname, OPT_DRIVER))
-		{
-			ogr.dr_str = defGetString(def);
-		}
-		if (streq(def->defname, OPT_CONFIG_OPTIONS))
-		{
-			ogr.config_options = defGetString(def);
-		}
-		if (streq(def->defname, OPT_OPEN_OPTIONS))
-		{
-			ogr.open_options = defGetString(def);
-		}
-		if (streq(def->defname, OPT_CHAR_ENCODING))
-		{
-			ogr.char_encoding = pg_char_to_encoding(defGetString(def));
-		}
-		if (streq(def->defname, OPT_UPDATEABLE))
+		OgrConnCacheEntry* entry = &(ogr_conn_cache[i]);
+
+		if (!entry->ds || entry->in_use || entry->xact)
+			continue;
+
+		if (entry->invalid ||
+		    TimestampDifferenceExceeds(entry->last_used, now, OGR_FDW_CONNECTION_IDLE_SECS * 1000))
 		{
-			if (defGetBoolean(def))
-			{
-				ogr.ds_updateable = OGR_UPDATEABLE_TRUE;
-			}
-			else
-			{
-				ogr.ds_updateable = OGR_UPDATEABLE_FALSE;
-				/* Over-ride the open mode to favour user-defined mode */
-				updateable = OGR_UPDATEABLE_FALSE;
-			}
+			elog(DEBUG2, "%s: closing cached datasource \"%s\"", __func__, entry->ds_str);
+			ogrConnCacheEntryClose(entry);
 		}
 	}
+}
 
-	if (!ogr.ds_str)
+/*
+ * Find a slot for a newly opened dataset: an empty one if
+ * possible, otherwise evict the least recently used idle
+ * dataset. Returns NULL if every slot is leased.
+ */
+static OgrConnCacheEntry*
+ogrConnCacheGetFreeSlot(void)
+{
+	OgrConnCacheEntry* lru = NULL;
+	int i;
+
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
 	{
-		elog(ERROR, "FDW table '%s' option is missing", OPT_SOURCE);
-	}
+		OgrConnCacheEntry* entry = &(ogr_conn_cache[i]);
 
-	/*
-	 * TODO: Connections happen twice for each query, having a
-	 * connection pool will certainly make things faster.
-	 */
+		if (!entry->ds)
+			return entry;
 
-	/*  Connect! */
-	err = ogrGetDataSource(&ogr, updateable);
-	if (err == OGRERR_FAILURE)
+		if (!entry->in_use && !entry->xact && (!lru || entry->last_used < lru->last_used))
+			lru = entry;
+	}
+
+	if (lru)
 	{
-		elog(ERROR, "ogrGetDataSource failed");
+		elog(DEBUG2, "%s: evicting cached datasource \"%s\"", __func__, lru->ds_str);
+		ogrConnCacheEntryClose(lru);
 	}
-	return ogr;
+	return lru;
 }
 
-
 /*
- * Read the options (data source connection from server and
- * layer name from table) from a foreign table and use them
- * to connect to an OGR layer. Return a connection object that
- * has handles for both the datasource and layer.
+ * Does this backend have a GDAL transaction open on the
+ * data source, with writes other backends can't see yet?
  */
-static OgrConnection
-ogrGetConnectionFromTable(Oid foreigntableid, OgrUpdateable updateable)
+static bool
+ogrConnCacheInTransaction(const char* ds_str)
 {
-	ForeignTable* table;
-	/* UserMapping *mapping; */
-	/* ForeignDataWrapper *wrapper; */
-	ListCell* cell;
-	OgrConnection ogr;
-
-	elog(DEBUG3, "%s: entered function", __func__);
-
-	/* Gather all data for the foreign table. */
-	table = GetForeignTable(foreigntableid);
-	/* mapping = GetUserMapping(GetUserId(), table->serverid); */
+	int i;
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
+	{
+		OgrConnCacheEntry* entry = &(ogr_conn_cache[i]);
+		if (entry->ds && entry->xact && streq(entry->ds_str, ds_str))
+			return true;
+	}
+	return false;
+}
 
-	ogr = ogrGetConnectionFromServer(table->serverid, updateable);
+/*
+ * Lease a dataset for the connection from the cache, or
+ * open a new one and add it to the cache.
+ */
+static OGRErr
+ogrGetDataSourceCached(OgrConnection* ogr, Oid foreignserverid, OgrUpdateable updateable)
+{
+	TimestampTz now = GetCurrentTimestamp();
+	OgrConnCacheEntry* entry;
+	OGRErr err;
+	int i;
 
-	elog(DEBUG3, "%s: ogr.ds_str = %s", __func__, ogr.ds_str);
+	ogrConnCacheExpire(now);
 
-	foreach (cell, table->options)
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
 	{
-		DefElem* def = (DefElem*) lfirst(cell);
-		if (streq(def->defname, OPT_LAYER))
-		{
-			ogr.lyr_str = defGetString(def);
-		}
-		if (streq(def->defname, OPT_UPDATEABLE))
+		entry = &(ogr_conn_cache[i]);
+		if (ogrConnCacheEntryMatches(entry, ogr, updateable))
 		{
-			if (defGetBoolean(def))
-			{
-				if (ogr.ds_updateable == OGR_UPDATEABLE_FALSE)
-				{
-					ereport(ERROR, (
-					            errcode(ERRCODE_FDW_ERROR),
-					            errmsg("data source \"%s\" is not updateable", ogr.ds_str),
-					            errhint("cannot set table '%s' option to true", OPT_UPDATEABLE)
-					        ));
-				}
-				ogr.lyr_updateable = OGR_UPDATEABLE_TRUE;
-			}
-			else
+			elog(DEBUG2, "%s: re-using cached datasource \"%s\"", __func__, ogr->ds_str);
+			ogrSetConfigOptions(ogr);
+			entry->in_use = true;
+			entry->last_used = now;
+			ogr->ds = entry->ds;
+			ogr->cache_entry = entry;
+			if (entry->update_failed && updateable == OGR_UPDATEABLE_TRY)
 			{
-				ogr.lyr_updateable = OGR_UPDATEABLE_FALSE;
+				ogr->ds_updateable = ogr->lyr_updateable = OGR_UPDATEABLE_FALSE;
 			}
+			return OGRERR_NONE;
 		}
 	}
 
-	if (!ogr.lyr_str)
+	err = ogrGetDataSource(ogr, updateable);
+	if (err != OGRERR_NONE)
+		return err;
+
+	/* Every slot leased? Then this connection just isn't cached */
+	entry = ogrConnCacheGetFreeSlot();
+	if (!entry)
+		return err;
+
+	entry->ds_str = ogrConnCacheStrdup(ogr->ds_str);
+	entry->dr_str = ogrConnCacheStrdup(ogr->dr_str);
+	entry->config_options = ogrConnCacheStrdup(ogr->config_options);
+	entry->open_options = ogrConnCacheStrdup(ogr->open_options);
+	entry->update_failed = (updateable == OGR_UPDATEABLE_TRY && ogr->ds_updateable == OGR_UPDATEABLE_FALSE);
+	entry->update = (updateable == OGR_UPDATEABLE_TRUE || updateable == OGR_UPDATEABLE_TRY) && !entry->update_failed;
+	entry->server_hashvalue = GetSysCacheHashValue1(FOREIGNSERVEROID, ObjectIdGetDatum(foreignserverid));
+	entry->ds = ogr->ds;
+	entry->in_use = true;
+	entry->last_used = now;
+	ogr->cache_entry = entry;
+
+	return err;
+}
+
+/*
+ * ALTER SERVER (or a syscache flush) invalidates the cached
+ * datasets of the server. User mapping rows don't say which
+ * server they belong to by their hash, so a user mapping
+ * change invalidates every dataset. Closing a dataset can
+ * raise GDAL errors, which we don't want in the middle of
+ * invalidation processing, so entries are only flagged here,
+ * and closed at the next cache lookup or commit.
+ */
+static void
+ogrConnCacheInvalCallback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	int i;
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
 	{
-		elog(ERROR, "FDW table '%s' option is missing", OPT_LAYER);
+		OgrConnCacheEntry* entry = &(ogr_conn_cache[i]);
+		if (entry->ds && (hashvalue == 0 || cacheid == USERMAPPINGOID ||
+		                  entry->server_hashvalue == hashvalue))
+		{
+			entry->invalid = true;
+		}
 	}
+}
 
-	elog(DEBUG3, "%s: ogr.lyr_str = %s", __func__, ogr.lyr_str);
+/*
+ * End the GDAL transaction of a cached dataset. Only the
+ * commit can fail, and the caller reports it.
+ */
+static bool
+ogrConnCacheEndTransaction(OgrConnCacheEntry* entry, bool commit)
+{
+	OGRErr err = OGRERR_NONE;
 
-	/* Does the layer exist in the data source? */
-	ogr.lyr = GDALDatasetGetLayerByName(ogr.ds, ogr.lyr_str);
-	if (!ogr.lyr)
+	entry->xact = false;
+	entry->xact_level = 0;
+
+	/* Spatial indexes may have been built from the writes */
+	if (!commit)
+		ogrRtreeInvalidate(entry->ds_str, NULL);
+
+#if GDAL_VERSION_MAJOR >= 2
+	if (commit)
 	{
-		const char* ogrerr = CPLGetLastErrorMsg();
-		ereport(ERROR, (
-		    errcode(ERRCODE_FDW_TABLE_NOT_FOUND),
-		    errmsg("unable to connect to %s to \"%s\"", OPT_LAYER, ogr.lyr_str),
-		    (ogrerr && ! streq(ogrerr, ""))
-		        ? errhint("%s", ogrerr)
-		        : errhint("Does the layer exist?")
-		    ));
+		elog(DEBUG2, "%s: committing transaction on \"%s\"", __func__, entry->ds_str);
+		err = GDALDatasetCommitTransaction(entry->ds);
 	}
-
-	if (OGR_L_TestCapability(ogr.lyr, OLCStringsAsUTF8))
+	else
 	{
-		ogr.char_encoding = PG_UTF8;
+		elog(DEBUG2, "%s: rolling back transaction on \"%s\"", __func__, entry->ds_str);
+		CPLPushErrorHandler(CPLQuietErrorHandler);
+		GDALDatasetRollbackTransaction(entry->ds);
+		CPLPopErrorHandler();
 	}
+#endif
 
-	return ogr;
+	return err == OGRERR_NONE;
 }
 
+/*
+ * Commit the GDAL transaction of a cached dataset, at the
+ * end of the statement that wrote through it.
+ */
+static void
+ogrConnCacheCommit(OgrConnCacheEntry* entry)
+{
+	if (!ogrConnCacheEndTransaction(entry, true))
+		ogrEreportError("failure committing OGR data source transaction");
+}
 
 /*
- * Validate the options given to a FOREIGN DATA WRAPPER, SERVER,
- * USER MAPPING or FOREIGN TABLE that uses ogr_fdw.
+ * GDAL transactions are committed by the statements that
+ * write, when they end, so one still open here is from a
+ * statement that did not finish, and is rolled back.
  *
- * Raise an ERROR if the option or its value is considered invalid.
+ * Leases still outstanding at the end of a transaction
+ * belong to queries that errored out before cleaning up.
+ * The datasets may have been left mid-operation, so they
+ * are flagged for closing rather than re-used.
  */
-Datum
-ogr_fdw_validator(PG_FUNCTION_ARGS)
+static void
+ogrConnCacheXactCallback(XactEvent event, void* arg)
 {
-	List* options_list = untransformRelOptions(PG_GETARG_DATUM(0));
-	Oid catalog = PG_GETARG_OID(1);
-	ListCell* cell;
-	struct OgrFdwOption* opt;
-	const char* source = NULL, *driver = NULL;
-	const char* config_options = NULL, *open_options = NULL;
-	OgrUpdateable updateable = OGR_UPDATEABLE_FALSE;
-
-	/* Initialize found state to not found */
-	for (opt = valid_options; opt->optname; opt++)
-	{
-		opt->optfound = false;
-	}
+	int i;
 
-	/*
-	 * Check that only options supported by ogr_fdw, and allowed for the
-	 * current object type, are given.
-	 */
-	foreach (cell, options_list)
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
 	{
-		DefElem* def = (DefElem*) lfirst(cell);
-		bool optfound = false;
-
-		for (opt = valid_options; opt->optname; opt++)
-		{
-			if (catalog == opt->optcontext && streq(opt->optname, def->defname))
-			{
-				/* Mark that this user option was found */
-				opt->optfound = optfound = true;
-
-				/* Store some options for testing later */
-				if (streq(opt->optname, OPT_SOURCE))
-				{
-					source = defGetString(def);
-				}
-				if (streq(opt->optname, OPT_DRIVER))
-				{
-					driver = defGetString(def);
-				}
-				if (streq(opt->optname, OPT_CONFIG_OPTIONS))
-				{
-					config_options = defGetString(def);
-				}
-				if (streq(opt->optname, OPT_OPEN_OPTIONS))
-				{
-					open_options = defGetString(def);
-				}
-				if (streq(opt->optname, OPT_UPDATEABLE))
-				{
-					if (defGetBoolean(def))
-					{
-						updateable = OGR_UPDATEABLE_TRY;
-					}
-				}
+		OgrConnCacheEntry* entry = &(ogr_conn_cache[i]);
 
-				break;
-			}
-		}
+		if (!entry->ds || !entry->xact)
+			continue;
 
-		if (!optfound)
+		switch (event)
 		{
-			/*
-			 * Unknown option specified, complain about it. Provide a hint
-			 * with list of valid options for the object.
-			 */
-			const struct OgrFdwOption* opt;
-			StringInfoData buf;
-
-			initStringInfo(&buf);
-			for (opt = valid_options; opt->optname; opt++)
-			{
-				if (catalog == opt->optcontext)
-					appendStringInfo(&buf, "%s%s", (buf.len > 0) ? ", " : "",
-					                 opt->optname);
-			}
-
-			ereport(ERROR, (
-			    errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-			    errmsg("invalid option \"%s\"", def->defname),
-			    buf.len > 0
-			        ? errhint("Valid options in this context are: %s", buf.data)
-			        : errhint("There are no valid options in this context.")));
+		case XACT_EVENT_PRE_COMMIT:
+		case XACT_EVENT_PRE_PREPARE:
+		case XACT_EVENT_ABORT:
+#if PG_VERSION_NUM >= 90500
+		case XACT_EVENT_PARALLEL_ABORT:
+#endif
+			ogrConnCacheEndTransaction(entry, false);
+			break;
+		default:
+			break;
 		}
 	}
 
-	/* Check that all the mandatory options were found */
-	for (opt = valid_options; opt->optname; opt++)
+	/*
+	 * Backends can sit idle between queries for a long time, so
+	 * idle datasets are closed at commits too, not just at the
+	 * next lookup. A dataset that fails to close quietly is no
+	 * reason to fail the commit.
+	 */
+	if (event == XACT_EVENT_PRE_COMMIT)
 	{
-		/* Required option for this catalog type is missing? */
-		if (catalog == opt->optcontext && opt->optrequired && ! opt->optfound)
-		{
-			ereport(ERROR, (
-			    errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
-			    errmsg("required option \"%s\" is missing", opt->optname)));
-		}
+		CPLPushErrorHandler(CPLQuietErrorHandler);
+		ogrConnCacheExpire(GetCurrentTimestamp());
+		CPLPopErrorHandler();
 	}
 
-	/* Make sure server connection can actually be established */
-	if (catalog == ForeignServerRelationId && source)
-	{
-		OgrConnection ogr;
-		OGRErr err;
-
-		ogr.ds_str = source;
-		ogr.dr_str = driver;
-		ogr.config_options = config_options;
-		ogr.open_options = open_options;
+	if (event != XACT_EVENT_ABORT && event != XACT_EVENT_COMMIT)
+		return;
 
-		err = ogrGetDataSource(&ogr, updateable);
-		if (err == OGRERR_FAILURE)
-		{
-			elog(ERROR, "ogrGetDataSource failed");
-		}
-		if (ogr.ds)
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
+	{
+		OgrConnCacheEntry* entry = &(ogr_conn_cache[i]);
+		if (entry->ds && entry->in_use)
 		{
-			GDALClose(ogr.ds);
+			entry->in_use = false;
+			entry->invalid = true;
 		}
 	}
-
-	PG_RETURN_VOID();
 }
 
 /*
- * Initialize an OgrFdwPlanState on the heap.
+ * A statement that fails inside a subtransaction (a savepoint,
+ * or an exception block of a function) takes its GDAL
+ * transaction down with the subtransaction.
  */
-static OgrFdwState*
-getOgrFdwState(Oid foreigntableid, OgrFdwStateType state_type)
+static void
+ogrConnCacheSubXactCallback(SubXactEvent event, SubTransactionId mySubid, SubTransactionId parentSubid, void* arg)
 {
-	OgrFdwState* state;
-	size_t size;
-	OgrUpdateable updateable = OGR_UPDATEABLE_FALSE;
+	int level = GetCurrentTransactionNestLevel();
+	int i;
 
-	switch (state_type)
-	{
-	case OGR_PLAN_STATE:
-		size = sizeof(OgrFdwPlanState);
-		updateable = OGR_UPDATEABLE_FALSE;
-		break;
-	case OGR_EXEC_STATE:
-		size = sizeof(OgrFdwExecState);
-		updateable = OGR_UPDATEABLE_FALSE;
-		break;
-	case OGR_MODIFY_STATE:
-		updateable = OGR_UPDATEABLE_TRUE;
-		size = sizeof(OgrFdwModifyState);
-		break;
-	default:
-		elog(ERROR, "invalid state type");
-	}
+	if (event != SUBXACT_EVENT_COMMIT_SUB && event != SUBXACT_EVENT_ABORT_SUB)
+		return;
 
-	state = palloc0(size);
-	state->type = state_type;
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
+	{
+		OgrConnCacheEntry* entry = &(ogr_conn_cache[i]);
 
-	/*  Connect! */
-	state->ogr = ogrGetConnectionFromTable(foreigntableid, updateable);
-	state->foreigntableid = foreigntableid;
+		if (!entry->ds || !entry->xact || entry->xact_level < level)
+			continue;
 
-	return state;
+		if (event == SUBXACT_EVENT_ABORT_SUB)
+			ogrConnCacheEndTransaction(entry, false);
+		else
+			entry->xact_level = level - 1;
+	}
 }
 
-
-
 /*
- * ogrGetForeignRelSize
- *		Obtain relation size estimates for a foreign table
+ * Before writing through a connection, make sure its dataset
+ * is in a GDAL transaction, which the statement commits when
+ * it ends (see ogrEndForeignModify), so that the writes of a
+ * statement are committed once and not row by row. Later
+ * statements, which read through other datasets, then see
+ * the writes, but a PgSQL rollback after the statement can't
+ * undo them. Only cached datasets stay open for the whole
+ * statement, and only drivers with real transactions (not
+ * emulated ones, which copy the whole file) are used this
+ * way. Other writes commit as they go.
  */
 static void
-ogrGetForeignRelSize(PlannerInfo* root,
-                     RelOptInfo* baserel,
-                     Oid foreigntableid)
+ogrBeginTransaction(OgrConnection* ogr)
 {
-	/* Initialize the OGR connection */
-	OgrFdwState* state = (OgrFdwState*)getOgrFdwState(foreigntableid, OGR_PLAN_STATE);
-	OgrFdwPlanState* planstate = (OgrFdwPlanState*)state;
-	List* scan_clauses = baserel->baserestrictinfo;
-
-	elog(DEBUG3, "%s: entered function", __func__);
-
-	/* Set to NULL to clear the restriction clauses in OGR */
-	OGR_L_SetIgnoredFields(planstate->ogr.lyr, NULL);
-	OGR_L_SetSpatialFilter(planstate->ogr.lyr, NULL);
-	OGR_L_SetAttributeFilter(planstate->ogr.lyr, NULL);
+	OgrConnCacheEntry* entry = ogr->cache_entry;
 
-	/*
-	* The estimate number of rows returned must actually use restrictions.
-	* Since OGR can't really give us a fast count with restrictions on
-	* (usually involves a scan) and restrictions in the baserel mean we
-	* must punt row count estimates.
-	*/
+	if (!entry || entry->xact)
+		return;
 
-	/* TODO: calculate the row width based on the attribute types of the OGR table */
+#if GDAL_VERSION_MAJOR >= 2
+	if (!GDALDatasetTestCapability(entry->ds, ODsCTransactions))
+		return;
+	if (GDALDatasetStartTransaction(entry->ds, FALSE) != OGRERR_NONE)
+		return;
 
-	/*
-	* OGR asks drivers to honestly state if they can provide a fast
-	* row count, but too many drivers lie. We are only listing drivers
-	* we trust in ogrCanReallyCountFast()
-	*/
+	entry->xact = true;
+	entry->xact_level = GetCurrentTransactionNestLevel();
+	elog(DEBUG2, "%s: started transaction on \"%s\"", __func__, entry->ds_str);
+#endif
+}
 
-	/* If we can quickly figure how many rows this layer has, then do so */
-	if (scan_clauses == NIL &&
-	        OGR_L_TestCapability(planstate->ogr.lyr, OLCFastFeatureCount) == TRUE &&
-	        ogrCanReallyCountFast(&(planstate->ogr)))
+static void
+ogrConnCacheCloseAll(void)
+{
+	int i;
+	for (i = 0; i < OGR_FDW_CONNECTION_CACHE_SIZE; i++)
 	{
-		/* Count rows, but don't force a slow count */
-		int rows = OGR_L_GetFeatureCount(planstate->ogr.lyr, false);
-		/* Only use row count if return is valid (>0) */
-		if (rows >= 0)
+		if (ogr_conn_cache[i].ds)
 		{
-			planstate->nrows = rows;
-			baserel->rows = rows;
+			ogrConnCacheEntryClose(&(ogr_conn_cache[i]));
 		}
 	}
-
-	/* Save connection state for next calls */
-	baserel->fdw_private = (void*) planstate;
-
-	return;
 }
 
-
-
 /*
- * ogrGetForeignPaths
- *		Create possible access paths for a scan on the foreign table
- *
- *		Currently there is only one
- *		possible access path, which simply returns all records in the order in
- *		the data file.
+ * Make sure the datasource is cleaned up when we're done
+ * with a connection. Cached datasets go back to the cache
+ * for the next query, others are closed.
  */
 static void
-ogrGetForeignPaths(PlannerInfo* root,
-                   RelOptInfo* baserel,
-                   Oid foreigntableid)
+ogrFinishConnection(OgrConnection* ogr)
 {
-	OgrFdwPlanState* planstate = (OgrFdwPlanState*)(baserel->fdw_private);
-
 	elog(DEBUG3, "%s: entered function", __func__);
 
-	/* TODO: replace this with something that looks at the OGRDriver and */
-	/* makes a determination based on that? Better: add connection caching */
-	/* so that slow startup doesn't matter so much */
-	planstate->startup_cost = 25;
+	if (ogr->lyr && OGR_L_SyncToDisk(ogr->lyr) != OGRERR_NONE)
+	{
+		elog(NOTICE, "failed to flush writes to OGR data source");
+	}
+
+	if (ogr->cache_entry)
+	{
+		OgrConnCacheEntry* entry = ogr->cache_entry;
+		entry->in_use = false;
+		entry->last_used = GetCurrentTimestamp();
+		if (entry->invalid && !entry->xact)
+		{
+			ogrConnCacheEntryClose(entry);
+		}
+	}
+	else if (ogr->ds)
+	{
+		GDALClose(ogr->ds);
+	}
+
+	ogr->ds = NULL;
+	ogr->lyr = NULL;
+	ogr->cache_entry = NULL;
+}
+
+static OgrConnection
+ogrGetConnectionFromServer(Oid foreignserverid, OgrUpdateable updateable)
+{
+	ForeignServer* server;
+	OgrConnection ogr;
+	ListCell* cell;
+	OGRErr err;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	/* Null all values */
+	memset(&ogr, 0, sizeof(OgrConnection));
+	ogr.ds_updateable = OGR_UPDATEABLE_UNSET;
+	ogr.lyr_updateable = OGR_UPDATEABLE_UNSET;
+
+	server = GetForeignServer(foreignserverid);
+
+	foreach (cell, server->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_SOURCE))
+		{
+			ogr.ds_str = defGetString(def);
+		}
+		if (streq(def->defname, OPT_DRIVER))
+		{
+			ogr.dr_str = defGetString(def);
+		}
+		if (streq(def->defname, OPT_CONFIG_OPTIONS))
+		{
+			ogr.config_options = defGetString(def);
+		}
+		if (streq(def->defname, OPT_OPEN_OPTIONS))
+		{
+			ogr.open_options = defGetString(def);
+		}
+		if (streq(def->defname, OPT_CHAR_ENCODING))
+		{
+			ogr.char_encoding = pg_char_to_encoding(defGetString(def));
+		}
+		if (streq(def->defname, OPT_UPDATEABLE))
+		{
+			if (defGetBoolean(def))
+			{
+				ogr.ds_updateable = OGR_UPDATEABLE_TRUE;
+			}
+			else
+			{
+				ogr.ds_updateable = OGR_UPDATEABLE_FALSE;
+				/* Over-ride the open mode to favour user-defined mode */
+				updateable = OGR_UPDATEABLE_FALSE;
+			}
+		}
+	}
+
+	if (!ogr.ds_str)
+	{
+		elog(ERROR, "FDW table '%s' option is missing", OPT_SOURCE);
+	}
+
+	/*  Connect! (or re-use a cached connection) */
+	err = ogrGetDataSourceCached(&ogr, foreignserverid, updateable);
+	if (err == OGRERR_FAILURE)
+	{
+		elog(ERROR, "ogrGetDataSource failed");
+	}
+	return ogr;
+}
+
+
+/*
+ * Read the options (data source connection from server and
+ * layer name from table) from a foreign table and use them
+ * to connect to an OGR layer. Return a connection object that
+ * has handles for both the datasource and layer.
+ */
+static OgrConnection
+ogrGetConnectionFromTable(Oid foreigntableid, OgrUpdateable updateable)
+{
+	ForeignTable* table;
+	/* UserMapping *mapping; */
+	/* ForeignDataWrapper *wrapper; */
+	ListCell* cell;
+	OgrConnection ogr;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	/* Gather all data for the foreign table. */
+	table = GetForeignTable(foreigntableid);
+	/* mapping = GetUserMapping(GetUserId(), table->serverid); */
+
+	ogr = ogrGetConnectionFromServer(table->serverid, updateable);
+
+	elog(DEBUG3, "%s: ogr.ds_str = %s", __func__, ogr.ds_str);
+
+	foreach (cell, table->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_LAYER))
+		{
+			ogr.lyr_str = defGetString(def);
+		}
+		if (streq(def->defname, OPT_UPDATEABLE))
+		{
+			if (defGetBoolean(def))
+			{
+				if (ogr.ds_updateable == OGR_UPDATEABLE_FALSE)
+				{
+					ereport(ERROR, (
+					            errcode(ERRCODE_FDW_ERROR),
+					            errmsg("data source \"%s\" is not updateable", ogr.ds_str),
+					            errhint("cannot set table '%s' option to true", OPT_UPDATEABLE)
+					        ));
+				}
+				ogr.lyr_updateable = OGR_UPDATEABLE_TRUE;
+			}
+			else
+			{
+				ogr.lyr_updateable = OGR_UPDATEABLE_FALSE;
+			}
+		}
+	}
+
+	if (!ogr.lyr_str)
+	{
+		elog(ERROR, "FDW table '%s' option is missing", OPT_LAYER);
+	}
+
+	elog(DEBUG3, "%s: ogr.lyr_str = %s", __func__, ogr.lyr_str);
+
+	/* Does the layer exist in the data source? */
+	ogr.lyr = GDALDatasetGetLayerByName(ogr.ds, ogr.lyr_str);
+	if (!ogr.lyr)
+	{
+		const char* ogrerr = CPLGetLastErrorMsg();
+		ereport(ERROR, (
+		    errcode(ERRCODE_FDW_TABLE_NOT_FOUND),
+		    errmsg("unable to connect to %s to \"%s\"", OPT_LAYER, ogr.lyr_str),
+		    (ogrerr && ! streq(ogrerr, ""))
+		        ? errhint("%s", ogrerr)
+		        : errhint("Does the layer exist?")
+		    ));
+	}
+
+	/* Cached layers may carry state from a previous query */
+	OGR_L_SetIgnoredFields(ogr.lyr, NULL);
+	OGR_L_SetSpatialFilter(ogr.lyr, NULL);
+	OGR_L_SetAttributeFilter(ogr.lyr, NULL);
+	OGR_L_ResetReading(ogr.lyr);
+
+	if (OGR_L_TestCapability(ogr.lyr, OLCStringsAsUTF8))
+	{
+		ogr.char_encoding = PG_UTF8;
+	}
+
+	return ogr;
+}
+
+
+/*
+ * Read the arrow_stream table option, which forces reading
+ * through an Arrow stream on or off. Left unset, the layer
+ * capabilities decide.
+ */
+static OgrArrowStream
+ogrGetArrowStreamOption(Oid foreigntableid)
+{
+	ForeignTable* table = GetForeignTable(foreigntableid);
+	ListCell* cell;
+
+	foreach (cell, table->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_ARROW_STREAM))
+		{
+			return defGetBoolean(def) ? OGR_ARROW_STREAM_TRUE : OGR_ARROW_STREAM_FALSE;
+		}
+	}
+
+	return OGR_ARROW_STREAM_UNSET;
+}
+
+/*
+ * Read the async_capable option, from the table, or else
+ * from its server. Scans are synchronous unless asked.
+ */
+static bool
+ogrGetAsyncCapableOption(Oid foreigntableid)
+{
+	ForeignTable* table = GetForeignTable(foreigntableid);
+	ForeignServer* server = GetForeignServer(table->serverid);
+	bool async_capable = false;
+	ListCell* cell;
+
+	foreach (cell, server->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_ASYNC_CAPABLE))
+			async_capable = defGetBoolean(def);
+	}
+
+	foreach (cell, table->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_ASYNC_CAPABLE))
+			async_capable = defGetBoolean(def);
+	}
+
+	return async_capable;
+}
+
+/*
+ * Read the spatial_index option, from the table, or else
+ * from its server. Layers are only indexed in memory when
+ * asked, since the first scan pays for reading them whole.
+ */
+static bool
+ogrGetSpatialIndexOption(Oid foreigntableid)
+{
+	ForeignTable* table = GetForeignTable(foreigntableid);
+	ForeignServer* server = GetForeignServer(table->serverid);
+	bool spatial_index = false;
+	ListCell* cell;
+
+	foreach (cell, server->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_SPATIAL_INDEX))
+			spatial_index = defGetBoolean(def);
+	}
+
+	foreach (cell, table->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_SPATIAL_INDEX))
+			spatial_index = defGetBoolean(def);
+	}
+
+	return spatial_index;
+}
+
+/*
+ * Read the prefetch and prefetch_size server options, which
+ * turn on the background reader for ordinary scans and size
+ * its feature ring (for async scans too).
+ */
+static void
+ogrGetPrefetchOptions(Oid foreigntableid, bool* prefetch, int* prefetch_size)
+{
+	ForeignTable* table = GetForeignTable(foreigntableid);
+	ForeignServer* server = GetForeignServer(table->serverid);
+	ListCell* cell;
+
+	*prefetch = false;
+	*prefetch_size = OGR_FDW_READER_RING_SIZE;
+
+	foreach (cell, server->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_PREFETCH))
+			*prefetch = defGetBoolean(def);
+		if (streq(def->defname, OPT_PREFETCH_SIZE))
+			*prefetch_size = Min(atoi(defGetString(def)), OGR_FDW_READER_RING_MAX);
+	}
+}
+
+/*
+ * Read the key_batch_size option, of the table or else its
+ * server: how many keys of a long list go in each filter.
+ */
+static int
+ogrGetKeyBatchSize(Oid foreigntableid)
+{
+	ForeignTable* table = GetForeignTable(foreigntableid);
+	ForeignServer* server = GetForeignServer(table->serverid);
+	int batch_size = OGR_FDW_KEY_BATCH_SIZE;
+	ListCell* cell;
+
+	foreach (cell, server->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_KEY_BATCH_SIZE))
+			batch_size = atoi(defGetString(def));
+	}
+	foreach (cell, table->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_KEY_BATCH_SIZE))
+			batch_size = atoi(defGetString(def));
+	}
+
+	return batch_size;
+}
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * Read the batch_size option, of the table or else its
+ * server: how many rows an INSERT hands over at a time.
+ */
+static int
+ogrGetBatchSize(Oid foreigntableid)
+{
+	ForeignTable* table = GetForeignTable(foreigntableid);
+	ForeignServer* server = GetForeignServer(table->serverid);
+	int batch_size = OGR_FDW_BATCH_SIZE;
+	ListCell* cell;
+
+	foreach (cell, server->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_BATCH_SIZE))
+			batch_size = atoi(defGetString(def));
+	}
+	foreach (cell, table->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_BATCH_SIZE))
+			batch_size = atoi(defGetString(def));
+	}
+
+	return batch_size;
+}
+#endif
+
+/*
+ * Validate the options given to a FOREIGN DATA WRAPPER, SERVER,
+ * USER MAPPING or FOREIGN TABLE that uses ogr_fdw.
+ *
+ * Raise an ERROR if the option or its value is considered invalid.
+ */
+Datum
+ogr_fdw_validator(PG_FUNCTION_ARGS)
+{
+	List* options_list = untransformRelOptions(PG_GETARG_DATUM(0));
+	Oid catalog = PG_GETARG_OID(1);
+	ListCell* cell;
+	struct OgrFdwOption* opt;
+	const char* source = NULL, *driver = NULL;
+	const char* config_options = NULL, *open_options = NULL;
+	OgrUpdateable updateable = OGR_UPDATEABLE_FALSE;
+
+	/* Initialize found state to not found */
+	for (opt = valid_options; opt->optname; opt++)
+	{
+		opt->optfound = false;
+	}
+
+	/*
+	 * Check that only options supported by ogr_fdw, and allowed for the
+	 * current object type, are given.
+	 */
+	foreach (cell, options_list)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		bool optfound = false;
+
+		for (opt = valid_options; opt->optname; opt++)
+		{
+			if (catalog == opt->optcontext && streq(opt->optname, def->defname))
+			{
+				/* Mark that this user option was found */
+				opt->optfound = optfound = true;
+
+				/* Store some options for testing later */
+				if (streq(opt->optname, OPT_SOURCE))
+				{
+					source = defGetString(def);
+				}
+				if (streq(opt->optname, OPT_DRIVER))
+				{
+					driver = defGetString(def);
+				}
+				if (streq(opt->optname, OPT_CONFIG_OPTIONS))
+				{
+					config_options = defGetString(def);
+				}
+				if (streq(opt->optname, OPT_OPEN_OPTIONS))
+				{
+					open_options = defGetString(def);
+				}
+				if (streq(opt->optname, OPT_UPDATEABLE))
+				{
+					if (defGetBoolean(def))
+					{
+						updateable = OGR_UPDATEABLE_TRY;
+					}
+				}
+				if (streq(opt->optname, OPT_ARROW_STREAM) ||
+				    streq(opt->optname, OPT_ASYNC_CAPABLE) ||
+				    streq(opt->optname, OPT_PREFETCH) ||
+				    streq(opt->optname, OPT_SPATIAL_INDEX))
+				{
+					/* Complain now about values that aren't booleans */
+					(void) defGetBoolean(def);
+				}
+				if (streq(opt->optname, OPT_PREFETCH_SIZE) ||
+				    streq(opt->optname, OPT_KEY_BATCH_SIZE) ||
+				    streq(opt->optname, OPT_BATCH_SIZE))
+				{
+					const char* str = defGetString(def);
+					char* end;
+					long size = strtol(str, &end, 10);
+
+					if (*str == '\0' || *end != '\0' || size <= 0 || size > INT_MAX / 2)
+					{
+						ereport(ERROR, (
+						    errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						    errmsg("invalid value for option \"%s\": \"%s\"", opt->optname, str),
+						    errhint("%s must be a positive integer", opt->optname)));
+					}
+					/* The reader allocates its whole ring up front */
+					if (streq(opt->optname, OPT_PREFETCH_SIZE) && size > OGR_FDW_READER_RING_MAX)
+					{
+						ereport(ERROR, (
+						    errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						    errmsg("invalid value for option \"%s\": \"%s\"", opt->optname, str),
+						    errhint("%s must be at most %d", opt->optname, OGR_FDW_READER_RING_MAX)));
+					}
+				}
+
+				break;
+			}
+		}
+
+		if (!optfound)
+		{
+			/*
+			 * Unknown option specified, complain about it. Provide a hint
+			 * with list of valid options for the object.
+			 */
+			const struct OgrFdwOption* opt;
+			StringInfoData buf;
+
+			initStringInfo(&buf);
+			for (opt = valid_options; opt->optname; opt++)
+			{
+				if (catalog == opt->optcontext)
+					appendStringInfo(&buf, "%s%s", (buf.len > 0) ? ", " : "",
+					                 opt->optname);
+			}
+
+			ereport(ERROR, (
+			    errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+			    errmsg("invalid option \"%s\"", def->defname),
+			    buf.len > 0
+			        ? errhint("Valid options in this context are: %s", buf.data)
+			        : errhint("There are no valid options in this context.")));
+		}
+	}
+
+	/* Check that all the mandatory options were found */
+	for (opt = valid_options; opt->optname; opt++)
+	{
+		/* Required option for this catalog type is missing? */
+		if (catalog == opt->optcontext && opt->optrequired && ! opt->optfound)
+		{
+			ereport(ERROR, (
+			    errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
+			    errmsg("required option \"%s\" is missing", opt->optname)));
+		}
+	}
+
+	/* Make sure server connection can actually be established */
+	if (catalog == ForeignServerRelationId && source)
+	{
+		OgrConnection ogr;
+		OGRErr err;
+
+		ogr.ds_str = source;
+		ogr.dr_str = driver;
+		ogr.config_options = config_options;
+		ogr.open_options = open_options;
+
+		err = ogrGetDataSource(&ogr, updateable);
+		if (err == OGRERR_FAILURE)
+		{
+			elog(ERROR, "ogrGetDataSource failed");
+		}
+		if (ogr.ds)
+		{
+			GDALClose(ogr.ds);
+		}
+	}
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Initialize an OgrFdwPlanState on the heap.
+ */
+static OgrFdwState*
+getOgrFdwState(Oid foreigntableid, OgrFdwStateType state_type)
+{
+	OgrFdwState* state;
+	size_t size;
+	OgrUpdateable updateable = OGR_UPDATEABLE_FALSE;
+
+	switch (state_type)
+	{
+	case OGR_PLAN_STATE:
+		size = sizeof(OgrFdwPlanState);
+		updateable = OGR_UPDATEABLE_FALSE;
+		break;
+	case OGR_EXEC_STATE:
+		size = sizeof(OgrFdwExecState);
+		updateable = OGR_UPDATEABLE_FALSE;
+		break;
+	case OGR_MODIFY_STATE:
+		updateable = OGR_UPDATEABLE_TRUE;
+		size = sizeof(OgrFdwModifyState);
+		break;
+	default:
+		elog(ERROR, "invalid state type");
+	}
+
+	state = palloc0(size);
+	state->type = state_type;
+
+	/*  Connect! */
+	state->ogr = ogrGetConnectionFromTable(foreigntableid, updateable);
+	state->foreigntableid = foreigntableid;
+
+	return state;
+}
+
+
+
+/*
+ * ogrGetForeignRelSize
+ *		Obtain relation size estimates for a foreign table
+ */
+static void
+ogrGetForeignRelSize(PlannerInfo* root,
+                     RelOptInfo* baserel,
+                     Oid foreigntableid)
+{
+	/* Initialize the OGR connection */
+	OgrFdwState* state = (OgrFdwState*)getOgrFdwState(foreigntableid, OGR_PLAN_STATE);
+	OgrFdwPlanState* planstate = (OgrFdwPlanState*)state;
+	List* scan_clauses = baserel->baserestrictinfo;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	/* Set to NULL to clear the restriction clauses in OGR */
+	OGR_L_SetIgnoredFields(planstate->ogr.lyr, NULL);
+	OGR_L_SetSpatialFilter(planstate->ogr.lyr, NULL);
+	OGR_L_SetAttributeFilter(planstate->ogr.lyr, NULL);
+
+	/*
+	* The estimate number of rows returned must actually use restrictions.
+	* Since OGR can't really give us a fast count with restrictions on
+	* (usually involves a scan) and restrictions in the baserel mean we
+	* must punt row count estimates.
+	*/
+
+	/* TODO: calculate the row width based on the attribute types of the OGR table */
+
+	/*
+	* OGR asks drivers to honestly state if they can provide a fast
+	* row count, but too many drivers lie. We are only listing drivers
+	* we trust in ogrCanReallyCountFast()
+	*/
+
+	/* If we can quickly figure how many rows this layer has, then do so */
+	if (scan_clauses == NIL &&
+	        OGR_L_TestCapability(planstate->ogr.lyr, OLCFastFeatureCount) == TRUE &&
+	        ogrCanReallyCountFast(&(planstate->ogr)))
+	{
+		/* Count rows, but don't force a slow count */
+		int rows = OGR_L_GetFeatureCount(planstate->ogr.lyr, false);
+		/* Only use row count if return is valid (>0) */
+		if (rows >= 0)
+		{
+			planstate->nrows = rows;
+			baserel->rows = rows;
+		}
+	}
+
+	/* Async scans need a background reader to wait on */
+	planstate->async_capable = ogrReaderAvailable() && ogrGetAsyncCapableOption(foreigntableid);
+
+	/* Save connection state for next calls */
+	baserel->fdw_private = (void*) planstate;
+
+	return;
+}
+
+
+
+/*
+ * A parallel scan has every participant claim chunks of
+ * FIDs, jump to the first with OGR_L_SetNextByIndex and read
+ * until a feature falls past the chunk. That only works on
+ * layers whose FIDs are their read positions, only pays off
+ * on layers that can jump without reading up to the position,
+ * and only on layers big enough to be worth splitting. Layers
+ * are only fast at it with no filter set (a filtered
+ * Shapefile reads from the start up to each index), so
+ * scans with an attribute or spatial filter aren't split.
+ * The feature count only sizes the worker pool; reading
+ * by FID range is exact whatever records were deleted.
+ */
+static void
+ogrAddParallelPath(PlannerInfo* root, RelOptInfo* baserel, OgrFdwPlanState* planstate)
+{
+	ForeignPath* path;
+	int parallel_workers;
+	double parallel_divisor;
+	double pages;
+	StringInfoData sql;
+	List* params_list = NIL;
+	OgrFdwSpatialFilter* spatial_filter = NULL;
+
+	if (!baserel->consider_parallel || planstate->nrows <= 0)
+		return;
+
+	if (!ogrCanSplitByFid(&(planstate->ogr)) ||
+	    !OGR_L_TestCapability(planstate->ogr.lyr, OLCFastSetNextByIndex))
+		return;
+
+	ogrReadColumnData((OgrFdwState*) planstate);
+	initStringInfo(&sql);
+	ogrDeparse(&sql, root, baserel, baserel->baserestrictinfo, (OgrFdwState*) planstate, &params_list, &spatial_filter, NULL);
+	if (sql.len > 0 || spatial_filter)
+	{
+		elog(DEBUG2, "%s: filtered scans are not split among workers", __func__);
+		return;
+	}
+
+	/* Nothing to share out unless there are at least two chunks */
+	if (planstate->nrows < 2 * OGR_FDW_PARALLEL_CHUNK_SIZE)
+		return;
+
+	/*
+	 * Size the worker count the way a heap scan would, treating
+	 * each chunk as a page's worth of the usual threshold.
+	 */
+	pages = ceil((double) planstate->nrows / OGR_FDW_PARALLEL_CHUNK_SIZE) *
+	        (min_parallel_table_scan_size > 0 ? min_parallel_table_scan_size : 1);
+	parallel_workers = compute_parallel_worker(baserel, pages, -1, max_parallel_workers_per_gather);
+	if (parallel_workers <= 0)
+		return;
+
+	/* As get_parallel_divisor(), the leader does some work too */
+	parallel_divisor = parallel_workers;
+	if (parallel_leader_participation)
+	{
+		double leader_contribution = 1.0 - (0.3 * parallel_workers);
+		if (leader_contribution > 0)
+			parallel_divisor += leader_contribution;
+	}
+
+	path = create_foreignscan_path(root, baserel,
+	                               NULL, /* PathTarget */
+	                               baserel->rows / parallel_divisor,
+#if PG_VERSION_NUM >= 180000
+	                               0,       /* disabled_nodes */
+#endif
+	                               planstate->startup_cost,
+	                               planstate->startup_cost + planstate->nrows / parallel_divisor,
+	                               NIL,     /* no pathkeys */
+	                               NULL,    /* no lateral_relids */
+	                               NULL     /* no extra plan */
+#if PG_VERSION_NUM >= 170000
+	                               , NIL    /* no fdw_restrictinfo list */
+#endif
+	                               , NIL    /* no fdw_private list */
+	                              );
+	path->path.parallel_aware = true;
+	path->path.parallel_safe = true;
+	path->path.parallel_workers = parallel_workers;
+
+	add_partial_path(baserel, (Path*) path);
+}
+
+/*
+ * SQL dialect that runs aggregate and join queries on this
+ * data source through GDALDatasetExecuteSQL: the native SQL
+ * of database drivers (""), SQLite for file geodatabases, or
+ * NULL where OGR SQL would have to (and can't) do it. These
+ * are also the drivers whose attribute filters use indexes.
+ */
+static const char*
+ogrRemoteDialect(const OgrConnection* ogr)
+{
+	const char* dr_str = GDALGetDriverShortName(GDALGetDatasetDriver(ogr->ds));
+
+	if (streq(dr_str, "GPKG") ||
+	    streq(dr_str, "SQLite") ||
+	    streq(dr_str, "PostgreSQL"))
+	{
+		return "";
+	}
+	if (streq(dr_str, "FileGDB") ||
+	    streq(dr_str, "OpenFileGDB"))
+	{
+		return "SQLITE";
+	}
+	return NULL;
+}
+
+/*
+ * Is the expression the table's FID column?
+ */
+static bool
+ogrIsFidVar(Expr* expr, const RelOptInfo* baserel, int fidattno)
+{
+	Var* var;
+
+	if (IsA(expr, RelabelType))
+		expr = ((RelabelType*) expr)->arg;
+	if (!IsA(expr, Var))
+		return false;
+
+	var = (Var*) expr;
+	return var->varno == baserel->relid && var->varattno == fidattno && var->varlevelsup == 0;
+}
+
+/*
+ * The value a clause looks the FID up by, when it is
+ * "fid = value" or "fid = ANY(value)", and the value is an
+ * integer (or integer array) that doesn't depend on the table.
+ * NULL for any other clause.
+ */
+static Expr*
+ogrFidClauseValue(PlannerInfo* root, RestrictInfo* rinfo, RelOptInfo* baserel, int fidattno, bool* isarray)
+{
+	Expr* clause = rinfo->clause;
+	Expr* left;
+	Expr* right;
+	Oid opno;
+	Oid type;
+	char* opname;
+
+	if (IsA(clause, OpExpr) && list_length(((OpExpr*) clause)->args) == 2)
+	{
+		OpExpr* op = (OpExpr*) clause;
+		left = linitial(op->args);
+		right = lsecond(op->args);
+		opno = op->opno;
+		*isarray = false;
+
+		/* Either way round */
+		if (!ogrIsFidVar(left, baserel, fidattno))
+		{
+			Expr* tmp = left;
+			left = right;
+			right = tmp;
+		}
+	}
+	else if (IsA(clause, ScalarArrayOpExpr) && ((ScalarArrayOpExpr*) clause)->useOr)
+	{
+		ScalarArrayOpExpr* saop = (ScalarArrayOpExpr*) clause;
+		left = linitial(saop->args);
+		right = lsecond(saop->args);
+		opno = saop->opno;
+		*isarray = true;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	if (!ogrIsFidVar(left, baserel, fidattno))
+		return NULL;
+
+	opname = get_opname(opno);
+	if (!opname || !streq(opname, "="))
+		return NULL;
+
+#if PG_VERSION_NUM >= 140000
+	if (bms_is_member(baserel->relid, pull_varnos(root, (Node*) right)))
+#else
+	if (bms_is_member(baserel->relid, pull_varnos((Node*) right)))
+#endif
+		return NULL;
+
+	if (contain_volatile_functions((Node*) right))
+		return NULL;
+
+	type = exprType((Node*) right);
+	if (*isarray)
+		type = get_element_type(type);
+	if (type != INT2OID && type != INT4OID && type != INT8OID)
+		return NULL;
+
+	return right;
+}
+
+/*
+ * Equivalence class members that are the FID column, to find
+ * the join clauses a parameterized FID lookup can use.
+ */
+static bool
+ogrFidEcMemberMatches(PlannerInfo* root, RelOptInfo* rel, EquivalenceClass* ec, EquivalenceMember* em, void* arg)
+{
+	return ogrIsFidVar(em->em_expr, rel, *((int*) arg));
+}
+
+/*
+ * Add a path fetching features by FID, with the value of
+ * the FID clause going in its fdw_private. A parameterized
+ * one takes the FIDs from the outer side of a nested loop.
+ */
+static void
+ogrAddFidPath(PlannerInfo* root, RelOptInfo* baserel, OgrFdwPlanState* planstate,
+              Expr* value, bool isarray, Relids required_outer)
+{
+	double nfids = 1;
+	double rows = baserel->rows;
+
+	if (isarray)
+	{
+		if (IsA(value, Const) && !((Const*) value)->constisnull)
+		{
+			ArrayType* arr = DatumGetArrayTypeP(((Const*) value)->constvalue);
+			nfids = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+		}
+		else if (IsA(value, ArrayExpr))
+		{
+			nfids = list_length(((ArrayExpr*) value)->elements);
+		}
+		else
+		{
+			nfids = 10;
+		}
+	}
+
+	if (required_outer)
+		rows = get_baserel_parampathinfo(root, baserel, required_outer)->ppi_rows;
+
+	add_path(baserel,
+	         (Path*) create_foreignscan_path(root, baserel,
+	                 NULL, /* PathTarget */
+	                 rows,
+#if PG_VERSION_NUM >= 180000
+	                 0,       /* disabled_nodes */
+#endif
+	                 planstate->startup_cost,
+	                 planstate->startup_cost + nfids * OGR_FDW_LOOKUP_COST,
+	                 NIL,     /* no pathkeys */
+	                 required_outer,
+	                 NULL     /* no extra plan */
+#if PG_VERSION_NUM >= 170000
+	                 , NIL    /* no fdw_restrictinfo list */
+#endif
+	                 , list_make1(value)
+	                                        )
+	        );
+}
+
+/*
+ * Layers that read features by FID without scanning (OGR's
+ * random read) get a path looking up FIDs given in the query,
+ * and parameterized ones looking up FIDs from other tables.
+ */
+static void
+ogrAddFidPaths(PlannerInfo* root, RelOptInfo* baserel, OgrFdwPlanState* planstate)
+{
+	OgrFdwTable* tbl;
+	List* clauses;
+	ListCell* lc;
+	int fidattno = 0;
+	int i;
+
+	if (OGR_L_TestCapability(planstate->ogr.lyr, OLCRandomRead) != TRUE)
+		return;
+
+	ogrReadColumnData((OgrFdwState*) planstate);
+	tbl = planstate->table;
+	for (i = 0; i < tbl->ncols; i++)
+	{
+		if (tbl->cols[i].ogrvariant == OGR_FID && !tbl->cols[i].pgattisdropped)
+			fidattno = tbl->cols[i].pgattnum;
+	}
+	if (!fidattno)
+		return;
+
+	/* FIDs from the query */
+	foreach (lc, baserel->baserestrictinfo)
+	{
+		bool isarray;
+		Expr* value = ogrFidClauseValue(root, (RestrictInfo*) lfirst(lc), baserel, fidattno, &isarray);
+
+		if (value)
+		{
+			ogrAddFidPath(root, baserel, planstate, value, isarray, NULL);
+			break;
+		}
+	}
+
+	/* FIDs from other tables, by equality with the FID column or plain join clauses */
+	clauses = generate_implied_equalities_for_column(root, baserel,
+	                                                 ogrFidEcMemberMatches, (void*) &fidattno,
+	                                                 baserel->lateral_referencers);
+	clauses = list_concat(clauses, list_copy(baserel->joininfo));
+
+	foreach (lc, clauses)
+	{
+		RestrictInfo* rinfo = (RestrictInfo*) lfirst(lc);
+		Relids required_outer;
+		bool isarray;
+		Expr* value;
+
+		if (!join_clause_is_movable_to(rinfo, baserel))
+			continue;
+
+		value = ogrFidClauseValue(root, rinfo, baserel, fidattno, &isarray);
+		if (!value)
+			continue;
+
+		required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+		required_outer = bms_del_member(required_outer, baserel->relid);
+		if (bms_is_empty(required_outer))
+			continue;
+
+		ogrAddFidPath(root, baserel, planstate, value, isarray, required_outer);
+	}
+}
+
+/*
+ * Any plain column of the table, to find the join clauses
+ * a parameterized scan can filter on.
+ */
+static bool
+ogrEcMemberMatches(PlannerInfo* root, RelOptInfo* rel, EquivalenceClass* ec, EquivalenceMember* em, void* arg)
+{
+	Expr* expr = em->em_expr;
+
+	if (IsA(expr, RelabelType))
+		expr = ((RelabelType*) expr)->arg;
+
+	return IsA(expr, Var) && ((Var*) expr)->varno == rel->relid && ((Var*) expr)->varlevelsup == 0;
+}
+
+/*
+ * Data sources whose attribute filters use indexes get
+ * parameterized paths, filtering on the join clauses with
+ * the values of each outer row, so a nested loop turns
+ * into an index lookup per outer row instead of a full
+ * scan. Layers with a spatial index get them for spatial
+ * join clauses too, setting the spatial filter from the
+ * outer geometry. Other drivers would read the whole layer
+ * for every outer row, which is never better than one
+ * plain scan.
+ */
+static void
+ogrAddParamPaths(PlannerInfo* root, RelOptInfo* baserel, OgrFdwPlanState* planstate)
+{
+	OgrFdwState* state = (OgrFdwState*) planstate;
+	List* clauses;
+	List* outers = NIL;
+	ListCell* lc;
+	bool indexed_sql, indexed_spatial;
+
+	indexed_sql = ogrRemoteDialect(&(planstate->ogr)) != NULL;
+	indexed_spatial = OGR_L_TestCapability(planstate->ogr.lyr, OLCFastSpatialFilter);
+	if (!indexed_sql && !indexed_spatial)
+		return;
+
+	ogrReadColumnData(state);
+
+	clauses = generate_implied_equalities_for_column(root, baserel,
+	                                                 ogrEcMemberMatches, NULL,
+	                                                 baserel->lateral_referencers);
+	clauses = list_concat(clauses, list_copy(baserel->joininfo));
+
+	foreach (lc, clauses)
+	{
+		RestrictInfo* rinfo = (RestrictInfo*) lfirst(lc);
+		Relids required_outer;
+		ParamPathInfo* ppi;
+		StringInfoData sql;
+		List* params_list = NIL;
+		OgrFdwSpatialFilter* spatial_filter = NULL;
+		ListCell* lco;
+		bool seen = false;
+
+		if (!join_clause_is_movable_to(rinfo, baserel))
+			continue;
+
+		required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+		required_outer = bms_del_member(required_outer, baserel->relid);
+		if (bms_is_empty(required_outer))
+			continue;
+
+		/* One path for each set of outer tables, filtering on all their clauses */
+		foreach (lco, outers)
+		{
+			if (bms_equal((Relids) lfirst(lco), required_outer))
+				seen = true;
+		}
+		if (seen)
+			continue;
+
+		/* Only clauses that filter on the outer values are any use */
+		initStringInfo(&sql);
+		ogrDeparse(&sql, root, baserel, list_make1(rinfo), state, &params_list, &spatial_filter, NULL);
+		if (!(indexed_sql && sql.len > 0 && params_list) &&
+		    !(indexed_spatial && spatial_filter && spatial_filter->param))
+			continue;
+
+		outers = lappend(outers, required_outer);
+		ppi = get_baserel_parampathinfo(root, baserel, required_outer);
+
+		if (sql.len > 0)
+			elog(DEBUG2, "%s: parameterized path filtering on %s", __func__, sql.data);
+		else
+			elog(DEBUG2, "%s: parameterized path filtering on outer geometry", __func__);
+
+		add_path(baserel,
+		         (Path*) create_foreignscan_path(root, baserel,
+		                 NULL, /* PathTarget */
+		                 ppi->ppi_rows,
+#if PG_VERSION_NUM >= 180000
+		                 0,       /* disabled_nodes */
+#endif
+		                 planstate->startup_cost,
+		                 planstate->startup_cost + OGR_FDW_LOOKUP_COST + ppi->ppi_rows,
+		                 NIL,     /* no pathkeys */
+		                 required_outer,
+		                 NULL     /* no extra plan */
+#if PG_VERSION_NUM >= 170000
+		                 , NIL    /* no fdw_restrictinfo list */
+#endif
+		                 , NIL    /* no fdw_private list */
+		                                        )
+		        );
+	}
+}
+
+/*
+ * ogrGetForeignPaths
+ *		Create possible access paths for a scan on the foreign table
+ *
+ *		The plain path reads all records in the order in the data
+ *		file, filtered by whatever of the WHERE clause OGR can take.
+ *		Layers that allow it also get a parallel path sharing out
+ *		chunks of the layer, FID lookup paths for conditions on the
+ *		FID column, and paths parameterized by the outer rows of a
+ *		nested loop.
+ */
+static void
+ogrGetForeignPaths(PlannerInfo* root,
+                   RelOptInfo* baserel,
+                   Oid foreigntableid)
+{
+	OgrFdwPlanState* planstate = (OgrFdwPlanState*)(baserel->fdw_private);
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	/* TODO: replace this with something that looks at the OGRDriver and */
+	/* makes a determination based on that? Better: add connection caching */
+	/* so that slow startup doesn't matter so much */
+	planstate->startup_cost = 25;
 
 	/* TODO: more research on what the total cost is supposed to mean, */
 	/* relative to the startup cost? */
 	planstate->total_cost = planstate->startup_cost + baserel->rows;
 
-	/* Built the (one) path we are providing. Providing fancy paths is */
-	/* really only possible with back-ends that can properly provide */
-	/* explain info on how they complete the query, not for something as */
-	/* obtuse as OGR. (So far, have only seen it w/ the postgres_fdw */
-	add_path(baserel,
-	         (Path*) create_foreignscan_path(root, baserel,
-#if PG_VERSION_NUM >= 90600
-	                 NULL, /* PathTarget */
+	/* Built the (one) path we are providing. Providing fancy paths is */
+	/* really only possible with back-ends that can properly provide */
+	/* explain info on how they complete the query, not for something as */
+	/* obtuse as OGR. (So far, have only seen it w/ the postgres_fdw */
+	add_path(baserel,
+	         (Path*) create_foreignscan_path(root, baserel,
+#if PG_VERSION_NUM >= 90600
+	                 NULL, /* PathTarget */
+#endif
+	                 baserel->rows,
+#if PG_VERSION_NUM >= 180000
+	                 0,       /* disabled_nodes */
+#endif
+	                 planstate->startup_cost,
+	                 planstate->total_cost,
+	                 NIL,     /* no pathkeys */
+	                 NULL,    /* no lateral_relids */
+	                 NULL  /* no extra plan */
+#if PG_VERSION_NUM >= 170000
+	                 , NIL /* no fdw_restrictinfo list */
+#endif
+#if PG_VERSION_NUM >= 90500
+	                 , NIL /* no fdw_private list */
+#endif
+	                                        )
+	        );   /* no fdw_private data */
+
+	/* Big layers that can be read from any offset can be split among workers */
+	ogrAddParallelPath(root, baserel, planstate);
+
+	/* Layers that can fetch features by FID can skip the scan */
+	ogrAddFidPaths(root, baserel, planstate);
+
+	/* Nested loops can filter on the values of each outer row */
+	ogrAddParamPaths(root, baserel, planstate);
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Can the layer answer this aggregate from its metadata,
+ * without reading features? That is count(*), for layers
+ * that count fast, and ST_Extent() of a geometry column,
+ * for layers that know their exact extent.
+ */
+static bool
+ogrAggregateIsSupported(const Aggref* agg, const RelOptInfo* baserel, const OgrFdwState* state, int* kind, int* ogrfldnum)
+{
+	char* fname;
+
+	if (agg->aggfilter || agg->aggdistinct || agg->aggorder ||
+	    agg->aggkind != AGGKIND_NORMAL || agg->aggsplit != AGGSPLIT_SIMPLE)
+		return false;
+
+	fname = get_func_name(agg->aggfnoid);
+	if (!fname)
+		return false;
+
+	if (agg->aggstar && streq(fname, "count") &&
+	    get_func_namespace(agg->aggfnoid) == PG_CATALOG_NAMESPACE)
+	{
+		if (OGR_L_TestCapability(state->ogr.lyr, OLCFastFeatureCount) != TRUE ||
+		    !ogrCanReallyCountFast(&(state->ogr)))
+			return false;
+
+		*kind = OGR_AGG_COUNT;
+		*ogrfldnum = -1;
+		return true;
+	}
+
+	if (streq(fname, "st_extent") && list_length(agg->args) == 1)
+	{
+		Var* var = (Var*) ((TargetEntry*) linitial(agg->args))->expr;
+		int i;
+
+		if (!IsA(var, Var) || var->varno != baserel->relid || var->varlevelsup != 0 ||
+		    var->vartype != ogrGetGeometryOid())
+			return false;
+
+		if (OGR_L_TestCapability(state->ogr.lyr, OLCFastGetExtent) != TRUE ||
+		    !ogrCanReallyGetExtentExactly(&(state->ogr)))
+			return false;
+
+		for (i = 0; i < state->table->ncols; i++)
+		{
+			const OgrFdwColumn* col = &(state->table->cols[i]);
+			if (col->pgattnum == var->varattno && col->ogrvariant == OGR_GEOMETRY)
+			{
+				*kind = OGR_AGG_EXTENT;
+				*ogrfldnum = col->ogrfldnum;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Add a one row path answering the aggregates straight from
+ * the layer header, when there is no GROUP BY and no
+ * restriction, and every aggregate is one the layer knows.
+ */
+static void
+ogrAddMetadataAggregatePath(PlannerInfo* root, RelOptInfo* input_rel, RelOptInfo* output_rel, OgrFdwPlanState* planstate)
+{
+	OgrFdwState* state = (OgrFdwState*) planstate;
+	Query* parse = root->parse;
+	List* fdw_scan_tlist = NIL;
+	List* aggs = NIL;
+	ListCell* lc;
+	ForeignPath* path;
+
+	/* The layer only knows about all of itself */
+	if (!parse->hasAggs || parse->groupClause || input_rel->baserestrictinfo != NIL)
+		return;
+
+	/* Every aggregate in the target list has to be one we can answer */
+	foreach (lc, output_rel->reltarget->exprs)
+	{
+		List* nodes = pull_var_clause((Node*) lfirst(lc),
+		                              PVC_INCLUDE_AGGREGATES | PVC_RECURSE_PLACEHOLDERS);
+		ListCell* nc;
+
+		foreach (nc, nodes)
+		{
+			Aggref* agg = (Aggref*) lfirst(nc);
+			int kind, ogrfldnum;
+
+			if (!IsA(agg, Aggref) || !ogrAggregateIsSupported(agg, input_rel, state, &kind, &ogrfldnum))
+				return;
+
+			if (!tlist_member((Expr*) agg, fdw_scan_tlist))
+			{
+				fdw_scan_tlist = lappend(fdw_scan_tlist,
+				                         makeTargetEntry((Expr*) agg, list_length(fdw_scan_tlist) + 1, NULL, false));
+				aggs = lappend_int(aggs, kind);
+				aggs = lappend_int(aggs, ogrfldnum);
+			}
+		}
+	}
+
+	if (!fdw_scan_tlist)
+		return;
+
+	path = create_foreign_upper_path(root, output_rel,
+	                                 output_rel->reltarget,
+	                                 1,
+#if PG_VERSION_NUM >= 180000
+	                                 0,       /* disabled_nodes */
+#endif
+	                                 planstate->startup_cost,
+	                                 planstate->startup_cost + 1,
+	                                 NIL,     /* no pathkeys */
+	                                 NULL     /* no extra plan */
+#if PG_VERSION_NUM >= 170000
+	                                 , NIL    /* no fdw_restrictinfo list */
+#endif
+	                                 , list_make4(fdw_scan_tlist, aggs, makeString(NULL), makeString(NULL)) /* OgrFdwPathPrivateIndex order */
+	                                );
+
+	add_path(output_rel, (Path*) path);
+}
+
+/*
+ * Add a path running the whole aggregate query (grouping,
+ * aggregates and restrictions) in the data source's own SQL
+ * engine, so only the small result layer comes back.
+ */
+static void
+ogrAddRemoteAggregatePath(PlannerInfo* root, RelOptInfo* input_rel, RelOptInfo* output_rel, OgrFdwPlanState* planstate)
+{
+	OgrFdwState* state = (OgrFdwState*) planstate;
+	Query* parse = root->parse;
+	const char* dialect = ogrRemoteDialect(&(planstate->ogr));
+	List* fdw_scan_tlist = NIL;
+	List* groupvars = NIL;
+	StringInfoData sql;
+	ListCell* lc;
+	ForeignPath* path;
+	double rows = 1;
+	Cost startup_cost, total_cost;
+
+	if (!dialect)
+		return;
+
+	/* Only group by plain columns */
+	foreach (lc, parse->groupClause)
+	{
+		SortGroupClause* sgc = (SortGroupClause*) lfirst(lc);
+		Var* var = (Var*) get_sortgroupclause_expr(sgc, parse->targetList);
+
+		if (!IsA(var, Var) || var->varno != input_rel->relid || var->varlevelsup != 0)
+			return;
+		groupvars = lappend(groupvars, var);
+	}
+
+	/* The result carries the grouping columns and the aggregates */
+	foreach (lc, output_rel->reltarget->exprs)
+	{
+		List* nodes = pull_var_clause((Node*) lfirst(lc),
+		                              PVC_INCLUDE_AGGREGATES | PVC_RECURSE_PLACEHOLDERS);
+		ListCell* nc;
+
+		foreach (nc, nodes)
+		{
+			Node* node = (Node*) lfirst(nc);
+			if (IsA(node, Var) && !list_member(groupvars, node))
+				return;
+		}
+		fdw_scan_tlist = add_to_flat_tlist(fdw_scan_tlist, nodes);
+	}
+
+	if (!fdw_scan_tlist)
+		return;
+
+	initStringInfo(&sql);
+	if (!ogrDeparseAggregate(&sql, root, input_rel, fdw_scan_tlist, groupvars, input_rel->baserestrictinfo, state))
+	{
+		elog(DEBUG2, "%s: aggregate query not pushed down", __func__);
+		return;
+	}
+
+	if (groupvars)
+	{
+		List* groupexprs = get_sortgrouplist_exprs(parse->groupClause, parse->targetList);
+		rows = estimate_num_groups(root, groupexprs, input_rel->rows, NULL
+#if PG_VERSION_NUM >= 140000
+		                           , NULL
+#endif
+		                          );
+	}
+
+	/* The data source reads every row, but we only see the groups */
+	startup_cost = planstate->startup_cost + input_rel->rows * cpu_operator_cost;
+	total_cost = startup_cost + rows * cpu_tuple_cost;
+
+	path = create_foreign_upper_path(root, output_rel,
+	                                 output_rel->reltarget,
+	                                 rows,
+#if PG_VERSION_NUM >= 180000
+	                                 0,       /* disabled_nodes */
+#endif
+	                                 startup_cost,
+	                                 total_cost,
+	                                 NIL,     /* no pathkeys */
+	                                 NULL     /* no extra plan */
+#if PG_VERSION_NUM >= 170000
+	                                 , NIL    /* no fdw_restrictinfo list */
+#endif
+	                                 , list_make4(fdw_scan_tlist, NIL, makeString(sql.data), makeString(pstrdup(dialect))) /* OgrFdwPathPrivateIndex order */
+	                                );
+
+	add_path(output_rel, (Path*) path);
+}
+
+/*
+ * ogrGetForeignUpperPaths
+ *		Aggregate queries over a single table can skip reading
+ *		features into the executor: plain counts and extents come
+ *		from the layer metadata, and grouped aggregates can run in
+ *		the data source's own SQL engine.
+ */
+static void
+ogrGetForeignUpperPaths(PlannerInfo* root,
+                        UpperRelationKind stage,
+                        RelOptInfo* input_rel,
+                        RelOptInfo* output_rel,
+                        void* extra)
+{
+	OgrFdwPlanState* planstate = (OgrFdwPlanState*) input_rel->fdw_private;
+	Query* parse = root->parse;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	if (stage != UPPERREL_GROUP_AGG || input_rel->reloptkind != RELOPT_BASEREL ||
+	    !planstate || output_rel->fdw_private)
+		return;
+
+	if (parse->groupingSets || root->hasHavingQual ||
+	    parse->hasWindowFuncs || parse->hasTargetSRFs)
+		return;
+
+	ogrReadColumnData((OgrFdwState*) planstate);
+
+	ogrAddMetadataAggregatePath(root, input_rel, output_rel, planstate);
+	ogrAddRemoteAggregatePath(root, input_rel, output_rel, planstate);
+
+	output_rel->fdw_private = planstate;
+}
+
+/*
+ * ogrGetForeignJoinPaths
+ *		Inner joins of two layers of one data source can run as
+ *		a single query in the data source's own SQL engine, which
+ *		can use its indexes, rather than as two scans joined here.
+ *		Every join and restriction clause has to go along, since
+ *		the data source returns the joined rows ready made.
+ */
+static void
+ogrGetForeignJoinPaths(PlannerInfo* root,
+                       RelOptInfo* joinrel,
+                       RelOptInfo* outerrel,
+                       RelOptInfo* innerrel,
+                       JoinType jointype,
+                       JoinPathExtraData* extra)
+{
+	OgrFdwPlanState* outerstate = (OgrFdwPlanState*) outerrel->fdw_private;
+	OgrFdwPlanState* innerstate = (OgrFdwPlanState*) innerrel->fdw_private;
+	const char* dialect;
+	List* fdw_scan_tlist;
+	List* joinclauses = NIL;
+	StringInfoData sql;
+	ListCell* lc;
+	ForeignPath* path;
+	Cost startup_cost, total_cost;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	/* Called once for each ordering of the pair, only look once */
+	if (joinrel->fdw_private)
+		return;
+	joinrel->fdw_private = outerstate;
+
+	if (jointype != JOIN_INNER ||
+	    outerrel->reloptkind != RELOPT_BASEREL || innerrel->reloptkind != RELOPT_BASEREL ||
+	    !outerstate || !innerstate)
+		return;
+
+	/* No rechecking of locked rows, which would need the base scans */
+	if (root->parse->commandType != CMD_SELECT || root->rowMarks ||
+	    !bms_is_empty(joinrel->lateral_relids))
+		return;
+
+	/* Both tables are on one server, so the data source is the same */
+	dialect = ogrRemoteDialect(&(outerstate->ogr));
+	if (!dialect)
+		return;
+
+	/* Constant gating quals aren't ours to run, and cross joins are better done here */
+	foreach (lc, extra->restrictlist)
+	{
+		RestrictInfo* rinfo = (RestrictInfo*) lfirst(lc);
+		if (rinfo->pseudoconstant)
+			return;
+		joinclauses = lappend(joinclauses, rinfo);
+	}
+	if (!joinclauses)
+		return;
+
+	ogrReadColumnData((OgrFdwState*) outerstate);
+	ogrReadColumnData((OgrFdwState*) innerstate);
+
+	/* The join returns the columns needed above it */
+	fdw_scan_tlist = add_to_flat_tlist(NIL, pull_var_clause((Node*) joinrel->reltarget->exprs,
+	                                                        PVC_RECURSE_PLACEHOLDERS));
+
+	initStringInfo(&sql);
+	if (!ogrDeparseJoin(&sql, root,
+	                    outerrel, (OgrFdwState*) outerstate,
+	                    innerrel, (OgrFdwState*) innerstate,
+	                    fdw_scan_tlist, joinclauses))
+	{
+		elog(DEBUG2, "%s: join query not pushed down", __func__);
+		return;
+	}
+
+	/*
+	 * The data source reads both tables, at the same cost per row
+	 * as our own scans of them, and we only see the joined rows.
+	 * The SQLite dialect runs over OGR virtual tables with no
+	 * indexes, so can end up reading the inner table for every
+	 * outer row.
+	 */
+	startup_cost = outerstate->total_cost + innerstate->total_cost +
+	               (outerrel->rows + innerrel->rows) * cpu_operator_cost;
+	if (*dialect)
+		startup_cost += outerrel->rows * innerrel->rows * cpu_operator_cost;
+	total_cost = startup_cost + joinrel->rows * cpu_tuple_cost;
+
+	path = create_foreign_join_path(root, joinrel,
+	                                NULL,    /* default pathtarget */
+	                                joinrel->rows,
+#if PG_VERSION_NUM >= 180000
+	                                0,       /* disabled_nodes */
+#endif
+	                                startup_cost,
+	                                total_cost,
+	                                NIL,     /* no pathkeys */
+	                                joinrel->lateral_relids,
+	                                NULL     /* no extra plan */
+#if PG_VERSION_NUM >= 170000
+	                                , NIL    /* no fdw_restrictinfo list */
+#endif
+	                                , list_make4(fdw_scan_tlist, NIL, makeString(sql.data), makeString(pstrdup(dialect))) /* OgrFdwPathPrivateIndex order */
+	                               );
+
+	add_path(joinrel, (Path*) path);
+}
+#endif /* PG_VERSION_NUM >= 120000 */
+
+/*
+ * Convert an OgrFdwSpatialFilter into a List so it can
+ * be safely passed through the fdw_private list.
+ */
+static List*
+ogrSpatialFilterToList(const OgrFdwSpatialFilter* spatial_filter)
+{
+	List *l = NIL;
+	if (spatial_filter)
+	{
+		l = lappend(l, makeInteger(spatial_filter->ogrfldnum));
+		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->minx)));
+		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->miny)));
+		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->maxx)));
+		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->maxy)));
+		l = lappend(l, makeString(spatial_filter->hexwkb));
+		l = lappend(l, makeInteger(spatial_filter->param));
+		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->distance)));
+		l = lappend(l, makeInteger(spatial_filter->exact));
+		l = lappend(l, makeString(spatial_filter->colname));
+	}
+	return l;
+}
+
+/*
+ * Convert the List form back into an OgrFdwSpatialFilter
+ * after passing through fdw_private.
+ */
+static OgrFdwSpatialFilter*
+ogrSpatialFilterFromList(const List* lst)
+{
+	OgrFdwSpatialFilter* spatial_filter;
+
+	if (lst == NIL)
+		return NULL;
+
+	Assert(list_length(lst) == 10);
+
+	spatial_filter = palloc(sizeof(OgrFdwSpatialFilter));
+	spatial_filter->ogrfldnum = intVal(linitial(lst));
+	spatial_filter->minx = floatVal(lsecond(lst));
+	spatial_filter->miny = floatVal(lthird(lst));
+	spatial_filter->maxx = floatVal(lfourth(lst));
+	spatial_filter->maxy = floatVal(list_nth(lst, 4)); /* list_nth counts from zero */
+	spatial_filter->hexwkb = strVal(list_nth(lst, 5));
+	spatial_filter->param = intVal(list_nth(lst, 6));
+	spatial_filter->distance = floatVal(list_nth(lst, 7));
+	spatial_filter->exact = intVal(list_nth(lst, 8));
+	spatial_filter->colname = strVal(list_nth(lst, 9));
+	return spatial_filter;
+}
+
+/*
+ * Collect the attribute numbers (one based) of the columns
+ * a scan has to fill: everything in the relation target list,
+ * plus everything the restriction clauses refer to, whether
+ * they end up evaluated locally or by OGR. A whole-row
+ * reference, or a scan feeding an UPDATE/DELETE, needs them all.
+ */
+static List*
+ogrGetRetrievedAttrs(PlannerInfo* root, RelOptInfo* baserel, const OgrFdwTable* tbl)
+{
+	Bitmapset* attrs_used = NULL;
+	List* retrieved_attrs = NIL;
+	ListCell* lc;
+	bool wholerow;
+	int i;
+
+	pull_varattnos((Node*) baserel->reltarget->exprs, baserel->relid, &attrs_used);
+	foreach(lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo* rinfo = (RestrictInfo*) lfirst(lc);
+		pull_varattnos((Node*) rinfo->clause, baserel->relid, &attrs_used);
+	}
+
+	wholerow = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber, attrs_used) ||
+	           root->parse->resultRelation == baserel->relid;
+
+	for (i = 1; i <= tbl->ncols; i++)
+	{
+		if (wholerow || bms_is_member(i - FirstLowInvalidHeapAttributeNumber, attrs_used))
+			retrieved_attrs = lappend_int(retrieved_attrs, i);
+	}
+
+	bms_free(attrs_used);
+	return retrieved_attrs;
+}
+
+/*
+ * How many rows the query can use from this scan, when a
+ * LIMIT caps it, or -1. The planner works the bound out
+ * (root->limit_tuples, which already excludes grouping and
+ * aggregates), but it only carries over to the scan when
+ * the table is the whole query, nothing has to be sorted
+ * first, and there are no restrictions: the executor
+ * re-checks every clause, and OGR filters (bounding boxes
+ * in particular) can let through rows that then get
+ * dropped, so a scan cut short could come up short.
+ */
+static int
+ogrGetScanLimit(PlannerInfo* root, RelOptInfo* baserel)
+{
+	if (root->limit_tuples < 0 || root->limit_tuples > INT_MAX)
+		return -1;
+
+	if (baserel->reloptkind != RELOPT_BASEREL ||
+	    bms_membership(root->all_baserels) != BMS_SINGLETON ||
+	    root->query_pathkeys != NIL ||
+	    baserel->baserestrictinfo != NIL)
+		return -1;
+
+	return (int) root->limit_tuples;
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Create the ForeignScan for an aggregate or join path. It
+ * has no scan relation, so the table to connect through goes
+ * in fdw_private, and the aggregates (and grouping columns)
+ * or joined columns it returns form its scan tuple.
+ */
+static ForeignScan*
+ogrGetForeignPushdownPlan(PlannerInfo* root,
+                          RelOptInfo* rel,
+                          ForeignPath* best_path,
+                          List* tlist,
+                          Plan* outer_plan)
+{
+	OgrFdwPlanState* planstate = (OgrFdwPlanState*)(rel->fdw_private);
+	List* fdw_scan_tlist = (List*) list_nth(best_path->fdw_private, OgrFdwPathPrivateScanTlist);
+	List* aggs = (List*) list_nth(best_path->fdw_private, OgrFdwPathPrivateAggs);
+	Node* remotesql = (Node*) list_nth(best_path->fdw_private, OgrFdwPathPrivateRemoteSQL);
+	Node* dialect = (Node*) list_nth(best_path->fdw_private, OgrFdwPathPrivateDialect);
+	List* fdw_private;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	/* In OgrFdwScanPrivateIndex order */
+	fdw_private = list_make4(makeString(NULL), NIL, NIL, NIL);
+	fdw_private = lappend(fdw_private, makeInteger(-1));
+	fdw_private = lappend(fdw_private, aggs);
+	fdw_private = lappend(fdw_private, makeInteger((int) planstate->foreigntableid));
+	fdw_private = lappend(fdw_private, remotesql);
+	fdw_private = lappend(fdw_private, dialect);
+	fdw_private = lappend(fdw_private, makeInteger(-1));
+	fdw_private = lappend(fdw_private, makeInteger(0));
+	Assert(list_length(fdw_private) == OgrFdwScanPrivateCount);
+
+	if (strVal(remotesql))
+		elog(DEBUG1, "OGR data source SQL: %s", strVal(remotesql));
+
+	/* Clean up our connections, one for each table of a join */
+	if (IS_JOIN_REL(rel))
+	{
+		int relid = -1;
+		while ((relid = bms_next_member(rel->relids, relid)) >= 0)
+		{
+			OgrFdwPlanState* relstate = (OgrFdwPlanState*) find_base_rel(root, relid)->fdw_private;
+			ogrFinishConnection(&(relstate->ogr));
+		}
+	}
+	else
+	{
+		ogrFinishConnection(&(planstate->ogr));
+	}
+
+	return make_foreignscan(tlist,
+	                        NIL,  /* no local quals */
+	                        0,    /* no scan relation */
+	                        NIL,  /* no expressions to evaluate */
+	                        fdw_private,
+	                        fdw_scan_tlist,
+	                        NIL,  /* no remote quals */
+	                        outer_plan);
+}
+#endif
+
+/*
+ * fileGetForeignPlan
+ *		Create a ForeignScan plan node for scanning the foreign table
+ */
+static ForeignScan*
+ogrGetForeignPlan(PlannerInfo* root,
+                  RelOptInfo* baserel,
+                  Oid foreigntableid,
+                  ForeignPath* best_path,
+                  List* tlist,
+                  List* scan_clauses
+#if PG_VERSION_NUM >= 90500
+                  , Plan* outer_plan
+#endif
+                 )
+{
+	Index scan_relid = baserel->relid;
+	bool sql_generated;
+	StringInfoData sql;
+	List* params_list = NULL;
+	List* fdw_private;
+	OgrFdwPlanState* planstate = (OgrFdwPlanState*)(baserel->fdw_private);
+	OgrFdwState* state = (OgrFdwState*)(baserel->fdw_private);
+	OgrFdwSpatialFilter* spatial_filter = NULL;
+	char* attribute_filter = NULL;
+	List* retrieved_attrs;
+	List* fdw_exprs;
+	int limit;
+	int fididx = -1;
+	int batchparam;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+#if PG_VERSION_NUM >= 120000
+	/* Aggregates and joins, answered by the layer or the data source */
+	if (IS_UPPER_REL(baserel) || IS_JOIN_REL(baserel))
+		return ogrGetForeignPushdownPlan(root, baserel, best_path, tlist, outer_plan);
+#endif
+
+	/* Add in column mapping data to build SQL with the right OGR column names */
+	ogrReadColumnData(state);
+
+	/* Work out which columns the executor will actually look at */
+	retrieved_attrs = ogrGetRetrievedAttrs(root, baserel, state->table);
+
+	initStringInfo(&sql);
+	sql_generated = ogrDeparse(&sql, root, baserel, scan_clauses, state, &params_list, &spatial_filter, &batchparam);
+
+	/* Extract the OGR SQL from the StringInfoData */
+	if (sql_generated && sql.len > 0)
+		attribute_filter = sql.data;
+
+	/* Log filters at debug level one as necessary */
+	if (attribute_filter)
+		elog(DEBUG1, "OGR SQL: %s", attribute_filter);
+	if (spatial_filter && spatial_filter->param)
+		elog(DEBUG1, "OGR spatial filter from parameter $%d", spatial_filter->param);
+	else if (spatial_filter)
+		elog(DEBUG1, "OGR spatial filter (%g %g, %g %g)",
+		             spatial_filter->minx, spatial_filter->miny,
+		             spatial_filter->maxx, spatial_filter->maxy);
+	if (spatial_filter && spatial_filter->hexwkb)
+		elog(DEBUG2, "%s: spatial filter on the geometry itself", __func__);
+
+	/* Scans under a LIMIT can stop reading early */
+	limit = ogrGetScanLimit(root, baserel);
+	if (limit >= 0)
+		elog(DEBUG2, "%s: scan limited to %d rows", __func__, limit);
+	/*
+	 * Here we strip RestrictInfo
+	 * nodes from the clauses and ignore pseudoconstants (which will be
+	 * handled elsewhere).
+	 * Some FDW implementations (mysql_fdw) just pass this full list on to the
+	 * make_foreignscan function. postgres_fdw carefully separates local and remote
+	 * clauses and only passes the local ones to make_foreignscan, so this
+	 * is probably best practice, though re-applying the clauses is probably
+	 * the least of our performance worries with this fdw. For now, we just
+	 * pass them all to make_foreignscan, see no evil, etc.
+	 */
+	scan_clauses = extract_actual_clauses(scan_clauses, false);
+
+	/*
+	 * The filter parameters, and for a FID lookup path the FID
+	 * value after them. Outer columns in a parameterized path's
+	 * FID value become nestloop Params once we return.
+	 */
+	fdw_exprs = params_list;
+	if (best_path->fdw_private)
+	{
+		fididx = list_length(params_list);
+		fdw_exprs = lappend(list_copy(params_list), linitial(best_path->fdw_private));
+	}
+
+	/* Pack the data we want to pass to the execution stage into a List. */
+	/* The members of this list must by copyable by PgSQL, which means */
+	/* they need to be Lists themselves, or Value nodes, otherwise when */
+	/* the plan gets copied the copy might fail. They go in */
+	/* OgrFdwScanPrivateIndex order. */
+	fdw_private = list_make4(makeString(attribute_filter),
+	                         params_list,
+	                         ogrSpatialFilterToList(spatial_filter),
+	                         retrieved_attrs);
+	fdw_private = lappend(fdw_private, makeInteger(limit));
+	fdw_private = lappend(fdw_private, NIL); /* no aggregates */
+	fdw_private = lappend(fdw_private, makeInteger((int) foreigntableid));
+	fdw_private = lappend(fdw_private, makeString(NULL)); /* no aggregate SQL */
+	fdw_private = lappend(fdw_private, makeString(NULL));
+	fdw_private = lappend(fdw_private, makeInteger(fididx));
+	fdw_private = lappend(fdw_private, makeInteger(batchparam));
+	Assert(list_length(fdw_private) == OgrFdwScanPrivateCount);
+
+	/* Clean up our connection */
+	ogrFinishConnection(&(planstate->ogr));
+
+	/* Create the ForeignScan node */
+	return make_foreignscan(tlist,
+	                        scan_clauses,
+	                        scan_relid,
+	                        fdw_exprs,
+	                        fdw_private
+#if PG_VERSION_NUM >= 90500
+	                        , NIL /* no scan_tlist */
+	                        , NIL  /* no remote quals */
+	                        , outer_plan
+#endif
+	                       );
+
+
+}
+
+static bool
+pgCanConvertToOgr(Oid pg_type, OGRFieldType ogr_type)
+{
+	struct PgOgrMap
+	{
+		Oid pg;
+		OGRFieldType ogr;
+	};
+
+	static struct PgOgrMap data[] = {
+		{BOOLOID, OFTInteger}, /* 16 */
+		{BYTEAOID, OFTBinary}, /* 17 */
+		{CHAROID, OFTString},  /* 18 */
+		{NAMEOID, OFTString},  /* 19 */
+#if GDAL_VERSION_MAJOR >= 2
+		{INT8OID, OFTInteger64}, /* 20 */
+#else
+		{INT8OID, OFTInteger}, /* 20 */
+#endif
+		{INT2OID, OFTInteger}, /* 21 */
+		{INT4OID, OFTInteger}, /* 23 */
+		{TEXTOID, OFTString},  /* 25 */
+		{FLOAT4OID, OFTReal},  /* 700 */
+		{FLOAT8OID, OFTReal},  /* 701 */
+		{BOOLARRAYOID, OFTIntegerList}, /* 1000 */
+		{CHARARRAYOID, OFTStringList}, /* 1002 */
+		{NAMEARRAYOID, OFTStringList}, /* 1003 */
+		{INT2ARRAYOID, OFTIntegerList}, /* 1005 */
+		{INT4ARRAYOID, OFTIntegerList}, /* 1007 */
+		{TEXTARRAYOID, OFTStringList}, /* 1009 */
+		{VARCHARARRAYOID, OFTStringList}, /* 1015 */
+#if GDAL_VERSION_MAJOR >= 2
+		{INT8ARRAYOID, OFTInteger64List}, /* 1016 */
+#endif
+		{FLOAT4ARRAYOID, OFTRealList}, /* 1021 */
+		{FLOAT8ARRAYOID, OFTRealList}, /* 1022 */
+		{BPCHAROID, OFTString}, /* 1042 */
+		{VARCHAROID, OFTString}, /* 1043 */
+		{DATEOID, OFTDate}, /* 1082 */
+		{TIMEOID, OFTTime}, /* 1083 */
+		{TIMESTAMPOID, OFTDateTime}, /* 1114 */
+		{NUMERICOID, OFTReal}, /* 1700 */
+		{0, 0}};
+
+	struct PgOgrMap* map = data;
+	while (map->pg)
+	{
+		if (ogr_type == map->ogr) return true;
+		else map++;
+	}
+	return false;
+
+}
+
+
+static void
+pgCheckConvertToOgr(Oid pg_type, OGRFieldType ogr_type, const char *colname, const char *tblname)
+{
+	if (pgCanConvertToOgr(pg_type, ogr_type))
+		return;
+
+	ereport(ERROR, (
+	    errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+	    errmsg("column \"%s\" of foreign table \"%s\" converts \"%s\" to OGR \"%s\"",
+	        colname, tblname,
+	        format_type_be(pg_type), OGR_GetFieldTypeName(ogr_type))
+	    ));
+}
+
+
+static bool
+ogrCanConvertToPg(OGRFieldType ogr_type, Oid pg_type)
+{
+	struct OgrPgMap
+	{
+		OGRFieldType ogr;
+		Oid pg[16];
+	};
+
+	static struct OgrPgMap data[] =
+	{
+		{OFTInteger, {BOOLOID, INT2OID, INT4OID, INT8OID, NUMERICOID, FLOAT4OID, FLOAT8OID, TEXTOID, VARCHAROID, 0}},
+		{OFTReal, {NUMERICOID, FLOAT4OID, FLOAT8OID, TEXTOID, VARCHAROID, 0}},
+		{OFTBinary, {BYTEAOID, 0}},
+		{OFTString, {TEXTOID, VARCHAROID, CHAROID, BPCHAROID, JSONBOID, JSONOID, 0}},
+		{OFTDate, {DATEOID, TIMESTAMPOID, TIMESTAMPTZOID, TEXTOID, VARCHAROID, 0}},
+		{OFTTime, {TIMEOID, TEXTOID, VARCHAROID, 0}},
+		{OFTDateTime, {TIMESTAMPOID, TIMESTAMPTZOID, TEXTOID, VARCHAROID, 0}},
+	#if GDAL_VERSION_MAJOR >= 2
+		{OFTInteger64, {INT8OID, NUMERICOID, FLOAT8OID, TEXTOID, VARCHAROID, 0}},
+		{OFTInteger64List, {INT8ARRAYOID, FLOAT8ARRAYOID, TEXTARRAYOID, VARCHARARRAYOID, 0}},
+	#endif
+		{OFTRealList, {FLOAT4ARRAYOID, FLOAT8ARRAYOID, TEXTARRAYOID, VARCHARARRAYOID, 0}},
+		{OFTStringList, {TEXTARRAYOID, VARCHARARRAYOID, NAMEARRAYOID, CHARARRAYOID, 0}},
+		{OFTIntegerList, {BOOLARRAYOID, INT2ARRAYOID, INT4ARRAYOID, INT8ARRAYOID, TEXTARRAYOID, VARCHARARRAYOID, 0}},
+		{256, {0}} /* Zero terminate list */
+	};
+
+	struct OgrPgMap* map = data;
+	while (map->ogr <= OFTMaxType)
+	{
+		if (ogr_type == map->ogr)
+		{
+			Oid *typ = map->pg;
+			while (*typ)
+			{
+				if (pg_type == *typ) return true;
+				else typ++;
+			}
+		}
+		map++;
+	}
+
+	return false;
+}
+
+static void
+ogrCheckConvertToPg(OGRFieldType ogr_type, Oid pg_type, const char *colname, const char *tblname)
+{
+	if (ogrCanConvertToPg(ogr_type, pg_type))
+		return;
+
+	if (ogr_type == OFTWideString || ogr_type == OFTWideStringList)
+	{
+		ereport(ERROR, (
+		    errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+		    errmsg("column \"%s\" of foreign table \"%s\" uses an OGR OFTWideString, deprecated", colname, tblname)
+		    ));
+		return;
+	}
+
+	ereport(ERROR, (
+	    errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+	    errmsg("column \"%s\" of foreign table \"%s\" converts OGR \"%s\" to \"%s\"",
+	           colname, tblname,
+	           OGR_GetFieldTypeName(ogr_type), format_type_be(pg_type))
+	    ));
+}
+
+
+#ifdef OGR_FDW_HEXWKB
+
+static char* hexchr = "0123456789ABCDEF";
+
+static char*
+ogrBytesToHex(unsigned char* bytes, size_t size)
+{
+	char* hex;
+	int i;
+	if (! bytes || ! size)
+	{
+		elog(ERROR, "ogrBytesToHex: invalid input");
+		return NULL;
+	}
+	hex = palloc(size * 2 + 1);
+	hex[2 * size] = '\0';
+	for (i = 0; i < size; i++)
+	{
+		/* Top four bits to 0-F */
+		hex[2 * i] = hexchr[bytes[i] >> 4];
+		/* Bottom four bits to 0-F */
+		hex[2 * i + 1] = hexchr[bytes[i] & 0x0F];
+	}
+	return hex;
+}
+
+#endif
+
+typedef struct
+{
+	char* fldname;
+	int fldnum;
+} OgrFieldEntry;
+
+static int
+ogrFieldEntryCmpFunc(const void* a, const void* b)
+{
+	const char* a_name = ((OgrFieldEntry*)a)->fldname;
+	const char* b_name = ((OgrFieldEntry*)b)->fldname;
+
+	return strcasecmp(a_name, b_name);
+}
+
+
+/*
+ * The execstate holds a foreign table relation id and an OGR connection,
+ * this function finds all the OGR fields that match up to columns in the
+ * foreign table definition, using columns name match and data type consistency
+ * as the criteria for making a match.
+ * The results of the matching are returned in a new table, allocated
+ * in the current memory context.
+ */
+static OgrFdwTable*
+ogrBuildColumnData(const OgrFdwState* state, OGRFeatureDefnH dfn)
+{
+	Relation rel;
+	TupleDesc tupdesc;
+	int i;
+	OgrFdwTable* tbl;
+	int ogr_ncols;
+	int fid_count = 0;
+	int geom_count = 0;
+	int ogr_geom_count = 0;
+	int field_count = 0;
+	OgrFieldEntry* ogr_fields;
+	int ogr_fields_count = 0;
+	char* tblname = get_rel_name(state->foreigntableid);
+
+	/* Fresh table */
+	tbl = palloc0(sizeof(OgrFdwTable));
+
+	/* One column for each PgSQL foreign table column */
+#if PG_VERSION_NUM < 120000
+	rel = heap_open(state->foreigntableid, NoLock);
+#else
+	rel = table_open(state->foreigntableid, NoLock);
+#endif /* PG_VERSION_NUM */
+
+	tupdesc = rel->rd_att;
+	tbl->ncols = tupdesc->natts;
+	tbl->cols = palloc0(tbl->ncols * sizeof(OgrFdwColumn));
+	tbl->tblname = pstrdup(tblname);
+
+	/* Get OGR metadata ready */
+	ogr_ncols = OGR_FD_GetFieldCount(dfn);
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+	ogr_geom_count = OGR_FD_GetGeomFieldCount(dfn);
+#else
+	ogr_geom_count = (OGR_FD_GetGeomType(dfn) != wkbNone) ? 1 : 0;
+#endif
+
+
+	/* Prepare sorted list of OGR column names */
+	/* TODO: change this to a hash table, to avoid repeated strcmp */
+	/* We will search both the original and laundered OGR field names for matches */
+	ogr_fields_count = 2 * ogr_ncols;
+	ogr_fields = palloc0(ogr_fields_count * sizeof(OgrFieldEntry));
+	for (i = 0; i < ogr_ncols; i++)
+	{
+		char* fldname = pstrdup(OGR_Fld_GetNameRef(OGR_FD_GetFieldDefn(dfn, i)));
+		char* fldname_laundered = palloc(STR_MAX_LEN);
+		strlcpy(fldname_laundered, fldname, STR_MAX_LEN);
+		ogrStringLaunder(fldname_laundered);
+		ogr_fields[2 * i].fldname = fldname;
+		ogr_fields[2 * i].fldnum = i;
+		ogr_fields[2 * i + 1].fldname = fldname_laundered;
+		ogr_fields[2 * i + 1].fldnum = i;
+	}
+	qsort(ogr_fields, ogr_fields_count, sizeof(OgrFieldEntry), ogrFieldEntryCmpFunc);
+
+
+	/* loop through foreign table columns */
+	for (i = 0; i < tbl->ncols; i++)
+	{
+		List* options;
+		ListCell* lc;
+		OgrFieldEntry* found_entry;
+		OgrFieldEntry entry;
+
+		Form_pg_attribute att_tuple = TupleDescAttr(tupdesc, i);
+
+		OgrFdwColumn col = tbl->cols[i];
+		col.pgattnum = att_tuple->attnum;
+		col.pgtype = att_tuple->atttypid;
+		col.pgtypmod = att_tuple->atttypmod;
+		col.pgattisdropped = att_tuple->attisdropped;
+
+		/* Skip filling in any further metadata about dropped columns */
+		if (col.pgattisdropped)
+		{
+			continue;
+		}
+
+		/* Check for array type */
+		col.pgelmtype = get_element_type(col.pgtype);
+		if (col.pgelmtype)
+		{
+			/* Extra type info needed to form the array */
+			col.pgisarray = true;
+		}
+		else
+			col.pgelmtype = col.pgtype;
+
+		/* Find the appropriate conversion functions */
+		getTypeInputInfo(col.pgelmtype, &col.pginputfunc, &col.pginputioparam);
+		getTypeBinaryInputInfo(col.pgelmtype, &col.pgrecvfunc, &col.pgrecvioparam);
+		getTypeOutputInfo(col.pgelmtype, &col.pgoutputfunc, &col.pgoutputvarlena);
+		getTypeBinaryOutputInfo(col.pgelmtype, &col.pgsendfunc, &col.pgsendvarlena);
+
+		/* Get the PgSQL column name */
+#if PG_VERSION_NUM >= 110000
+		col.pgname = pstrdup(get_attname(rel->rd_id, att_tuple->attnum, false));
+#else
+		col.pgname = pstrdup(get_attname(rel->rd_id, att_tuple->attnum));
+#endif
+
+		/* Handle FID first */
+		if (strcaseeq(col.pgname, "fid") &&
+		        (col.pgtype == INT4OID || col.pgtype == INT8OID))
+		{
+			if (fid_count >= 1)
+			{
+				elog(ERROR, "FDW table '%s' includes more than one FID column", tblname);
+			}
+
+			col.ogrvariant = OGR_FID;
+			col.ogrfldnum = fid_count++;
+			tbl->cols[i] = col;
+			continue;
+		}
+
+		/* If the OGR source has geometries, can we match them to Pg columns? */
+		/* We'll match to the first ones we find, irrespective of name */
+		if (geom_count < ogr_geom_count && col.pgtype == ogrGetGeometryOid())
+		{
+			col.ogrvariant = OGR_GEOMETRY;
+			col.ogrfldtype = OFTBinary;
+			col.ogrfldnum = geom_count++;
+			tbl->cols[i] = col;
+			continue;
+		}
+
+		/* Now we search for matches in the OGR fields */
+
+		/* By default, search for the PgSQL column name */
+		entry.fldname = col.pgname;
+		entry.fldnum = 0;
+
+		/*
+		 * But, if there is a 'column_name' option for this column, we
+		 * want to search for *that* in the OGR layer.
+		 */
+		options = GetForeignColumnOptions(state->foreigntableid, i + 1);
+		foreach (lc, options)
+		{
+			DefElem*    def = (DefElem*) lfirst(lc);
+
+			if (streq(def->defname, OPT_COLUMN))
+			{
+				entry.fldname = defGetString(def);
+				break;
+			}
+		}
+
+		/* Search PgSQL column name in the OGR column name list */
+		found_entry = bsearch(&entry, ogr_fields, ogr_fields_count, sizeof(OgrFieldEntry), ogrFieldEntryCmpFunc);
+
+		/* Column name matched, so save this entry, type mismatches are raised on conversion */
+		if (found_entry)
+		{
+			OGRFieldDefnH fld = OGR_FD_GetFieldDefn(dfn, found_entry->fldnum);
+			OGRFieldType fldtype = OGR_Fld_GetType(fld);
+
+			col.ogrvariant = OGR_FIELD;
+			col.ogrfldnum = found_entry->fldnum;
+			col.ogrfldtype = fldtype;
+			field_count++;
+		}
+		else
+		{
+			col.ogrvariant = OGR_UNMATCHED;
+		}
+		tbl->cols[i] = col;
+	}
+
+	elog(DEBUG2, "ogrReadColumnData matched %d FID, %d GEOM, %d FIELDS out of %d PGSQL COLUMNS", fid_count, geom_count,
+	     field_count, tbl->ncols);
+
+	/* Clean up */
+	for (i = 0; i < 2 * ogr_ncols; i++)
+	{
+		if (ogr_fields[i].fldname)
+		{
+			pfree(ogr_fields[i].fldname);
+		}
+	}
+	pfree(ogr_fields);
+#if PG_VERSION_NUM < 120000
+	heap_close(rel, NoLock);
+#else
+	table_close(rel, NoLock);
+#endif /* PG_VERSION_NUM */
+
+	return tbl;
+}
+
+/*
+ * Column mappings are cached per foreign table, so that the
+ * catalog lookups in ogrBuildColumnData are only done once,
+ * instead of for every plan, scan and modify of the table.
+ */
+typedef struct OgrFdwTableCacheEntry
+{
+	Oid foreigntableid;        /* hash key, must be first */
+	bool valid;                /* false if catalogs changed since build */
+	uint32 ftable_hashvalue;   /* syscache hash of the pg_foreign_table row */
+	uint32 lyr_signature;      /* fingerprint of the OGR layer definition */
+	MemoryContext cxt;         /* memory holding the table */
+	OgrFdwTable* table;        /* column mapping */
+} OgrFdwTableCacheEntry;
+
+static HTAB* ogr_table_cache = NULL;
+
+/*
+ * Invalidated mappings may still be referenced by running
+ * scans, so their memory is parked here until the end of
+ * the transaction instead of being freed immediately.
+ */
+static MemoryContext ogr_table_retired_cxt = NULL;
+
+static void
+ogrTableCacheEntryInvalidate(OgrFdwTableCacheEntry* entry)
+{
+	entry->valid = false;
+	if (entry->cxt)
+	{
+		MemoryContextSetParent(entry->cxt, ogr_table_retired_cxt);
+		entry->cxt = NULL;
+		entry->table = NULL;
+	}
+}
+
+/*
+ * Relcache invalidations cover ALTER FOREIGN TABLE on the
+ * columns (including column options) and renames.
+ */
+static void
+ogrTableCacheRelcacheCallback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	OgrFdwTableCacheEntry* entry;
+
+	hash_seq_init(&status, ogr_table_cache);
+	while ((entry = (OgrFdwTableCacheEntry*) hash_seq_search(&status)) != NULL)
+	{
+		if (relid == InvalidOid || entry->foreigntableid == relid)
+		{
+			ogrTableCacheEntryInvalidate(entry);
+		}
+	}
+}
+
+/*
+ * Syscache invalidations on pg_foreign_table cover changes
+ * to the table options, like the layer name.
+ */
+static void
+ogrTableCacheSyscacheCallback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	HASH_SEQ_STATUS status;
+	OgrFdwTableCacheEntry* entry;
+
+	hash_seq_init(&status, ogr_table_cache);
+	while ((entry = (OgrFdwTableCacheEntry*) hash_seq_search(&status)) != NULL)
+	{
+		if (hashvalue == 0 || entry->ftable_hashvalue == hashvalue)
+		{
+			ogrTableCacheEntryInvalidate(entry);
+		}
+	}
+}
+
+static void
+ogrTableCacheXactCallback(XactEvent event, void* arg)
+{
+	if (event == XACT_EVENT_ABORT || event == XACT_EVENT_COMMIT)
+	{
+		MemoryContextDeleteChildren(ogr_table_retired_cxt);
+	}
+}
+
+static void
+ogrTableCacheInit(void)
+{
+	HASHCTL ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(OgrFdwTableCacheEntry);
+	ctl.hcxt = CacheMemoryContext;
+	ogr_table_cache = hash_create("ogr_fdw column mappings", 64, &ctl,
+	                              HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	ogr_table_retired_cxt = AllocSetContextCreate(CacheMemoryContext,
+	                                              "ogr_fdw retired column mappings",
+	                                              ALLOCSET_SMALL_SIZES);
+
+	CacheRegisterRelcacheCallback(ogrTableCacheRelcacheCallback, (Datum) 0);
+	CacheRegisterSyscacheCallback(FOREIGNTABLEREL, ogrTableCacheSyscacheCallback, (Datum) 0);
+	RegisterXactCallback(ogrTableCacheXactCallback, NULL);
+}
+
+/*
+ * Cheap fingerprint (FNV-1a) of the field names and types
+ * of an OGR layer, so a cached column mapping can be
+ * rebuilt if the layer definition changes underneath it.
+ */
+static uint32
+ogrLayerDefnSignature(OGRFeatureDefnH dfn)
+{
+	uint32 hash = 2166136261u;
+	int nflds = OGR_FD_GetFieldCount(dfn);
+	int ngeoms;
+	int i;
+
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+	ngeoms = OGR_FD_GetGeomFieldCount(dfn);
+#else
+	ngeoms = (OGR_FD_GetGeomType(dfn) != wkbNone) ? 1 : 0;
+#endif
+
+	hash = (hash ^ (uint32) ngeoms) * 16777619u;
+	hash = (hash ^ (uint32) nflds) * 16777619u;
+	for (i = 0; i < nflds; i++)
+	{
+		OGRFieldDefnH fld = OGR_FD_GetFieldDefn(dfn, i);
+		const char* p = OGR_Fld_GetNameRef(fld);
+
+		hash = (hash ^ (uint32) OGR_Fld_GetType(fld)) * 16777619u;
+		for (; p && *p; p++)
+		{
+			hash = (hash ^ (unsigned char) *p) * 16777619u;
+		}
+	}
+	return hash;
+}
+
+/*
+ * Fill in the column mapping for the state, from the cache
+ * if possible, building and caching it otherwise.
+ */
+static void
+ogrReadColumnData(OgrFdwState* state)
+{
+	OgrFdwTableCacheEntry* entry;
+	OGRFeatureDefnH dfn = OGR_L_GetLayerDefn(state->ogr.lyr);
+	uint32 lyr_signature = ogrLayerDefnSignature(dfn);
+	MemoryContext cxt, oldcxt;
+	OgrFdwTable* tbl;
+	bool found;
+
+	if (!ogr_table_cache)
+	{
+		ogrTableCacheInit();
+	}
+
+	entry = hash_search(ogr_table_cache, &(state->foreigntableid), HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->valid = false;
+		entry->cxt = NULL;
+		entry->table = NULL;
+	}
+
+	if (entry->valid && entry->table && entry->lyr_signature == lyr_signature)
+	{
+		state->table = entry->table;
+		return;
+	}
+
+	/* Stale or missing, retire any old mapping and build a new one */
+	ogrTableCacheEntryInvalidate(entry);
+
+	/*
+	 * The catalog reads of the build can process invalidations,
+	 * so the entry is marked valid first and any invalidation
+	 * arriving during the build clears it again, making the
+	 * next lookup rebuild instead of trusting a stale mapping.
+	 */
+	entry->lyr_signature = lyr_signature;
+	entry->ftable_hashvalue = GetSysCacheHashValue1(FOREIGNTABLEREL, ObjectIdGetDatum(state->foreigntableid));
+	entry->valid = true;
+
+	/* Build in a private context, only parented to the cache on success */
+	cxt = AllocSetContextCreate(CurrentMemoryContext,
+	                            "ogr_fdw column mapping",
+	                            ALLOCSET_SMALL_SIZES);
+	oldcxt = MemoryContextSwitchTo(cxt);
+	tbl = ogrBuildColumnData(state, dfn);
+	MemoryContextSwitchTo(oldcxt);
+	MemoryContextSetParent(cxt, CacheMemoryContext);
+
+	entry->cxt = cxt;
+	entry->table = tbl;
+
+	state->table = tbl;
+}
+
+
+/*
+ * ogrLookupGeometryFunctionOid
+ *
+ * Find the procedure Oids of useful functions so we can call
+ * them later. In the case where multiple functions have the
+ * same signature, in different namespaces (???) we might have
+ * problems, but that seems very unlikely.
+ *
+ * https://github.com/pramsey/pgsql-ogr-fdw/issues/266
+ */
+static Oid
+ogrLookupGeometryFunctionOid(const char* proname)
+{
+	CatCList   *clist;
+	int			i;
+	Oid result = InvalidOid;
+
+	/* This only works if PostGIS is installed */
+	if (ogrGetGeometryOid() == InvalidOid ||
+	    ogrGetGeometryOid() == BYTEAOID)
+	{
+		return result;
+	}
+
+	if (!proname) return result;
+
+	/* Search syscache by name only */
+	clist = SearchSysCacheList1(PROCNAMEARGSNSP,
+	                            CStringGetDatum(proname));
+
+	if (!clist) return InvalidOid;
+
+	for (i = 0; i < clist->n_members; i++)
+	{
+		HeapTuple    proctup = &clist->members[i]->tuple;
+		Form_pg_proc procform = (Form_pg_proc) GETSTRUCT(proctup);
+		Oid         *proargtypes = procform->proargtypes.values;
+		int          pronargs = procform->pronargs;
+
+#if PG_VERSION_NUM >= 120000
+		Oid procoid = procform->oid;
+#else
+		Oid procoid = HeapTupleGetOid(proctup);
+#endif
+
+		/* ST_SetSRID(geometry, integer) */
+		if (streq(proname, "st_setsrid") &&
+		    pronargs == 2 &&
+		    proargtypes[0] == ogrGetGeometryOid())
+		{
+			result = procoid;
+			break;
+		}
+		/* postgis_typmod_srid(typmod) */
+		else if (streq(proname, "postgis_typmod_srid") &&
+		         pronargs == 1)
+		{
+			/* postgis_typmod_srid(integer) */
+			result = procoid;
+			break;
+		}
+		else
+		{
+			elog(ERROR, "%s could not find function '%s'",
+			     __func__, proname);
+		}
+	}
+
+	ReleaseSysCacheList(clist);
+	return result;
+}
+
+/*
+ * Hand the layer over to a background reader, from its first
+ * feature. The reader also exports the WKB of every geometry
+ * the conversion program reads. Without start, the thread is
+ * left for the first ogrReaderNext to start.
+ */
+static void
+ogrStartReader(OgrFdwExecState* execstate, int size, bool start)
+{
+	int* wkbfields = palloc(sizeof(int) * Max(execstate->nsteps, 1));
+	int nwkb = 0;
+	int i;
+
+	for (i = 0; i < execstate->nsteps; i++)
+	{
+		const OgrFdwColumn* col = execstate->program[i].col;
+		if (col->ogrvariant == OGR_GEOMETRY)
+			wkbfields[nwkb++] = col->ogrfldnum;
+	}
+
+	OGR_L_ResetReading(execstate->ogr.lyr);
+	execstate->reader = ogrReaderCreate(execstate->ogr.lyr, size, wkbfields, nwkb);
+	if (start)
+		ogrReaderStart(execstate->reader);
+	pfree(wkbfields);
+}
+
+/*
+ * The data source's result set goes with the executor
+ * memory, so it is released when a query fails too.
+ */
+static void
+ogrRemoteQueryCleanup(void* arg)
+{
+	OgrFdwExecState* execstate = (OgrFdwExecState*) arg;
+
+	if (execstate->result_lyr && execstate->ogr.ds)
+		GDALDatasetReleaseResultSet(execstate->ogr.ds, execstate->result_lyr);
+	execstate->result_lyr = NULL;
+}
+
+/*
+ * Run an aggregate or join query in the data source's SQL
+ * engine. Each column of the plan's scan tuple comes back as
+ * a result field (or geometry) named after its position,
+ * and the ones taken from table columns are read by type.
+ */
+static void
+ogrRemoteQueryBegin(OgrFdwExecState* execstate, const ForeignScan* fsplan, const char* sql, const char* dialect)
+{
+	MemoryContextCallback* cb;
+	OGRFeatureDefnH dfn;
+	bool have_typmod_funcs = (execstate->setsridfunc && execstate->typmodsridfunc);
+	ListCell* lc;
+	int i = 0;
+
+	elog(DEBUG2, "%s: running \"%s\"", __func__, sql);
+
+	CPLErrorReset();
+	execstate->result_lyr = GDALDatasetExecuteSQL(execstate->ogr.ds, sql, NULL, *dialect ? dialect : NULL);
+	if (!execstate->result_lyr)
+		ogrEreportError("failure running OGR data source query");
+
+	cb = palloc0(sizeof(MemoryContextCallback));
+	cb->func = ogrRemoteQueryCleanup;
+	cb->arg = execstate;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, cb);
+
+	dfn = OGR_L_GetLayerDefn(execstate->result_lyr);
+	execstate->result_steps = palloc0(sizeof(OgrFdwConvertStep) * Max(list_length(fsplan->fdw_scan_tlist), 1));
+	foreach (lc, fsplan->fdw_scan_tlist)
+	{
+		TargetEntry* tle = (TargetEntry*) lfirst(lc);
+		OgrFdwConvertStep* step = &(execstate->result_steps[i]);
+		char* name = psprintf("c%d", tle->resno);
+
+		step->attnum = i++;
+		step->ogrfldnum = OGR_FD_GetFieldIndex(dfn, name);
+
+		if (IsA(tle->expr, Var))
+		{
+			Var* var = (Var*) tle->expr;
+			OgrFdwColumn* col = palloc0(sizeof(OgrFdwColumn));
+
+			col->pgname = name;
+			col->pgtype = var->vartype;
+			col->pgtypmod = var->vartypmod;
+			getTypeInputInfo(var->vartype, &col->pginputfunc, &col->pginputioparam);
+			col->ogrvariant = OGR_FIELD;
+
+			if (step->ogrfldnum >= 0)
+			{
+				col->ogrfldtype = OGR_Fld_GetType(OGR_FD_GetFieldDefn(dfn, step->ogrfldnum));
+			}
+			else
+			{
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+				step->ogrfldnum = OGR_FD_GetGeomFieldIndex(dfn, name);
 #endif
-	                 baserel->rows,
-#if PG_VERSION_NUM >= 180000
-	                 0,       /* disabled_nodes */
+				/* Geometry columns convert like they do in a scan */
+				if (step->ogrfldnum >= 0)
+				{
+					col->ogrvariant = OGR_GEOMETRY;
+					col->ogrfldnum = step->ogrfldnum;
+					getTypeBinaryInputInfo(var->vartype, &col->pgrecvfunc, &col->pgrecvioparam);
+					if (var->vartype == BYTEAOID)
+					{
+						step->convert = ogrConvertGeometryBytea;
+					}
+					else
+					{
+						step->convert = ogrConvertGeometry;
+						if (have_typmod_funcs && var->vartypmod >= 0)
+							step->flags |= OGR_CONVERT_SETSRID;
+					}
+				}
+			}
+			step->col = col;
+		}
+
+		if (step->ogrfldnum < 0)
+		{
+			ereport(ERROR,
+			        (errcode(ERRCODE_FDW_ERROR),
+			         errmsg("OGR data source query returned no column \"%s\"", name)));
+		}
+	}
+}
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * Put the current values of its parameters into the attribute
+ * filter, one filter for each batch of keys, or return NIL
+ * when they don't fit (see ogrDeparseFillParams) and the scan
+ * has to go unfiltered. The filters last as long as the scan.
+ */
+static List*
+ogrFillFilterParams(ForeignScanState* node, OgrFdwExecState* execstate, const char* sql)
+{
+	ExprContext* econtext = node->ss.ps.ps_ExprContext;
+	int nparams = list_length(execstate->param_exprs);
+	Datum* values = palloc(sizeof(Datum) * nparams);
+	bool* nulls = palloc(sizeof(bool) * nparams);
+	Oid* types = palloc(sizeof(Oid) * nparams);
+	List* filled;
+	List* filters = NIL;
+	MemoryContext oldcxt;
+	ListCell* lc;
+	int i = 0;
+
+	foreach (lc, execstate->param_exprs)
+	{
+		ExprState* expr = (ExprState*) lfirst(lc);
+		values[i] = ExecEvalExpr(expr, econtext, &(nulls[i]));
+		types[i] = exprType((Node*) expr->expr);
+		i++;
+	}
+
+	filled = ogrDeparseFillParams(sql, nparams, values, nulls, types,
+	                              execstate->batch_param, execstate->batch_size);
+	if (filled)
+		elog(DEBUG2, "%s: OGR SQL with parameters: %s", __func__, (char*) linitial(filled));
+	else
+		elog(DEBUG2, "%s: parameters of \"%s\" don't fit, scanning without it", __func__, sql);
+	if (list_length(filled) > 1)
+		elog(DEBUG2, "%s: reading the keys in %d batches", __func__, list_length(filled));
+
+	oldcxt = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+	foreach (lc, filled)
+		filters = lappend(filters, pstrdup((char*) lfirst(lc)));
+	MemoryContextSwitchTo(oldcxt);
+
+	pfree(values);
+	pfree(nulls);
+	pfree(types);
+	return filters;
+}
+
+/*
+ * Take on the filters of a new parameter fill, starting
+ * with the first batch.
+ */
+static void
+ogrSetFilterBatches(OgrFdwExecState* execstate, List* filters)
+{
+	if (execstate->sql_batches)
+		list_free_deep(execstate->sql_batches);
+	execstate->sql_batches = filters;
+	execstate->batch_pos = 0;
+	execstate->sql = filters ? (char*) linitial(filters) : NULL;
+}
+#endif
+
+/*
+ * Put a spatial filter on the layer: the geometry itself
+ * when there is one, so drivers can test features against
+ * it exactly, otherwise the box.
+ */
+static void
+ogrSetSpatialFilter(OgrFdwExecState* execstate, const OgrFdwSpatialFilter* spatial_filter)
+{
+	if (spatial_filter->hexwkb)
+	{
+		int wkbsize;
+		GByte* wkb = CPLHexToBinary(spatial_filter->hexwkb, &wkbsize);
+		OGRGeometryH geom = NULL;
+
+		if (OGR_G_CreateFromWkb(wkb, NULL, &geom, wkbsize) == OGRERR_NONE)
+		{
+			OGR_L_SetSpatialFilterEx(execstate->ogr.lyr, spatial_filter->ogrfldnum, geom);
+			OGR_G_DestroyGeometry(geom);
+			CPLFree(wkb);
+			return;
+		}
+		CPLFree(wkb);
+	}
+
+	OGR_L_SetSpatialFilterRectEx(execstate->ogr.lyr,
+	                             spatial_filter->ogrfldnum,
+	                             spatial_filter->minx,
+	                             spatial_filter->miny,
+	                             spatial_filter->maxx,
+	                             spatial_filter->maxy
+	                             );
+}
+
+/*
+ * Put the current filter on the layer, or take it off.
+ */
+static void
+ogrSetAttributeFilter(OgrFdwExecState* execstate)
+{
+	if (execstate->sql && strlen(execstate->sql) > 0)
+	{
+		OGRErr err = OGR_L_SetAttributeFilter(execstate->ogr.lyr, execstate->sql);
+		if (err != OGRERR_NONE)
+		{
+			const char* ogrerr = CPLGetLastErrorMsg();
+
+			if (ogrerr && ! streq(ogrerr, ""))
+			{
+				ereport(NOTICE,
+				        (errcode(ERRCODE_FDW_ERROR),
+				         errmsg("unable to set OGR SQL '%s' on layer", execstate->sql),
+				         errhint("%s", ogrerr)));
+			}
+			else
+			{
+				ereport(NOTICE,
+				        (errcode(ERRCODE_FDW_ERROR),
+				         errmsg("unable to set OGR SQL '%s' on layer", execstate->sql)));
+			}
+		}
+	}
+	else
+	{
+		OGR_L_SetAttributeFilter(execstate->ogr.lyr, NULL);
+	}
+}
+
+#if PG_VERSION_NUM >= 100000
+static bool
+ogrHasExecParams(Node* node, void* context)
+{
+	if (node == NULL)
+		return false;
+	if (IsA(node, Param) && ((Param*) node)->paramkind == PARAM_EXEC)
+		return true;
+	return expression_tree_walker(node, ogrHasExecParams, context);
+}
+
+/*
+ * Set the spatial filter from the geometry of its parameter:
+ * the geometry itself, or its envelope expanded by the
+ * distance. A NULL geometry passes nothing, which the local
+ * test sees to, so it just takes the filter off, as does one
+ * that can't be transformed to the layer's coordinates. The
+ * outer rows of a join mostly share one SRID, so the last
+ * transformation is kept for the rest of the scan.
+ */
+static void
+ogrSetSpatialParamFilter(ForeignScanState* node, OgrFdwExecState* execstate)
+{
+	const OgrFdwSpatialFilter* spatial_filter = execstate->spatial_filter;
+	ExprState* expr = (ExprState*) list_nth(execstate->param_exprs, spatial_filter->param - 1);
+	ExprContext* econtext = node->ss.ps.ps_ExprContext;
+	Oid sendfunc;
+	bool isvarlena;
+	OGRGeometryH geom;
+	OGRCoordinateTransformationH ct = NULL;
+	OGREnvelope env;
+	Datum value;
+	bool isnull;
+	int srid;
+
+	value = ExecEvalExpr(expr, econtext, &isnull);
+	getTypeBinaryOutputInfo(ogrGetGeometryOid(), &sendfunc, &isvarlena);
+
+	if (isnull || pgDatumToOgrGeometrySrid(value, sendfunc, &geom, &srid) != OGRERR_NONE)
+	{
+		OGR_L_SetSpatialFilterEx(execstate->ogr.lyr, spatial_filter->ogrfldnum, NULL);
+		return;
+	}
+
+	if (srid > 0)
+	{
+		if (srid != execstate->xform_srid)
+		{
+			if (execstate->xform)
+				OCTDestroyCoordinateTransformation(execstate->xform);
+			execstate->xform_ok = ogrSridTransform(srid, execstate->ogr.lyr,
+			                                       spatial_filter->ogrfldnum,
+			                                       &(execstate->xform));
+			execstate->xform_srid = srid;
+		}
+		if (!execstate->xform_ok)
+		{
+			OGR_L_SetSpatialFilterEx(execstate->ogr.lyr, spatial_filter->ogrfldnum, NULL);
+			OGR_G_DestroyGeometry(geom);
+			return;
+		}
+		ct = execstate->xform;
+	}
+
+	if (spatial_filter->exact && !ct && !OGR_G_IsEmpty(geom))
+	{
+		OGR_L_SetSpatialFilterEx(execstate->ogr.lyr, spatial_filter->ogrfldnum, geom);
+	}
+	else
+	{
+		OGR_G_GetEnvelope(geom, &env);
+		env.MinX -= spatial_filter->distance;
+		env.MinY -= spatial_filter->distance;
+		env.MaxX += spatial_filter->distance;
+		env.MaxY += spatial_filter->distance;
+
+		if (ct && !ogrTransformEnvelope(ct, &env))
+			OGR_L_SetSpatialFilterEx(execstate->ogr.lyr, spatial_filter->ogrfldnum, NULL);
+		else
+			OGR_L_SetSpatialFilterRectEx(execstate->ogr.lyr,
+			                             spatial_filter->ogrfldnum,
+			                             env.MinX, env.MinY,
+			                             env.MaxX, env.MaxY
+			                             );
+	}
+	OGR_G_DestroyGeometry(geom);
+}
+
+/*
+ * Refill the filters with the parameter values of this
+ * (re)scan. The attribute filter goes on the layer (which
+ * starts reading over again) only when it comes out
+ * different, a spatial filter from a parameter every time.
+ */
+static void
+ogrRefillFilterParams(ForeignScanState* node, OgrFdwExecState* execstate)
+{
+	List* filters = NIL;
+	char* sql = NULL;
+	bool same = true;
+
+	execstate->refilter = false;
+
+	if (execstate->sql_params)
+	{
+		filters = ogrFillFilterParams(node, execstate, execstate->sql_params);
+		sql = filters ? (char*) linitial(filters) : NULL;
+		same = execstate->batch_pos == 0 &&
+		       (sql ? (execstate->sql && streq(sql, execstate->sql)) : !execstate->sql);
+	}
+	if (execstate->spatial_filter)
+		same = false;
+
+	/* The reader thread owns the layer until it is stopped */
+	if (!same)
+	{
+		if (execstate->reader)
+			ogrReaderStop(execstate->reader);
+		ogrArrowScanReset(execstate);
+	}
+
+	if (execstate->sql_params)
+		ogrSetFilterBatches(execstate, filters);
+
+	if (!same)
+	{
+		if (execstate->sql_params)
+			elog(DEBUG1, "OGR SQL for the new parameters: %s", execstate->sql ? execstate->sql : "none");
+		if (execstate->spatial_filter)
+			ogrSetSpatialParamFilter(node, execstate);
+		ogrSetAttributeFilter(execstate);
+		OGR_L_ResetReading(execstate->ogr.lyr);
+	}
+}
+#endif
+
+/*
+ * At the end of a batch of keys, go on to read the next
+ * one, if there is one.
+ */
+static bool
+ogrNextFilterBatch(OgrFdwExecState* execstate)
+{
+	if (execstate->batch_pos + 1 >= list_length(execstate->sql_batches))
+		return false;
+
+	if (execstate->reader)
+		ogrReaderStop(execstate->reader);
+	ogrArrowScanReset(execstate);
+
+	execstate->sql = (char*) list_nth(execstate->sql_batches, ++execstate->batch_pos);
+	elog(DEBUG2, "%s: OGR SQL for the next batch: %s", __func__, execstate->sql);
+
+	ogrSetAttributeFilter(execstate);
+	OGR_L_ResetReading(execstate->ogr.lyr);
+	return true;
+}
+
+/*
+ * ogrBeginForeignScan
+ */
+static void
+ogrBeginForeignScan(ForeignScanState* node, int eflags)
+{
+	OgrFdwState* state;
+	OgrFdwExecState* execstate;
+	OgrFdwSpatialFilter* spatial_filter;
+	ForeignScan* fsplan = (ForeignScan*)node->ss.ps.plan;
+	Oid foreigntableid;
+	Bitmapset* retrieved_attrs = NULL;
+	ListCell* lc;
+	bool prefetch;
+	int prefetch_size;
+	char* remotesql;
+	List* filterexprs = fsplan->fdw_exprs;
+	int fididx;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	/* Do nothing in EXPLAIN (no ANALYZE) case */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	/* Aggregate and join scans have no scan relation, so the plan names the table */
+	foreigntableid = (Oid) intVal(list_nth(fsplan->fdw_private, OgrFdwScanPrivateForeignTableId));
+
+	/* Initialize OGR connection */
+	state = getOgrFdwState(foreigntableid, OGR_EXEC_STATE);
+	execstate = (OgrFdwExecState*)state;
+
+	/* Read the OGR layer definition and PgSQL foreign table definitions */
+	ogrReadColumnData(state);
+
+	/* Collect the procedure Oids for PostGIS functions we might need */
+	execstate->setsridfunc = ogrLookupGeometryFunctionOid("st_setsrid");
+	execstate->typmodsridfunc = ogrLookupGeometryFunctionOid("postgis_typmod_srid");
+
+	/* Only the columns the plan asked for get read and converted */
+	foreach(lc, (List*) list_nth(fsplan->fdw_private, OgrFdwScanPrivateRetrievedAttrs))
+		retrieved_attrs = bms_add_member(retrieved_attrs, lfirst_int(lc));
+
+	/* Work out how each column gets filled, once, rather than per row */
+	ogrBuildConvertProgram(execstate, retrieved_attrs);
+	ogrSetIgnoredFields(execstate, retrieved_attrs);
+	bms_free(retrieved_attrs);
+
+	/* Get OGR SQL generated by the deparse step during the planner function. */
+	execstate->sql = (char*) strVal(list_nth(fsplan->fdw_private, OgrFdwScanPrivateAttributeFilter));
+
+	/* FID lookups get the FIDs when the scan (or each rescan) starts */
+	fididx = intVal(list_nth(fsplan->fdw_private, OgrFdwScanPrivateFidIndex));
+	if (fididx >= 0)
+	{
+		execstate->fid_expr = ExecInitExpr(list_nth(fsplan->fdw_exprs, fididx), (PlanState*) node);
+		filterexprs = list_truncate(list_copy(filterexprs), fididx);
+	}
+
+	/* Get spatial filter generated by the deparse step. */
+	spatial_filter = ogrSpatialFilterFromList(list_nth(fsplan->fdw_private, OgrFdwScanPrivateSpatialFilter));
+	if (spatial_filter && spatial_filter->param)
+		execstate->spatial_filter = spatial_filter;
+
+#if PG_VERSION_NUM >= 100000
+	/*
+	 * Parameters of a prepared statement have their values by now.
+	 * Executor ones (outer rows of a nested loop, outer query columns,
+	 * subqueries) only get theirs once the scan runs.
+	 */
+	if (filterexprs)
+	{
+		execstate->param_exprs = ExecInitExprList(filterexprs, (PlanState*) node);
+		execstate->sql_params = execstate->sql;
+
+		/*
+		 * Long key lists are read a batch of keys at a time, except
+		 * where the scan doesn't read the layer from one end to the
+		 * other by itself
+		 */
+		execstate->batch_param = intVal(list_nth(fsplan->fdw_private, OgrFdwScanPrivateBatchParam));
+		execstate->batch_size = ogrGetKeyBatchSize(foreigntableid);
+		if (fsplan->scan.plan.parallel_aware)
+			execstate->batch_param = 0;
+#if PG_VERSION_NUM >= 140000
+		if (node->ss.ps.async_capable)
+			execstate->batch_param = 0;
 #endif
-	                 planstate->startup_cost,
-	                 planstate->total_cost,
-	                 NIL,     /* no pathkeys */
-	                 NULL,    /* no lateral_relids */
-	                 NULL  /* no extra plan */
-#if PG_VERSION_NUM >= 170000
-	                 , NIL /* no fdw_restrictinfo list */
+
+		if (ogrHasExecParams((Node*) filterexprs, NULL))
+		{
+			if (execstate->sql_params)
+				execstate->sql = NULL;
+			execstate->refilter = true;
+		}
+		else if (execstate->sql_params)
+		{
+			ogrSetFilterBatches(execstate, ogrFillFilterParams(node, execstate, execstate->sql_params));
+		}
+	}
 #endif
-#if PG_VERSION_NUM >= 90500
-	                 , NIL /* no fdw_private list */
+
+	/* Get the row limit, if a LIMIT caps the scan */
+	execstate->limit = intVal(list_nth(fsplan->fdw_private, OgrFdwScanPrivateLimit));
+
+	/* Get the aggregates, if the scan answers them from the layer */
+	execstate->aggs = (List*) list_nth(fsplan->fdw_private, OgrFdwScanPrivateAggs);
+
+	/* Get the aggregate or join query, if the data source runs it */
+	remotesql = strVal(list_nth(fsplan->fdw_private, OgrFdwScanPrivateRemoteSQL));
+
+	/* Scans reading the layer from end to end can use an in-memory spatial index */
+	if (spatial_filter && !spatial_filter->param && !execstate->fid_expr &&
+	    !execstate->aggs && !remotesql && !fsplan->scan.plan.parallel_aware &&
+#if PG_VERSION_NUM >= 140000
+	    !node->ss.ps.async_capable &&
 #endif
-	                                        )
-	        );   /* no fdw_private data */
-}
+	    ogrGetSpatialIndexOption(foreigntableid))
+	{
+		ogrScanSpatialIndex(node, execstate, spatial_filter);
+	}
 
-/*
- * Convert an OgrFdwSpatialFilter into a List so it can
- * be safely passed through the fdw_private list.
- */
-static List*
-ogrSpatialFilterToList(const OgrFdwSpatialFilter* spatial_filter)
-{
-	List *l = NIL;
+#if PG_VERSION_NUM >= 100000
+	if (execstate->spatial_filter)
+	{
+		if (!execstate->refilter)
+			ogrSetSpatialParamFilter(node, execstate);
+	}
+	else
+#endif
 	if (spatial_filter)
+		ogrSetSpatialFilter(execstate, spatial_filter);
+
+	ogrSetAttributeFilter(execstate);
+
+	/* Aggregate and join scans read no features of the layer */
+	if (execstate->aggs || remotesql)
 	{
-		l = lappend(l, makeInteger(spatial_filter->ogrfldnum));
-		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->minx)));
-		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->miny)));
-		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->maxx)));
-		l = lappend(l, makeFloat(psprintf("%.17g", spatial_filter->maxy)));
+		if (remotesql)
+			ogrRemoteQueryBegin(execstate, fsplan, remotesql, strVal(list_nth(fsplan->fdw_private, OgrFdwScanPrivateDialect)));
+		node->fdw_state = (void*) execstate;
+		return;
 	}
-	return l;
+
+	/* FID lookups fetch each feature directly, nothing to read ahead */
+	if (execstate->fid_expr || execstate->fid_index)
+	{
+		node->fdw_state = (void*) execstate;
+		return;
+	}
+
+	/*
+	 * Read in record batches if the layer is good at it, or we are
+	 * told to. Parallel scans jump around by feature index instead.
+	 */
+	ogrGetPrefetchOptions(foreigntableid, &prefetch, &prefetch_size);
+
+	/* No point reading far ahead of a LIMIT */
+	if (execstate->limit >= 0)
+		prefetch_size = Max(Min(prefetch_size, execstate->limit), 1);
+#if PG_VERSION_NUM >= 140000
+	/*
+	 * Async scans read ahead on a background thread from the start,
+	 * so an Append can overlap the I/O of all its children. Scans
+	 * still waiting on parameter values for their filter only start
+	 * it from the first fetch, once the filter is on the layer.
+	 */
+	if (node->ss.ps.async_capable && !fsplan->scan.plan.parallel_aware)
+	{
+		execstate->async = true;
+		ogrStartReader(execstate, prefetch_size, !execstate->refilter);
+	}
+	else
+#endif
+	if (!fsplan->scan.plan.parallel_aware &&
+	    !ogrArrowScanBegin(execstate, ogrGetArrowStreamOption(foreigntableid)) &&
+	    prefetch && !execstate->refilter && ogrReaderAvailable())
+	{
+		/*
+		 * Feature by feature, let a thread do the GDAL reading
+		 * while the backend builds tuples.
+		 */
+		ogrStartReader(execstate, prefetch_size, true);
+	}
+
+	/* Save the state for the next call */
+	node->fdw_state = (void*) execstate;
+
+	return;
 }
 
 /*
- * Convert the List form back into an OgrFdwSpatialFilter
- * after passing through fdw_private.
+ * Rather than explicitly try and form PgSQL datums, use the type
+ * input functions, that accept cstring representations, and convert
+ * to the input format. We have to lookup the right input function for
+ * each column in the foreign table.
  */
-static OgrFdwSpatialFilter*
-ogrSpatialFilterFromList(const List* lst)
+Datum
+pgDatumFromCString(const char* cstr, const OgrFdwColumn *col, int char_encoding, bool *is_null)
 {
-	OgrFdwSpatialFilter* spatial_filter;
+	size_t cstr_len = cstr ? strlen(cstr) : 0;
+	Datum value = (Datum) 0;
+	char *cstr_decoded;
 
-	if (lst == NIL)
-		return NULL;
+	/* Zero length implies NULL for all non-strings */
+	if (cstr_len == 0 && (col->ogrfldtype != OFTString && col->ogrfldtype != OFTStringList))
+	{
+		*is_null = true;
+		return value;
+	}
 
-	Assert(list_length(lst) == 5);
+	cstr_decoded = char_encoding ?
+			pg_any_to_server(cstr, cstr_len, char_encoding) :
+			pstrdup(cstr);
 
-	spatial_filter = palloc(sizeof(OgrFdwSpatialFilter));
-	spatial_filter->ogrfldnum = intVal(linitial(lst));
-	spatial_filter->minx = floatVal(lsecond(lst));
-	spatial_filter->miny = floatVal(lthird(lst));
-	spatial_filter->maxx = floatVal(lfourth(lst));
-	spatial_filter->maxy = floatVal(list_nth(lst, 4)); /* list_nth counts from zero */
-	return spatial_filter;
+	value = OidFunctionCall3(col->pginputfunc,
+			    CStringGetDatum(cstr_decoded),
+			    ObjectIdGetDatum(InvalidOid),
+			    Int32GetDatum(col->pgtypmod));
+
+	/* Free cstr_decoded if it is a copy */
+	if (cstr != cstr_decoded)
+		pfree(cstr_decoded);
+
+	*is_null = false;
+	return value;
 }
 
+
+
 /*
- * fileGetForeignPlan
- *		Create a ForeignScan plan node for scanning the foreign table
+ * Per-column converters, one of which is chosen for each
+ * column of the foreign table when the scan begins, so the
+ * per-row work in ogrFeatureToSlot is just running the
+ * list of conversion steps.
  */
-static ForeignScan*
-ogrGetForeignPlan(PlannerInfo* root,
-                  RelOptInfo* baserel,
-                  Oid foreigntableid,
-                  ForeignPath* best_path,
-                  List* tlist,
-                  List* scan_clauses
-#if PG_VERSION_NUM >= 90500
-                  , Plan* outer_plan
-#endif
-                 )
+#define CSTR_SZ 256
+
+static OGRErr
+ogrConvertFid(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
 {
-	Index scan_relid = baserel->relid;
-	bool sql_generated;
-	StringInfoData sql;
-	List* params_list = NULL;
-	List* fdw_private;
-	OgrFdwPlanState* planstate = (OgrFdwPlanState*)(baserel->fdw_private);
-	OgrFdwState* state = (OgrFdwState*)(baserel->fdw_private);
-	OgrFdwSpatialFilter* spatial_filter = NULL;
-	char* attribute_filter = NULL;
+	GIntBig fid = OGR_F_GetFID(feat);
+	char fidstr[CSTR_SZ];
 
-	elog(DEBUG3, "%s: entered function", __func__);
+	snprintf(fidstr, CSTR_SZ, OGR_FDW_FRMT_INT64, OGR_FDW_CAST_INT64(fid));
+	*value = pgDatumFromCString(fidstr, step->col, execstate->ogr.char_encoding, isnull);
+	return OGRERR_NONE;
+}
 
-	/* Add in column mapping data to build SQL with the right OGR column names */
-	ogrReadColumnData(state);
+/*
+ * Numeric fast paths. Integer and real OGR values are read
+ * in binary and turned straight into datums, instead of being
+ * printed by OGR and parsed again by the type input function.
+ */
+static inline int64
+ogrStepGetInteger(const OGRFeatureH feat, const OgrFdwConvertStep* step)
+{
+	if (step->flags & OGR_CONVERT_FID)
+		return (int64) OGR_F_GetFID(feat);
+#if GDAL_VERSION_MAJOR >= 2
+	return (int64) OGR_F_GetFieldAsInteger64(feat, step->ogrfldnum);
+#else
+	return (int64) OGR_F_GetFieldAsInteger(feat, step->ogrfldnum);
+#endif
+}
 
-	/*
-	 * TODO: Review the columns requested (via params_list) and only pull those back, using
-	 * OGR_L_SetIgnoredFields. This is less important than pushing restrictions
-	 * down to OGR via OGR_L_SetAttributeFilter (done) and (TODO) OGR_L_SetSpatialFilter.
-	 */
-	initStringInfo(&sql);
-	sql_generated = ogrDeparse(&sql, root, baserel, scan_clauses, state, &params_list, &spatial_filter);
+static inline double
+ogrStepGetDouble(const OGRFeatureH feat, const OgrFdwConvertStep* step)
+{
+	if (step->flags & OGR_CONVERT_INTEGER)
+		return (double) ogrStepGetInteger(feat, step);
+	return OGR_F_GetFieldAsDouble(feat, step->ogrfldnum);
+}
 
-	/* Extract the OGR SQL from the StringInfoData */
-	if (sql_generated && sql.len > 0)
-		attribute_filter = sql.data;
+static OGRErr
+ogrConvertInt2(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	int64 i = ogrStepGetInteger(feat, step);
 
-	/* Log filters at debug level one as necessary */
-	if (attribute_filter)
-		elog(DEBUG1, "OGR SQL: %s", attribute_filter);
-	if (spatial_filter)
-		elog(DEBUG1, "OGR spatial filter (%g %g, %g %g)",
-		             spatial_filter->minx, spatial_filter->miny,
-		             spatial_filter->maxx, spatial_filter->maxy);
-	/*
-	 * Here we strip RestrictInfo
-	 * nodes from the clauses and ignore pseudoconstants (which will be
-	 * handled elsewhere).
-	 * Some FDW implementations (mysql_fdw) just pass this full list on to the
-	 * make_foreignscan function. postgres_fdw carefully separates local and remote
-	 * clauses and only passes the local ones to make_foreignscan, so this
-	 * is probably best practice, though re-applying the clauses is probably
-	 * the least of our performance worries with this fdw. For now, we just
-	 * pass them all to make_foreignscan, see no evil, etc.
-	 */
-	scan_clauses = extract_actual_clauses(scan_clauses, false);
+	if (i < PG_INT16_MIN || i > PG_INT16_MAX)
+		ereport(ERROR,
+		        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+		         errmsg("value \"" INT64_FORMAT "\" is out of range for type %s", i, "smallint")));
 
-	/* Pack the data we want to pass to the execution stage into a List. */
-	/* The members of this list must by copyable by PgSQL, which means */
-	/* they need to be Lists themselves, or Value nodes, otherwise when */
-	/* the plan gets copied the copy might fail. */
-	fdw_private = list_make3(makeString(attribute_filter), params_list, ogrSpatialFilterToList(spatial_filter));
+	*value = Int16GetDatum((int16) i);
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
-	/* Clean up our connection */
-	ogrFinishConnection(&(planstate->ogr));
+static OGRErr
+ogrConvertInt4(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	int64 i = ogrStepGetInteger(feat, step);
 
-	/* Create the ForeignScan node */
-	return make_foreignscan(tlist,
-	                        scan_clauses,
-	                        scan_relid,
-	                        NIL,	/* no expressions to evaluate */
-	                        fdw_private
-#if PG_VERSION_NUM >= 90500
-	                        , NIL /* no scan_tlist */
-	                        , NIL  /* no remote quals */
-	                        , outer_plan
-#endif
-	                       );
+	if (i < PG_INT32_MIN || i > PG_INT32_MAX)
+		ereport(ERROR,
+		        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+		         errmsg("value \"" INT64_FORMAT "\" is out of range for type %s", i, "integer")));
 
+	*value = Int32GetDatum((int32) i);
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
+static OGRErr
+ogrConvertInt8(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	*value = Int64GetDatum(ogrStepGetInteger(feat, step));
+	*isnull = false;
+	return OGRERR_NONE;
 }
 
-static bool
-pgCanConvertToOgr(Oid pg_type, OGRFieldType ogr_type)
+/*
+ * Same range rules as float4in: finite in, finite out,
+ * and non-zero in, non-zero out.
+ */
+static float4
+ogrDoubleToFloat4(double d)
 {
-	struct PgOgrMap
-	{
-		Oid pg;
-		OGRFieldType ogr;
-	};
+	float4 f = (float4) d;
 
-	static struct PgOgrMap data[] = {
-		{BOOLOID, OFTInteger}, /* 16 */
-		{BYTEAOID, OFTBinary}, /* 17 */
-		{CHAROID, OFTString},  /* 18 */
-		{NAMEOID, OFTString},  /* 19 */
-#if GDAL_VERSION_MAJOR >= 2
-		{INT8OID, OFTInteger64}, /* 20 */
-#else
-		{INT8OID, OFTInteger}, /* 20 */
-#endif
-		{INT2OID, OFTInteger}, /* 21 */
-		{INT4OID, OFTInteger}, /* 23 */
-		{TEXTOID, OFTString},  /* 25 */
-		{FLOAT4OID, OFTReal},  /* 700 */
-		{FLOAT8OID, OFTReal},  /* 701 */
-		{BOOLARRAYOID, OFTIntegerList}, /* 1000 */
-		{CHARARRAYOID, OFTStringList}, /* 1002 */
-		{NAMEARRAYOID, OFTStringList}, /* 1003 */
-		{INT2ARRAYOID, OFTIntegerList}, /* 1005 */
-		{INT4ARRAYOID, OFTIntegerList}, /* 1007 */
-		{TEXTARRAYOID, OFTStringList}, /* 1009 */
-		{VARCHARARRAYOID, OFTStringList}, /* 1015 */
-#if GDAL_VERSION_MAJOR >= 2
-		{INT8ARRAYOID, OFTInteger64List}, /* 1016 */
-#endif
-		{FLOAT4ARRAYOID, OFTRealList}, /* 1021 */
-		{FLOAT8ARRAYOID, OFTRealList}, /* 1022 */
-		{BPCHAROID, OFTString}, /* 1042 */
-		{VARCHAROID, OFTString}, /* 1043 */
-		{DATEOID, OFTDate}, /* 1082 */
-		{TIMEOID, OFTTime}, /* 1083 */
-		{TIMESTAMPOID, OFTDateTime}, /* 1114 */
-		{NUMERICOID, OFTReal}, /* 1700 */
-		{0, 0}};
+	if ((isinf(f) && !isinf(d)) || (f == 0.0f && d != 0.0))
+		ereport(ERROR,
+		        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+		         errmsg("\"%g\" is out of range for type real", d)));
 
-	struct PgOgrMap* map = data;
-	while (map->pg)
-	{
-		if (ogr_type == map->ogr) return true;
-		else map++;
-	}
-	return false;
+	return f;
+}
 
+static OGRErr
+ogrConvertFloat4(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	*value = Float4GetDatum(ogrDoubleToFloat4(ogrStepGetDouble(feat, step)));
+	*isnull = false;
+	return OGRERR_NONE;
 }
 
+static OGRErr
+ogrConvertFloat8(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	*value = Float8GetDatum(ogrStepGetDouble(feat, step));
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
-static void
-pgCheckConvertToOgr(Oid pg_type, OGRFieldType ogr_type, const char *colname, const char *tblname)
+static OGRErr
+ogrConvertNumeric(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
 {
-	if (pgCanConvertToOgr(pg_type, ogr_type))
-		return;
+	Datum num = DirectFunctionCall1(int8_numeric, Int64GetDatum(ogrStepGetInteger(feat, step)));
 
-	ereport(ERROR, (
-	    errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-	    errmsg("column \"%s\" of foreign table \"%s\" converts \"%s\" to OGR \"%s\"",
-	        colname, tblname,
-	        format_type_be(pg_type), OGR_GetFieldTypeName(ogr_type))
-	    ));
-}
+	/* Apply the column precision and scale, as numeric_in would */
+	if (step->col->pgtypmod >= 0)
+		num = DirectFunctionCall2(numeric, num, Int32GetDatum(step->col->pgtypmod));
 
+	*value = num;
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
-static bool
-ogrCanConvertToPg(OGRFieldType ogr_type, Oid pg_type)
+static OGRErr
+ogrConvertBool(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
 {
-	struct OgrPgMap
-	{
-		OGRFieldType ogr;
-		Oid pg[16];
-	};
+	int64 i = ogrStepGetInteger(feat, step);
 
-	static struct OgrPgMap data[] =
-	{
-		{OFTInteger, {BOOLOID, INT4OID, INT8OID, NUMERICOID, FLOAT4OID, FLOAT8OID, TEXTOID, VARCHAROID, 0}},
-		{OFTReal, {NUMERICOID, FLOAT4OID, FLOAT8OID, TEXTOID, VARCHAROID, 0}},
-		{OFTBinary, {BYTEAOID, 0}},
-		{OFTString, {TEXTOID, VARCHAROID, CHAROID, BPCHAROID, JSONBOID, JSONOID, 0}},
-		{OFTDate, {DATEOID, TIMESTAMPOID, TEXTOID, VARCHAROID, 0}},
-		{OFTTime, {TIMEOID, TEXTOID, VARCHAROID, 0}},
-		{OFTDateTime, {TIMESTAMPOID, TEXTOID, VARCHAROID, 0}},
-	#if GDAL_VERSION_MAJOR >= 2
-		{OFTInteger64, {INT8OID, NUMERICOID, FLOAT8OID, TEXTOID, VARCHAROID, 0}},
-		{OFTInteger64List, {INT8ARRAYOID, FLOAT8ARRAYOID, TEXTARRAYOID, VARCHARARRAYOID, 0}},
-	#endif
-		{OFTRealList, {FLOAT4ARRAYOID, FLOAT8ARRAYOID, TEXTARRAYOID, VARCHARARRAYOID, 0}},
-		{OFTStringList, {TEXTARRAYOID, VARCHARARRAYOID, NAMEARRAYOID, CHARARRAYOID, 0}},
-		{OFTIntegerList, {BOOLARRAYOID, INT2ARRAYOID, INT4ARRAYOID, INT8ARRAYOID, TEXTARRAYOID, VARCHARARRAYOID, 0}},
-		{256, {0}} /* Zero terminate list */
-	};
+	/* Anything but 0/1 gets the usual boolin complaint from the text path */
+	if (i != 0 && i != 1)
+		return ogrConvertText(feat, step, execstate, value, isnull);
 
-	struct OgrPgMap* map = data;
-	while (map->ogr <= OFTMaxType)
+	*value = BoolGetDatum(i == 1);
+	*isnull = false;
+	return OGRERR_NONE;
+}
+
+/*
+ * Pick a binary converter for an integer or real source going
+ * into pgtype, or NULL if the text path has to handle it.
+ * Real values going to numeric stay on the text path, since
+ * OGR's string form carries the source field's scale.
+ */
+static OgrFdwConvertFunc
+ogrNumberConverter(Oid pgtype, bool integer)
+{
+	switch (pgtype)
 	{
-		if (ogr_type == map->ogr)
-		{
-			Oid *typ = map->pg;
-			while (*typ)
-			{
-				if (pg_type == *typ) return true;
-				else typ++;
-			}
-		}
-		map++;
+	case INT2OID:
+		return integer ? ogrConvertInt2 : NULL;
+	case INT4OID:
+		return integer ? ogrConvertInt4 : NULL;
+	case INT8OID:
+		return integer ? ogrConvertInt8 : NULL;
+	case FLOAT4OID:
+		return ogrConvertFloat4;
+	case FLOAT8OID:
+		return ogrConvertFloat8;
+	case NUMERICOID:
+		return integer ? ogrConvertNumeric : NULL;
+	case BOOLOID:
+		return integer ? ogrConvertBool : NULL;
+	default:
+		return NULL;
 	}
-
-	return false;
 }
 
-static void
-ogrCheckConvertToPg(OGRFieldType ogr_type, Oid pg_type, const char *colname, const char *tblname)
+/*
+ * Generate standard PgSQL variable length byte buffer,
+ * with WKB of the OGR geometry filled into the data area.
+ * Returns NULL when the feature has no geometry.
+ */
+static bytea*
+ogrGeometryToVarlena(const OGRFeatureH feat, int ogrfldnum, OGRErr* err)
 {
-	if (ogrCanConvertToPg(ogr_type, pg_type))
-		return;
+	int wkbsize;
+	int varsize;
+	bytea* varlena;
+	unsigned char* wkb;
 
-	if (ogr_type == OFTWideString || ogr_type == OFTWideStringList)
-	{
-		ereport(ERROR, (
-		    errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-		    errmsg("column \"%s\" of foreign table \"%s\" uses an OGR OFTWideString, deprecated", colname, tblname)
-		    ));
-		return;
-	}
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+	OGRGeometryH geom = OGR_F_GetGeomFieldRef(feat, ogrfldnum);
+#else
+	OGRGeometryH geom = OGR_F_GetGeometryRef(feat);
+#endif
 
-	ereport(ERROR, (
-	    errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-	    errmsg("column \"%s\" of foreign table \"%s\" converts OGR \"%s\" to \"%s\"",
-	           colname, tblname,
-	           OGR_GetFieldTypeName(ogr_type), format_type_be(pg_type))
-	    ));
-}
+	*err = OGRERR_NONE;
 
+	/* No geometry ? NULL */
+	if (! geom)
+		return NULL;
 
-#ifdef OGR_FDW_HEXWKB
+	wkbsize = OGR_G_WkbSize(geom);
+	varsize = wkbsize + VARHDRSZ;
+	varlena = palloc(varsize);
+	wkb = (unsigned char*)VARDATA(varlena);
+	*err = OGR_G_ExportToWkb(geom, wkbNDR, wkb);
+	SET_VARSIZE(varlena, varsize);
 
-static char* hexchr = "0123456789ABCDEF";
+	return varlena;
+}
 
-static char*
-ogrBytesToHex(unsigned char* bytes, size_t size)
+/*
+ * WKB of the step's geometry, if a background reader has
+ * already exported it for the current feature.
+ */
+static const unsigned char*
+ogrPrefetchedWkb(const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, int* wkbsize)
 {
-	char* hex;
-	int i;
-	if (! bytes || ! size)
-	{
-		elog(ERROR, "ogrBytesToHex: invalid input");
+	if (!execstate->reader)
 		return NULL;
+	return ogrReaderWkb(execstate->reader, step->ogrfldnum, wkbsize);
+}
+
+static OGRErr
+ogrConvertGeometryBytea(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	OGRErr err;
+	bytea* varlena;
+	int wkbsize;
+	const unsigned char* wkb = ogrPrefetchedWkb(step, execstate, &wkbsize);
+
+	if (wkb)
+	{
+		varlena = palloc(wkbsize + VARHDRSZ);
+		memcpy(VARDATA(varlena), wkb, wkbsize);
+		SET_VARSIZE(varlena, wkbsize + VARHDRSZ);
+		*isnull = false;
+		*value = PointerGetDatum(varlena);
+		return OGRERR_NONE;
 	}
-	hex = palloc(size * 2 + 1);
-	hex[2 * size] = '\0';
-	for (i = 0; i < size; i++)
+
+	varlena = ogrGeometryToVarlena(feat, step->ogrfldnum, &err);
+
+	/* Couldn't create WKB from OGR geometry? error */
+	if (err != OGRERR_NONE)
+		return err;
+
+	/*
+	 * Nothing special to do for bytea, just send the varlena data through!
+	 */
+	if (varlena)
 	{
-		/* Top four bits to 0-F */
-		hex[2 * i] = hexchr[bytes[i] >> 4];
-		/* Bottom four bits to 0-F */
-		hex[2 * i + 1] = hexchr[bytes[i] & 0x0F];
+		*isnull = false;
+		*value = PointerGetDatum(varlena);
 	}
-	return hex;
+	return OGRERR_NONE;
 }
 
+/*
+ * Turn WKB into a geometry datum for a geometry column,
+ * applying the column's typmod SRID when the conversion
+ * step asks for it. Shared by the feature and Arrow readers.
+ */
+Datum
+ogrWkbToGeometryDatum(const unsigned char* wkb, int wkbsize, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate)
+{
+	Datum value;
+
+	/*
+	 * For geometry we need to convert the varlena WKB data into a serialized
+	 * geometry (aka "gserialized"). For that, we can use the type's "recv" function
+	 * which takes in WKB and spits out serialized form, or the "input" function
+	 * that takes in HEXWKB. The "input" function is more lax about geometry
+	 * structure errors (unclosed polys, etc).
+	 */
+#ifdef OGR_FDW_HEXWKB
+	{
+		char* hexwkb = ogrBytesToHex((unsigned char*)wkb, wkbsize);
+		/*
+		 * Use the input function to convert the WKB from OGR into
+		 * a PostGIS internal format.
+		 */
+		value = OidFunctionCall1(step->col->pginputfunc, PointerGetDatum(hexwkb));
+		pfree(hexwkb);
+	}
+#else
+	{
+		/*
+		 * The "recv" function expects to receive a StringInfo pointer
+		 * on the first argument, so we form one of those ourselves by
+		 * hand. Rather than copy into a fresh buffer, we'll just use the
+		 * existing buffer and point to the data area.
+		 *
+		 * The "recv" function tests for basic geometry validity,
+		 * things like polygon closure, etc. So don't feed it junk.
+		 */
+		StringInfoData strinfo;
+		strinfo.data = (char*)wkb;
+		strinfo.len = wkbsize;
+		strinfo.maxlen = strinfo.len;
+		strinfo.cursor = 0;
+
+		/*
+		 * Use the recv function to convert the WKB from OGR into
+		 * a PostGIS internal format.
+		 */
+		value = OidFunctionCall1(step->col->pgrecvfunc, PointerGetDatum(&strinfo));
+	}
 #endif
 
-static void
-freeOgrFdwTable(OgrFdwTable* table)
-{
-	if (table)
+	/*
+	 * Apply the typmod restriction to the incoming geometry, so it's
+	 * not really a restriction anymore, it's more like a requirement.
+	 *
+	 * TODO: In the case where the OGR input actually *knows* what SRID
+	 * it is, we should actually apply *that* and let the restriction run
+	 * its usual course.
+	 */
+	if (step->flags & OGR_CONVERT_SETSRID)
 	{
-		if (table->tblname)
-		{
-			pfree(table->tblname);
-		}
-		if (table->cols)
-		{
-			pfree(table->cols);
-		}
-		pfree(table);
+		Datum srid = OidFunctionCall1(execstate->typmodsridfunc, Int32GetDatum(step->col->pgtypmod));
+		value = OidFunctionCall2(execstate->setsridfunc, value, srid);
 	}
+
+	return value;
 }
 
-typedef struct
+static OGRErr
+ogrConvertGeometry(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
 {
-	char* fldname;
-	int fldnum;
-} OgrFieldEntry;
+	OGRErr err;
+	bytea* varlena;
+	int wkbsize;
+	const unsigned char* wkb = ogrPrefetchedWkb(step, execstate, &wkbsize);
 
-static int
-ogrFieldEntryCmpFunc(const void* a, const void* b)
-{
-	const char* a_name = ((OgrFieldEntry*)a)->fldname;
-	const char* b_name = ((OgrFieldEntry*)b)->fldname;
+	if (wkb)
+	{
+		*isnull = false;
+		*value = ogrWkbToGeometryDatum(wkb, wkbsize, step, execstate);
+		return OGRERR_NONE;
+	}
 
-	return strcasecmp(a_name, b_name);
+	varlena = ogrGeometryToVarlena(feat, step->ogrfldnum, &err);
+
+	/* Couldn't create WKB from OGR geometry? error */
+	if (err != OGRERR_NONE)
+		return err;
+
+	/* No geometry column, so the output stays null */
+	if (!varlena)
+		return OGRERR_NONE;
+
+	*isnull = false;
+	*value = ogrWkbToGeometryDatum((unsigned char*)VARDATA(varlena), VARSIZE(varlena) - VARHDRSZ, step, execstate);
+	return OGRERR_NONE;
 }
 
+static OGRErr
+ogrConvertBinary(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	/*
+	 * Convert binary fields to bytea directly
+	 */
+	int bufsize;
+	GByte* buf = OGR_F_GetFieldAsBinary(feat, step->ogrfldnum, &bufsize);
+	int varsize = bufsize + VARHDRSZ;
+	bytea* varlena = palloc(varsize);
+	memcpy(VARDATA(varlena), buf, bufsize);
+	SET_VARSIZE(varlena, varsize);
+	*isnull = false;
+	*value = PointerGetDatum(varlena);
+	return OGRERR_NONE;
+}
 
-/*
- * The execstate holds a foreign table relation id and an OGR connection,
- * this function finds all the OGR fields that match up to columns in the
- * foreign table definition, using columns name match and data type consistency
- * as the criteria for making a match.
- * The results of the matching are stored in the execstate before the function
- * returns.
- */
-static void
-ogrReadColumnData(OgrFdwState* state)
+static OGRErr
+ogrConvertText(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
 {
-	Relation rel;
-	TupleDesc tupdesc;
-	int i;
-	OgrFdwTable* tbl;
-	OGRFeatureDefnH dfn;
-	int ogr_ncols;
-	int fid_count = 0;
-	int geom_count = 0;
-	int ogr_geom_count = 0;
-	int field_count = 0;
-	OgrFieldEntry* ogr_fields;
-	int ogr_fields_count = 0;
-	char* tblname = get_rel_name(state->foreigntableid);
+	/*
+	 * Convert strings, and any numbers without a binary fast path,
+	 * via a string representation.
+	 */
+	const char* cstr_in = OGR_F_GetFieldAsString(feat, step->ogrfldnum);
+	*value = pgDatumFromCString(cstr_in, step->col, execstate->ogr.char_encoding, isnull);
+	return OGRERR_NONE;
+}
 
-	/* Blow away any existing table in the state */
-	if (state->table)
-	{
-		freeOgrFdwTable(state->table);
-		state->table = NULL;
-	}
+static OGRErr
+ogrConvertDateTimeText(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	/*
+	 * OGR date/times have a weird access method, so we use that to pull
+	 * out the raw data and turn it into a string for PgSQL's (very
+	 * sophisticated) date/time parsing routines to handle.
+	 */
+	int year, month, day, hour, minute, second, tz;
+	char cstr[CSTR_SZ];
+	OGRFieldType ogrfldtype = step->col->ogrfldtype;
 
-	/* Fresh table */
-	tbl = palloc0(sizeof(OgrFdwTable));
+	OGR_F_GetFieldAsDateTime(feat, step->ogrfldnum,
+	                         &year, &month, &day,
+	                         &hour, &minute, &second, &tz);
 
-	/* One column for each PgSQL foreign table column */
-#if PG_VERSION_NUM < 120000
-	rel = heap_open(state->foreigntableid, NoLock);
+	if (ogrfldtype == OFTDate)
+	{
+		snprintf(cstr, CSTR_SZ, "%d-%02d-%02d", year, month, day);
+	}
+	else if (ogrfldtype == OFTTime)
+	{
+		snprintf(cstr, CSTR_SZ, "%02d:%02d:%02d", hour, minute, second);
+	}
+	else
+	{
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,7,0))
+		const char* tsstr = OGR_F_GetFieldAsISO8601DateTime(feat, step->ogrfldnum, NULL);
+		strlcpy(cstr, tsstr, CSTR_SZ);
 #else
-	rel = table_open(state->foreigntableid, NoLock);
-#endif /* PG_VERSION_NUM */
-
-	tupdesc = rel->rd_att;
-	state->tupdesc = tupdesc;
-	tbl->ncols = tupdesc->natts;
-	tbl->cols = palloc0(tbl->ncols * sizeof(OgrFdwColumn));
-	tbl->tblname = pstrdup(tblname);
+		snprintf(cstr, CSTR_SZ, "%d-%02d-%02d %02d:%02d:%02d", year, month, day, hour, minute, second);
+#endif
+	}
+	*value = pgDatumFromCString(cstr, step->col, PG_SQL_ASCII, isnull);
+	return OGRERR_NONE;
+}
 
-	/* Get OGR metadata ready */
-	dfn = OGR_L_GetLayerDefn(state->ogr.lyr);
-	ogr_ncols = OGR_FD_GetFieldCount(dfn);
-#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
-	ogr_geom_count = OGR_FD_GetGeomFieldCount(dfn);
+/*
+ * Native date/time converters, building the PgSQL datum
+ * directly from the components OGR holds, rather than
+ * printing them and running the datetime parser.
+ */
+static void
+ogrStepGetDateTime(const OGRFeatureH feat, const OgrFdwConvertStep* step, struct pg_tm* tm, fsec_t* fsec, int* tzflag)
+{
+	int year, month, day, hour, minute, msecs;
+#if GDAL_VERSION_MAJOR >= 2
+	float second;
+	OGR_F_GetFieldAsDateTimeEx(feat, step->ogrfldnum,
+	                           &year, &month, &day,
+	                           &hour, &minute, &second, tzflag);
+	/* OGR keeps millisecond precision, as its ISO8601 output shows */
+	msecs = (int) rint(second * 1000.0);
 #else
-	ogr_geom_count = (OGR_FD_GetGeomType(dfn) != wkbNone) ? 1 : 0;
+	int second;
+	OGR_F_GetFieldAsDateTime(feat, step->ogrfldnum,
+	                         &year, &month, &day,
+	                         &hour, &minute, &second, tzflag);
+	msecs = second * 1000;
 #endif
 
+	memset(tm, 0, sizeof(struct pg_tm));
+	tm->tm_year = year;
+	tm->tm_mon = month;
+	tm->tm_mday = day;
+	tm->tm_hour = hour;
+	tm->tm_min = minute;
+	tm->tm_sec = msecs / 1000;
+	*fsec = (msecs % 1000) * 1000;
+}
+
+static OGRErr
+ogrConvertDate(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	struct pg_tm tm;
+	fsec_t fsec;
+	int tzflag;
+	DateADT date;
 
-	/* Prepare sorted list of OGR column names */
-	/* TODO: change this to a hash table, to avoid repeated strcmp */
-	/* We will search both the original and laundered OGR field names for matches */
-	ogr_fields_count = 2 * ogr_ncols;
-	ogr_fields = palloc0(ogr_fields_count * sizeof(OgrFieldEntry));
-	for (i = 0; i < ogr_ncols; i++)
-	{
-		char* fldname = pstrdup(OGR_Fld_GetNameRef(OGR_FD_GetFieldDefn(dfn, i)));
-		char* fldname_laundered = palloc(STR_MAX_LEN);
-		strlcpy(fldname_laundered, fldname, STR_MAX_LEN);
-		ogrStringLaunder(fldname_laundered);
-		ogr_fields[2 * i].fldname = fldname;
-		ogr_fields[2 * i].fldnum = i;
-		ogr_fields[2 * i + 1].fldname = fldname_laundered;
-		ogr_fields[2 * i + 1].fldnum = i;
-	}
-	qsort(ogr_fields, ogr_fields_count, sizeof(OgrFieldEntry), ogrFieldEntryCmpFunc);
+	ogrStepGetDateTime(feat, step, &tm, &fsec, &tzflag);
 
+	if (!IS_VALID_JULIAN(tm.tm_year, tm.tm_mon, tm.tm_mday))
+		ereport(ERROR,
+		        (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+		         errmsg("date out of range: \"%d-%02d-%02d\"", tm.tm_year, tm.tm_mon, tm.tm_mday)));
 
-	/* loop through foreign table columns */
-	for (i = 0; i < tbl->ncols; i++)
-	{
-		List* options;
-		ListCell* lc;
-		OgrFieldEntry* found_entry;
-		OgrFieldEntry entry;
+	date = date2j(tm.tm_year, tm.tm_mon, tm.tm_mday) - POSTGRES_EPOCH_JDATE;
 
-		Form_pg_attribute att_tuple = TupleDescAttr(tupdesc, i);
+#ifdef IS_VALID_DATE
+	/* Like date_in, also catch dates just past the end of the range */
+	if (!IS_VALID_DATE(date))
+		ereport(ERROR,
+		        (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+		         errmsg("date out of range: \"%d-%02d-%02d\"", tm.tm_year, tm.tm_mon, tm.tm_mday)));
+#endif
 
-		OgrFdwColumn col = tbl->cols[i];
-		col.pgattnum = att_tuple->attnum;
-		col.pgtype = att_tuple->atttypid;
-		col.pgtypmod = att_tuple->atttypmod;
-		col.pgattisdropped = att_tuple->attisdropped;
+	*value = DateADTGetDatum(date);
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
-		/* Skip filling in any further metadata about dropped columns */
-		if (col.pgattisdropped)
-		{
-			continue;
-		}
+static OGRErr
+ogrConvertTime(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	struct pg_tm tm;
+	fsec_t fsec;
+	int tzflag;
+	TimeADT t;
 
-		/* Check for array type */
-		col.pgelmtype = get_element_type(col.pgtype);
-		if (col.pgelmtype)
-		{
-			/* Extra type info needed to form the array */
-			col.pgisarray = true;
-		}
-		else
-			col.pgelmtype = col.pgtype;
+	ogrStepGetDateTime(feat, step, &tm, &fsec, &tzflag);
+	t = ((((tm.tm_hour * MINS_PER_HOUR + tm.tm_min) * SECS_PER_MINUTE) + tm.tm_sec) * USECS_PER_SEC) + fsec;
 
-		/* Find the appropriate conversion functions */
-		getTypeInputInfo(col.pgelmtype, &col.pginputfunc, &col.pginputioparam);
-		getTypeBinaryInputInfo(col.pgelmtype, &col.pgrecvfunc, &col.pgrecvioparam);
-		getTypeOutputInfo(col.pgelmtype, &col.pgoutputfunc, &col.pgoutputvarlena);
-		getTypeBinaryOutputInfo(col.pgelmtype, &col.pgsendfunc, &col.pgsendvarlena);
+	*value = TimeADTGetDatum(t);
+	if (step->col->pgtypmod >= 0)
+		*value = DirectFunctionCall2(time_scale, *value, Int32GetDatum(step->col->pgtypmod));
 
-		/* Get the PgSQL column name */
-#if PG_VERSION_NUM >= 110000
-		col.pgname = pstrdup(get_attname(rel->rd_id, att_tuple->attnum, false));
-#else
-		col.pgname = pstrdup(get_attname(rel->rd_id, att_tuple->attnum));
-#endif
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
-		/* Handle FID first */
-		if (strcaseeq(col.pgname, "fid") &&
-		        (col.pgtype == INT4OID || col.pgtype == INT8OID))
-		{
-			if (fid_count >= 1)
-			{
-				elog(ERROR, "FDW table '%s' includes more than one FID column", tblname);
-			}
+static OGRErr
+ogrConvertTimestamp(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	struct pg_tm tm;
+	fsec_t fsec;
+	int tzflag;
+	Timestamp ts;
 
-			col.ogrvariant = OGR_FID;
-			col.ogrfldnum = fid_count++;
-			tbl->cols[i] = col;
-			continue;
-		}
+	/* Like timestamp_in, any OGR time zone is ignored */
+	ogrStepGetDateTime(feat, step, &tm, &fsec, &tzflag);
 
-		/* If the OGR source has geometries, can we match them to Pg columns? */
-		/* We'll match to the first ones we find, irrespective of name */
-		if (geom_count < ogr_geom_count && col.pgtype == ogrGetGeometryOid())
-		{
-			col.ogrvariant = OGR_GEOMETRY;
-			col.ogrfldtype = OFTBinary;
-			col.ogrfldnum = geom_count++;
-			tbl->cols[i] = col;
-			continue;
-		}
+	if (tm2timestamp(&tm, fsec, NULL, &ts) != 0)
+		ereport(ERROR,
+		        (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+		         errmsg("timestamp out of range")));
 
-		/* Now we search for matches in the OGR fields */
+	*value = TimestampGetDatum(ts);
+	if (step->col->pgtypmod >= 0)
+		*value = DirectFunctionCall2(timestamp_scale, *value, Int32GetDatum(step->col->pgtypmod));
 
-		/* By default, search for the PgSQL column name */
-		entry.fldname = col.pgname;
-		entry.fldnum = 0;
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
-		/*
-		 * But, if there is a 'column_name' option for this column, we
-		 * want to search for *that* in the OGR layer.
-		 */
-		options = GetForeignColumnOptions(state->foreigntableid, i + 1);
-		foreach (lc, options)
-		{
-			DefElem*    def = (DefElem*) lfirst(lc);
+static OGRErr
+ogrConvertTimestampTz(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	struct pg_tm tm;
+	fsec_t fsec;
+	int tzflag;
+	int tz;
+	TimestampTz ts;
 
-			if (streq(def->defname, OPT_COLUMN))
-			{
-				entry.fldname = defGetString(def);
-				break;
-			}
-		}
+	ogrStepGetDateTime(feat, step, &tm, &fsec, &tzflag);
 
-		/* Search PgSQL column name in the OGR column name list */
-		found_entry = bsearch(&entry, ogr_fields, ogr_fields_count, sizeof(OgrFieldEntry), ogrFieldEntryCmpFunc);
+	/*
+	 * OGR TZ flag: 0 unknown, 1 local time, 100 GMT, and
+	 * otherwise GMT offset in 15 minute steps from 100, so
+	 * values below 100 are west of Greenwich (96 is GMT-1).
+	 * PgSQL wants seconds west of Greenwich. Unknown and local
+	 * times are read in the session time zone, as timestamptz_in
+	 * does for strings without an offset.
+	 */
+	if (tzflag > 1)
+		tz = -(tzflag - 100) * 15 * SECS_PER_MINUTE;
+	else
+		tz = DetermineTimeZoneOffset(&tm, session_timezone);
 
-		/* Column name matched, so save this entry, if the types are consistent */
-		if (found_entry)
-		{
-			OGRFieldDefnH fld = OGR_FD_GetFieldDefn(dfn, found_entry->fldnum);
-			OGRFieldType fldtype = OGR_Fld_GetType(fld);
+	if (tm2timestamp(&tm, fsec, &tz, &ts) != 0)
+		ereport(ERROR,
+		        (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+		         errmsg("timestamp out of range")));
 
-			/* Error if types mismatched when column names match */
-			ogrCheckConvertToPg(fldtype, col.pgtype, col.pgname, tblname);
+	*value = TimestampTzGetDatum(ts);
+	if (step->col->pgtypmod >= 0)
+		*value = DirectFunctionCall2(timestamptz_scale, *value, Int32GetDatum(step->col->pgtypmod));
 
-			col.ogrvariant = OGR_FIELD;
-			col.ogrfldnum = found_entry->fldnum;
-			col.ogrfldtype = fldtype;
-			field_count++;
-		}
-		else
-		{
-			col.ogrvariant = OGR_UNMATCHED;
-		}
-		tbl->cols[i] = col;
+	*isnull = false;
+	return OGRERR_NONE;
+}
+
+#if GDAL_VERSION_MAJOR >= 2
+static OGRErr
+ogrConvertInteger64List(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	const OgrFdwColumn* col = step->col;
+	int ilist_size;
+	const int64 *ilist = (int64*)OGR_F_GetFieldAsInteger64List(feat, step->ogrfldnum, &ilist_size);
+	ArrayBuildState *abs = initArrayResult(col->pgelmtype, CurrentMemoryContext, false);
+	char cstr[CSTR_SZ];
+	int i;
+
+	for (i = 0; i < ilist_size; i++)
+	{
+		bool is_null = false;
+		snprintf(cstr, CSTR_SZ, OGR_FDW_FRMT_INT64, OGR_FDW_CAST_INT64(ilist[i]));
+		abs = accumArrayResult(abs,
+		          pgDatumFromCString(cstr, col, execstate->ogr.char_encoding, &is_null),
+		          is_null,
+		          col->pgelmtype,
+		          CurrentMemoryContext);
 	}
+	*value = makeArrayResult(abs, CurrentMemoryContext);
+	*isnull = false;
+	return OGRERR_NONE;
+}
+#endif
 
-	elog(DEBUG2, "ogrReadColumnData matched %d FID, %d GEOM, %d FIELDS out of %d PGSQL COLUMNS", fid_count, geom_count,
-	     field_count, tbl->ncols);
+static OGRErr
+ogrConvertIntegerList(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	const OgrFdwColumn* col = step->col;
+	int ilist_size;
+	const int *ilist = OGR_F_GetFieldAsIntegerList(feat, step->ogrfldnum, &ilist_size);
+	ArrayBuildState *abs = initArrayResult(col->pgelmtype, CurrentMemoryContext, false);
+	char cstr[CSTR_SZ];
+	int i;
 
-	/* Clean up */
+	for (i = 0; i < ilist_size; i++)
+	{
+		bool is_null = false;
+		snprintf(cstr, CSTR_SZ, "%d", ilist[i]);
+		abs = accumArrayResult(abs,
+		          pgDatumFromCString(cstr, col, execstate->ogr.char_encoding, &is_null),
+		          is_null,
+		          col->pgelmtype,
+		          CurrentMemoryContext);
+	}
+	*value = makeArrayResult(abs, CurrentMemoryContext);
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
-	state->table = tbl;
-	for (i = 0; i < 2 * ogr_ncols; i++)
+static OGRErr
+ogrConvertRealList(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	const OgrFdwColumn* col = step->col;
+	int rlist_size;
+	const double *rlist = OGR_F_GetFieldAsDoubleList(feat, step->ogrfldnum, &rlist_size);
+	ArrayBuildState *abs = initArrayResult(col->pgelmtype, CurrentMemoryContext, false);
+	char cstr[CSTR_SZ];
+	int i;
+
+	for (i = 0; i < rlist_size; i++)
 	{
-		if (ogr_fields[i].fldname)
-		{
-			pfree(ogr_fields[i].fldname);
-		}
+		bool is_null = false;
+		snprintf(cstr, CSTR_SZ, "%g", rlist[i]);
+		abs = accumArrayResult(abs,
+		          pgDatumFromCString(cstr, col, execstate->ogr.char_encoding, &is_null),
+		          is_null,
+		          col->pgelmtype,
+		          CurrentMemoryContext);
 	}
-	pfree(ogr_fields);
-#if PG_VERSION_NUM < 120000
-	heap_close(rel, NoLock);
-#else
-	table_close(rel, NoLock);
-#endif /* PG_VERSION_NUM */
+	*value = makeArrayResult(abs, CurrentMemoryContext);
+	*isnull = false;
+	return OGRERR_NONE;
+}
 
+static OGRErr
+ogrConvertStringList(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	const OgrFdwColumn* col = step->col;
+	ArrayBuildState *abs = initArrayResult(col->pgelmtype, CurrentMemoryContext, false);
+	char **cstrs = OGR_F_GetFieldAsStringList(feat, step->ogrfldnum);
 
-	return;
+	while (cstrs && *cstrs)
+	{
+		bool is_null = false;
+		abs = accumArrayResult(abs,
+		          pgDatumFromCString(*cstrs, col, execstate->ogr.char_encoding, &is_null),
+		          is_null,
+		          col->pgelmtype,
+		          CurrentMemoryContext);
+		cstrs++;
+	}
+	*value = makeArrayResult(abs, CurrentMemoryContext);
+	*isnull = false;
+	return OGRERR_NONE;
 }
 
+/*
+ * Columns whose OGR type cannot be read into their PgSQL type
+ * only raise an error once a value actually needs converting,
+ * so queries that never touch one still run.
+ */
+static OGRErr
+ogrConvertUnsupported(const OGRFeatureH feat, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	const OgrFdwColumn* col = step->col;
+	ogrCheckConvertToPg(col->ogrfldtype, col->pgtype, col->pgname, execstate->table->tblname);
+	return OGRERR_FAILURE;
+}
 
 /*
- * ogrLookupGeometryFunctionOid
- *
- * Find the procedure Oids of useful functions so we can call
- * them later. In the case where multiple functions have the
- * same signature, in different namespaces (???) we might have
- * problems, but that seems very unlikely.
- *
- * https://github.com/pramsey/pgsql-ogr-fdw/issues/266
+ * Pick the converter for an OGR field.
  */
-static Oid
-ogrLookupGeometryFunctionOid(const char* proname)
+static OgrFdwConvertFunc
+ogrFieldConverter(const OgrFdwColumn* col)
 {
-	CatCList   *clist;
-	int			i;
-	Oid result = InvalidOid;
+	OgrFdwConvertFunc func;
 
-	/* This only works if PostGIS is installed */
-	if (ogrGetGeometryOid() == InvalidOid ||
-	    ogrGetGeometryOid() == BYTEAOID)
+	if (!ogrCanConvertToPg(col->ogrfldtype, col->pgtype))
+		return ogrConvertUnsupported;
+
+	switch (col->ogrfldtype)
 	{
-		return result;
+	case OFTBinary:
+		return ogrConvertBinary;
+	case OFTInteger:
+#if GDAL_VERSION_MAJOR >= 2
+	case OFTInteger64:
+#endif
+		func = ogrNumberConverter(col->pgtype, true);
+		return func ? func : ogrConvertText;
+	case OFTReal:
+		func = ogrNumberConverter(col->pgtype, false);
+		return func ? func : ogrConvertText;
+	case OFTString:
+		return ogrConvertText;
+	case OFTDate:
+	case OFTTime:
+	case OFTDateTime:
+		switch (col->pgtype)
+		{
+		case DATEOID:
+			return ogrConvertDate;
+		case TIMEOID:
+			return ogrConvertTime;
+		case TIMESTAMPOID:
+			return ogrConvertTimestamp;
+		case TIMESTAMPTZOID:
+			return ogrConvertTimestampTz;
+		default:
+			return ogrConvertDateTimeText;
+		}
+#if GDAL_VERSION_MAJOR >= 2
+	case OFTInteger64List:
+		return ogrConvertInteger64List;
+#endif
+	case OFTIntegerList:
+		return ogrConvertIntegerList;
+	case OFTRealList:
+		return ogrConvertRealList;
+	case OFTStringList:
+		return ogrConvertStringList;
+	default:
+		elog(ERROR, "unsupported OGR type \"%s\"", OGR_GetFieldTypeName(col->ogrfldtype));
+		return NULL;
 	}
+}
 
-	if (!proname) return result;
-
-	/* Search syscache by name only */
-	clist = SearchSysCacheList1(PROCNAMEARGSNSP,
-	                            CStringGetDatum(proname));
+/*
+ * None of the column metadata changes during a scan, so work
+ * out once, at scan start, which columns need converting and
+ * how. Dropped and unmatched columns, and columns the query
+ * does not use, get no step, they are always NULL.
+ */
+static void
+ogrBuildConvertProgram(OgrFdwExecState* execstate, const Bitmapset* retrieved_attrs)
+{
+	const OgrFdwTable* tbl = execstate->table;
+	bool have_typmod_funcs = (execstate->setsridfunc && execstate->typmodsridfunc);
+	int i;
 
-	if (!clist) return InvalidOid;
+	execstate->program = palloc0(tbl->ncols * sizeof(OgrFdwConvertStep));
+	execstate->nsteps = 0;
 
-	for (i = 0; i < clist->n_members; i++)
+	for (i = 0; i < tbl->ncols; i++)
 	{
-		HeapTuple    proctup = &clist->members[i]->tuple;
-		Form_pg_proc procform = (Form_pg_proc) GETSTRUCT(proctup);
-		Oid         *proargtypes = procform->proargtypes.values;
-		int          pronargs = procform->pronargs;
+		const OgrFdwColumn* col = &(tbl->cols[i]);
+		OgrFdwConvertStep* step = &(execstate->program[execstate->nsteps]);
 
-#if PG_VERSION_NUM >= 120000
-		Oid procoid = procform->oid;
-#else
-		Oid procoid = HeapTupleGetOid(proctup);
-#endif
+		if (col->pgattisdropped || !bms_is_member(i + 1, retrieved_attrs))
+			continue;
 
-		/* ST_SetSRID(geometry, integer) */
-		if (streq(proname, "st_setsrid") &&
-		    pronargs == 2 &&
-		    proargtypes[0] == ogrGetGeometryOid())
+		step->attnum = i;
+		step->ogrfldnum = col->ogrfldnum;
+		step->col = col;
+		step->flags = 0;
+
+		if (col->ogrvariant == OGR_FID)
+		{
+			OgrFdwConvertFunc func = ogrNumberConverter(col->pgtype, true);
+			step->flags |= OGR_CONVERT_FID | OGR_CONVERT_INTEGER;
+			step->convert = func ? func : ogrConvertFid;
+		}
+		else if (col->ogrvariant == OGR_GEOMETRY)
+		{
+			if (col->pgtype == BYTEAOID)
+			{
+				step->convert = ogrConvertGeometryBytea;
+			}
+			else if (col->pgtype == ogrGetGeometryOid())
+			{
+				step->convert = ogrConvertGeometry;
+				if (have_typmod_funcs && col->pgtypmod >= 0)
+					step->flags |= OGR_CONVERT_SETSRID;
+			}
+			else
+			{
+				elog(NOTICE, "conversion to geometry called with column type not equal to bytea or geometry");
+				continue;
+			}
+		}
+		else if (col->ogrvariant == OGR_FIELD)
 		{
-			result = procoid;
-			break;
+			step->convert = ogrFieldConverter(col);
+			step->flags |= OGR_CONVERT_NULLABLE;
+#if GDAL_VERSION_MAJOR >= 2
+			if (col->ogrfldtype == OFTInteger || col->ogrfldtype == OFTInteger64)
+#else
+			if (col->ogrfldtype == OFTInteger)
+#endif
+				step->flags |= OGR_CONVERT_INTEGER;
 		}
-		/* postgis_typmod_srid(typmod) */
-		else if (streq(proname, "postgis_typmod_srid") &&
-		         pronargs == 1)
+		else if (col->ogrvariant == OGR_UNMATCHED)
 		{
-			/* postgis_typmod_srid(integer) */
-			result = procoid;
-			break;
+			continue;
 		}
 		else
 		{
-			elog(ERROR, "%s could not find function '%s'",
-			     __func__, proname);
+			elog(ERROR, "OGR FDW unsupported column variant in \"%s\", %d", col->pgname, col->ogrvariant);
 		}
-	}
 
-	ReleaseSysCacheList(clist);
-	return result;
+		execstate->nsteps++;
+	}
 }
 
 /*
- * ogrBeginForeignScan
+ * Tell OGR which fields and geometries the scan will not read,
+ * so drivers that support it can skip decoding them. The style
+ * string is never read.
  */
 static void
-ogrBeginForeignScan(ForeignScanState* node, int eflags)
+ogrSetIgnoredFields(OgrFdwExecState* execstate, const Bitmapset* retrieved_attrs)
 {
-	OgrFdwState* state;
-	OgrFdwExecState* execstate;
-	OgrFdwSpatialFilter* spatial_filter;
-	Oid foreigntableid = RelationGetRelid(node->ss.ss_currentRelation);
-	ForeignScan* fsplan = (ForeignScan*)node->ss.ps.plan;
-
-	elog(DEBUG3, "%s: entered function", __func__);
+	const OgrFdwTable* tbl = execstate->table;
+	OGRLayerH lyr = execstate->ogr.lyr;
+	OGRFeatureDefnH dfn;
+	int nfields, ngeoms, nignored = 0;
+	bool* field_used;
+	bool* geom_used;
+	const char** ignored;
+	OGRErr err;
+	int i;
 
-	/* Do nothing in EXPLAIN (no ANALYZE) case */
-	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+	if (!OGR_L_TestCapability(lyr, OLCIgnoreFields))
 		return;
 
-	/* Initialize OGR connection */
-	state = getOgrFdwState(foreigntableid, OGR_EXEC_STATE);
-	execstate = (OgrFdwExecState*)state;
-
-	/* Read the OGR layer definition and PgSQL foreign table definitions */
-	ogrReadColumnData(state);
+	dfn = OGR_L_GetLayerDefn(lyr);
+	nfields = OGR_FD_GetFieldCount(dfn);
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+	ngeoms = OGR_FD_GetGeomFieldCount(dfn);
+#else
+	ngeoms = 1;
+#endif
 
-	/* Collect the procedure Oids for PostGIS functions we might need */
-	execstate->setsridfunc = ogrLookupGeometryFunctionOid("st_setsrid");
-	execstate->typmodsridfunc = ogrLookupGeometryFunctionOid("postgis_typmod_srid");
+	field_used = palloc0(sizeof(bool) * (nfields + 1));
+	geom_used = palloc0(sizeof(bool) * (ngeoms + 1));
+	ignored = palloc0(sizeof(char*) * (nfields + ngeoms + 2));
 
-	/* Get OGR SQL generated by the deparse step during the planner function. */
-	execstate->sql = (char*) strVal(list_nth(fsplan->fdw_private, 0));
+	for (i = 0; i < tbl->ncols; i++)
+	{
+		const OgrFdwColumn* col = &(tbl->cols[i]);
 
-	/* TODO: Use the parse step attribute list to restrict requested columns */
-	// execstate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private, 1);
+		if (col->pgattisdropped || !bms_is_member(i + 1, retrieved_attrs))
+			continue;
 
-	/* Get spatial filter generated by the deparse step. */
-	spatial_filter = ogrSpatialFilterFromList(list_nth(fsplan->fdw_private, 2));
+		if (col->ogrvariant == OGR_FIELD && col->ogrfldnum >= 0 && col->ogrfldnum < nfields)
+			field_used[col->ogrfldnum] = true;
+		else if (col->ogrvariant == OGR_GEOMETRY && col->ogrfldnum >= 0 && col->ogrfldnum < ngeoms)
+			geom_used[col->ogrfldnum] = true;
+	}
 
-	if (spatial_filter)
+	for (i = 0; i < nfields; i++)
 	{
-		OGR_L_SetSpatialFilterRectEx(execstate->ogr.lyr,
-		                             spatial_filter->ogrfldnum,
-		                             spatial_filter->minx,
-		                             spatial_filter->miny,
-		                             spatial_filter->maxx,
-		                             spatial_filter->maxy
-		                             );
+		if (!field_used[i])
+			ignored[nignored++] = OGR_Fld_GetNameRef(OGR_FD_GetFieldDefn(dfn, i));
 	}
 
-	if (execstate->sql && strlen(execstate->sql) > 0)
+	for (i = 0; i < ngeoms; i++)
 	{
-		OGRErr err = OGR_L_SetAttributeFilter(execstate->ogr.lyr, execstate->sql);
-		if (err != OGRERR_NONE)
-		{
-			const char* ogrerr = CPLGetLastErrorMsg();
+		if (geom_used[i])
+			continue;
 
-			if (ogrerr && ! streq(ogrerr, ""))
-			{
-				ereport(NOTICE,
-				        (errcode(ERRCODE_FDW_ERROR),
-				         errmsg("unable to set OGR SQL '%s' on layer", execstate->sql),
-				         errhint("%s", ogrerr)));
-			}
-			else
-			{
-				ereport(NOTICE,
-				        (errcode(ERRCODE_FDW_ERROR),
-				         errmsg("unable to set OGR SQL '%s' on layer", execstate->sql)));
-			}
+		/* The default geometry goes by a special name, whatever it is called */
+		if (i == 0)
+		{
+			ignored[nignored++] = "OGR_GEOMETRY";
 		}
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+		else
+		{
+			const char* geomname = OGR_GFld_GetNameRef(OGR_FD_GetGeomFieldDefn(dfn, i));
+			if (geomname && strlen(geomname) > 0)
+				ignored[nignored++] = geomname;
+		}
+#endif
 	}
-	else
-	{
-		OGR_L_SetAttributeFilter(execstate->ogr.lyr, NULL);
-	}
-
-	/* Save the state for the next call */
-	node->fdw_state = (void*) execstate;
 
-	return;
-}
-
-/*
- * Rather than explicitly try and form PgSQL datums, use the type
- * input functions, that accept cstring representations, and convert
- * to the input format. We have to lookup the right input function for
- * each column in the foreign table.
- */
-static Datum
-pgDatumFromCString(const char* cstr, const OgrFdwColumn *col, int char_encoding, bool *is_null)
-{
-	size_t cstr_len = cstr ? strlen(cstr) : 0;
-	Datum value = (Datum) 0;
-	char *cstr_decoded;
+	ignored[nignored++] = "OGR_STYLE";
 
-	/* Zero length implies NULL for all non-strings */
-	if (cstr_len == 0 && (col->ogrfldtype != OFTString && col->ogrfldtype != OFTStringList))
+	err = OGR_L_SetIgnoredFields(lyr, ignored);
+	if (err != OGRERR_NONE)
 	{
-		*is_null = true;
-		return value;
+		elog(DEBUG2, "%s: unable to set ignored fields on layer, reading all fields", __func__);
+		OGR_L_SetIgnoredFields(lyr, NULL);
+	}
+	else
+	{
+		elog(DEBUG2, "%s: ignoring %d of %d fields", __func__, nignored - 1, nfields + ngeoms);
 	}
 
-	cstr_decoded = char_encoding ?
-			pg_any_to_server(cstr, cstr_len, char_encoding) :
-			pstrdup(cstr);
-
-	value = OidFunctionCall3(col->pginputfunc,
-			    CStringGetDatum(cstr_decoded),
-			    ObjectIdGetDatum(InvalidOid),
-			    Int32GetDatum(col->pgtypmod));
-
-	/* Free cstr_decoded if it is a copy */
-	if (cstr != cstr_decoded)
-		pfree(cstr_decoded);
-
-	*is_null = false;
-	return value;
-}
-
-
-
-static inline void
-ogrNullSlot(Datum* values, bool* nulls, int i)
-{
-	values[i] = PointerGetDatum(NULL);
-	nulls[i] = true;
+	pfree(field_used);
+	pfree(geom_used);
+	pfree(ignored);
 }
 
 /*
@@ -1822,11 +5260,8 @@ ogrNullSlot(Datum* values, bool* nulls, int i)
 * in the query.
 *
 * The tupledescriptor tells us about the types of each slot.
-* For now we assume our slot has exactly the same number of
-* records and equivalent types to our OGR layer, and that our
-* foreign table's first two columns are an integer primary key
-* using int8 as the type, and then a geometry using bytea as
-* the type, then everything else.
+* The conversion program built at scan start tells us which
+* columns to fill, and how.
 */
 static OGRErr
 ogrFeatureToSlot(const OGRFeatureH feat, TupleTableSlot* slot, const OgrFdwExecState* execstate)
@@ -1836,10 +5271,6 @@ ogrFeatureToSlot(const OGRFeatureH feat, TupleTableSlot* slot, const OgrFdwExecS
 	Datum* values = slot->tts_values;
 	bool* nulls = slot->tts_isnull;
 	TupleDesc tupdesc = slot->tts_tupleDescriptor;
-	int have_typmod_funcs = (execstate->setsridfunc && execstate->typmodsridfunc);
-
-#define CSTR_SZ 256
-	char cstr[CSTR_SZ];
 
 	/* Check our assumption that slot and setup data match */
 	if (tbl->ncols != tupdesc->natts)
@@ -1848,343 +5279,33 @@ ogrFeatureToSlot(const OGRFeatureH feat, TupleTableSlot* slot, const OgrFdwExecS
 		return OGRERR_FAILURE;
 	}
 
-	/* For each pgtable column, get a value from OGR */
-	for (i = 0; i < tbl->ncols; i++)
+	/* Everything starts out NULL, the program fills in the rest */
+	memset(values, 0, tupdesc->natts * sizeof(Datum));
+	memset(nulls, true, tupdesc->natts * sizeof(bool));
+
+	for (i = 0; i < execstate->nsteps; i++)
 	{
-		OgrFdwColumn col = tbl->cols[i];
-		const char* pgname = col.pgname;
-		Oid pgtype = col.pgtype;
-		int ogrfldnum = col.ogrfldnum;
-		OGRFieldType ogrfldtype = col.ogrfldtype;
-		OgrColumnVariant ogrvariant = col.ogrvariant;
+		const OgrFdwConvertStep* step = &(execstate->program[i]);
+		OGRErr err;
 
-		/*
-		 * Fill in dropped attributes with NULL
-		 */
-		if (col.pgattisdropped)
-		{
-			ogrNullSlot(values, nulls, i);
+		/* Unset FIDs come back as NULL */
+		if ((step->flags & OGR_CONVERT_FID) && OGR_F_GetFID(feat) == OGRNullFID)
 			continue;
-		}
-
-		if (ogrvariant == OGR_FID)
-		{
-			GIntBig fid = OGR_F_GetFID(feat);
-			bool is_null = false;
-
-			if (fid == OGRNullFID)
-			{
-				ogrNullSlot(values, nulls, i);
-			}
-			else
-			{
-				char fidstr[256];
-				snprintf(fidstr, 256, OGR_FDW_FRMT_INT64, OGR_FDW_CAST_INT64(fid));
-
-				values[i] = pgDatumFromCString(fidstr, &col, execstate->ogr.char_encoding, &is_null);
-				nulls[i] = is_null;
-			}
-		}
-		else if (ogrvariant == OGR_GEOMETRY)
-		{
-			int wkbsize;
-			int varsize;
-			bytea* varlena;
-			unsigned char* wkb;
-			OGRErr err;
-
-#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
-			OGRGeometryH geom = OGR_F_GetGeomFieldRef(feat, ogrfldnum);
-#else
-			OGRGeometryH geom = OGR_F_GetGeometryRef(feat);
-#endif
-
-			/* No geometry ? NULL */
-			if (! geom)
-			{
-				/* No geometry column, so make the output null */
-				ogrNullSlot(values, nulls, i);
-				continue;
-			}
-
-			/*
-			 * Start by generating standard PgSQL variable length byte
-			 * buffer, with WKB filled into the data area.
-			 */
-			wkbsize = OGR_G_WkbSize(geom);
-			varsize = wkbsize + VARHDRSZ;
-			varlena = palloc(varsize);
-			wkb = (unsigned char*)VARDATA(varlena);
-			err = OGR_G_ExportToWkb(geom, wkbNDR, wkb);
-			SET_VARSIZE(varlena, varsize);
-
-			/* Couldn't create WKB from OGR geometry? error */
-			if (err != OGRERR_NONE)
-			{
-				return err;
-			}
-
-			if (pgtype == BYTEAOID)
-			{
-				/*
-				 * Nothing special to do for bytea, just send the varlena data through!
-				 */
-				nulls[i] = false;
-				values[i] = PointerGetDatum(varlena);
-			}
-			else if (pgtype == ogrGetGeometryOid())
-			{
-				/*
-				 * For geometry we need to convert the varlena WKB data into a serialized
-				 * geometry (aka "gserialized"). For that, we can use the type's "recv" function
-				 * which takes in WKB and spits out serialized form, or the "input" function
-				 * that takes in HEXWKB. The "input" function is more lax about geometry
-				 * structure errors (unclosed polys, etc).
-				 */
-#ifdef OGR_FDW_HEXWKB
-				char* hexwkb = ogrBytesToHex(wkb, wkbsize);
-				/*
-				 * Use the input function to convert the WKB from OGR into
-				 * a PostGIS internal format.
-				 */
-				nulls[i] = false;
-				values[i] = OidFunctionCall1(col.pginputfunc, PointerGetDatum(hexwkb));
-				pfree(hexwkb);
-#else
-				/*
-				 * The "recv" function expects to receive a StringInfo pointer
-				 * on the first argument, so we form one of those ourselves by
-				 * hand. Rather than copy into a fresh buffer, we'll just use the
-				 * existing varlena buffer and point to the data area.
-				 *
-				 * The "recv" function tests for basic geometry validity,
-				 * things like polygon closure, etc. So don't feed it junk.
-				 */
-				StringInfoData strinfo;
-				strinfo.data = (char*)wkb;
-				strinfo.len = wkbsize;
-				strinfo.maxlen = strinfo.len;
-				strinfo.cursor = 0;
-
-				/*
-				 * Use the recv function to convert the WKB from OGR into
-				 * a PostGIS internal format.
-				 */
-				nulls[i] = false;
-				values[i] = OidFunctionCall1(col.pgrecvfunc, PointerGetDatum(&strinfo));
-#endif
-
-				/*
-				 * Apply the typmod restriction to the incoming geometry, so it's
-				 * not really a restriction anymore, it's more like a requirement.
-				 *
-				 * TODO: In the case where the OGR input actually *knows* what SRID
-				 * it is, we should actually apply *that* and let the restriction run
-				 * its usual course.
-				 */
-				if (have_typmod_funcs && col.pgtypmod >= 0)
-				{
-					Datum srid = OidFunctionCall1(execstate->typmodsridfunc, Int32GetDatum(col.pgtypmod));
-					values[i] = OidFunctionCall2(execstate->setsridfunc, values[i], srid);
-				}
-			}
-			else
-			{
-				elog(NOTICE, "conversion to geometry called with column type not equal to bytea or geometry");
-				ogrNullSlot(values, nulls, i);
-			}
 
-		}
-		else if (ogrvariant == OGR_FIELD)
+		/* Only convert non-null fields */
+		if (step->flags & OGR_CONVERT_NULLABLE)
 		{
 #if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,2,0))
-			int field_not_null = OGR_F_IsFieldSet(feat, ogrfldnum) && ! OGR_F_IsFieldNull(feat, ogrfldnum);
+			if (!OGR_F_IsFieldSetAndNotNull(feat, step->ogrfldnum))
 #else
-			int field_not_null = OGR_F_IsFieldSet(feat, ogrfldnum);
+			if (!OGR_F_IsFieldSet(feat, step->ogrfldnum))
 #endif
-
-			/* Ensure that the OGR data type fits the destination Pg column */
-			ogrCheckConvertToPg(ogrfldtype, pgtype, pgname, tbl->tblname);
-
-			/* Only convert non-null fields */
-			if (!field_not_null)
-			{
-				ogrNullSlot(values, nulls, i);
 				continue;
-			}
-
-			switch (ogrfldtype)
-			{
-			case OFTBinary:
-			{
-				/*
-				 * Convert binary fields to bytea directly
-				 */
-				int bufsize;
-				GByte* buf = OGR_F_GetFieldAsBinary(feat, ogrfldnum, &bufsize);
-				int varsize = bufsize + VARHDRSZ;
-				bytea* varlena = palloc(varsize);
-				memcpy(VARDATA(varlena), buf, bufsize);
-				SET_VARSIZE(varlena, varsize);
-				nulls[i] = false;
-				values[i] = PointerGetDatum(varlena);
-				break;
-			}
-			case OFTInteger:
-			case OFTReal:
-			case OFTString:
-#if GDAL_VERSION_MAJOR >= 2
-			case OFTInteger64:
-#endif
-			{
-				/*
-				 * Convert numbers and strings via a string representation.
-				 * Handling numbers directly would be faster, but require a lot of extra code.
-				 * For now, we go via text.
-				 */
-				const char* cstr_in = OGR_F_GetFieldAsString(feat, ogrfldnum);
-				bool is_null = false;
-				values[i] = pgDatumFromCString(cstr_in, &col, execstate->ogr.char_encoding, &is_null);
-				nulls[i] = is_null;
-				break;
-			}
-			case OFTDate:
-			case OFTTime:
-			case OFTDateTime:
-			{
-				/*
-				 * OGR date/times have a weird access method, so we use that to pull
-				 * out the raw data and turn it into a string for PgSQL's (very
-				 * sophisticated) date/time parsing routines to handle.
-				 */
-				int year, month, day, hour, minute, second, tz;
-				bool is_null = false;
-				OGR_F_GetFieldAsDateTime(feat, ogrfldnum,
-				                         &year, &month, &day,
-				                         &hour, &minute, &second, &tz);
-
-				if (ogrfldtype == OFTDate)
-				{
-					snprintf(cstr, CSTR_SZ, "%d-%02d-%02d", year, month, day);
-				}
-				else if (ogrfldtype == OFTTime)
-				{
-					snprintf(cstr, CSTR_SZ, "%02d:%02d:%02d", hour, minute, second);
-				}
-				else
-				{
-#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,7,0))
-					const char* tsstr = OGR_F_GetFieldAsISO8601DateTime(feat, ogrfldnum, NULL);
-					strlcpy(cstr, tsstr, CSTR_SZ);
-#else
-					snprintf(cstr, CSTR_SZ, "%d-%02d-%02d %02d:%02d:%02d", year, month, day, hour, minute, second);
-#endif
-				}
-				values[i] = pgDatumFromCString(cstr, &col, PG_SQL_ASCII, &is_null);
-				nulls[i] = is_null;
-				break;
-
-			}
-
-#if GDAL_VERSION_MAJOR >= 2
-			case OFTInteger64List:
-			{
-				int ilist_size;
-				const int64 *ilist = (int64*)OGR_F_GetFieldAsInteger64List(feat, ogrfldnum, &ilist_size);
-				ArrayBuildState *abs = initArrayResult(col.pgelmtype, CurrentMemoryContext, false);
-				for (uint32 i = 0; i < ilist_size; i++)
-				{
-					bool is_null = false;
-					snprintf(cstr, CSTR_SZ, OGR_FDW_FRMT_INT64, OGR_FDW_CAST_INT64(ilist[i]));
-					abs = accumArrayResult(abs,
-					          pgDatumFromCString(cstr, &col, execstate->ogr.char_encoding, &is_null),
-					          is_null,
-					          col.pgelmtype,
-					          CurrentMemoryContext);
-				}
-				values[i] = makeArrayResult(abs, CurrentMemoryContext);
-				nulls[i] = false;
-				break;
-			}
-#endif
-
-			case OFTIntegerList:
-			{
-				int ilist_size;
-				const int *ilist = OGR_F_GetFieldAsIntegerList(feat, ogrfldnum, &ilist_size);
-				ArrayBuildState *abs = initArrayResult(col.pgelmtype, CurrentMemoryContext, false);
-				for (uint32 i = 0; i < ilist_size; i++)
-				{
-					bool is_null = false;
-					snprintf(cstr, CSTR_SZ, "%d", ilist[i]);
-					abs = accumArrayResult(abs,
-					          pgDatumFromCString(cstr, &col, execstate->ogr.char_encoding, &is_null),
-					          is_null,
-					          col.pgelmtype,
-					          CurrentMemoryContext);
-				}
-				values[i] = makeArrayResult(abs, CurrentMemoryContext);
-				nulls[i] = false;
-				break;
-			}
-
-			case OFTRealList:
-			{
-				int rlist_size;
-				const double *rlist = OGR_F_GetFieldAsDoubleList(feat, ogrfldnum, &rlist_size);
-				ArrayBuildState *abs = initArrayResult(col.pgelmtype, CurrentMemoryContext, false);
-				for (uint32 i = 0; i < rlist_size; i++)
-				{
-					bool is_null = false;
-					snprintf(cstr, CSTR_SZ, "%g", rlist[i]);
-					abs = accumArrayResult(abs,
-					          pgDatumFromCString(cstr, &col, execstate->ogr.char_encoding, &is_null),
-					          is_null,
-					          col.pgelmtype,
-					          CurrentMemoryContext);
-				}
-				values[i] = makeArrayResult(abs, CurrentMemoryContext);
-				nulls[i] = false;
-				break;
-			}
-
-			case OFTStringList:
-			{
-				ArrayBuildState *abs = initArrayResult(col.pgelmtype, CurrentMemoryContext, false);
-				char **cstrs = OGR_F_GetFieldAsStringList(feat, ogrfldnum);
-				while (*cstrs)
-				{
-					bool is_null = false;
-					abs = accumArrayResult(abs,
-					          pgDatumFromCString(*cstrs, &col, execstate->ogr.char_encoding, &is_null),
-					          is_null,
-					          col.pgelmtype,
-					          CurrentMemoryContext);
-					cstrs++;
-				}
-				values[i] = makeArrayResult(abs, CurrentMemoryContext);
-				nulls[i] = false;
-				break;
-			}
-			default:
-			{
-				elog(ERROR, "unsupported OGR type \"%s\"", OGR_GetFieldTypeName(ogrfldtype));
-				break;
-			}
-
-			} /* !switch */
-		}
-		/* Fill in unmatched columns with NULL */
-		else if (ogrvariant == OGR_UNMATCHED)
-		{
-			ogrNullSlot(values, nulls, i);
-		}
-		else
-		{
-			elog(ERROR, "OGR FDW unsupported column variant in \"%s\", %d", pgname, ogrvariant);
-			return OGRERR_FAILURE;
 		}
 
+		err = step->convert(feat, step, execstate, &(values[step->attnum]), &(nulls[step->attnum]));
+		if (err != OGRERR_NONE)
+			return err;
 	}
 
 	/* done! */
@@ -2205,10 +5326,11 @@ ogrStaticText(char* text, const char* str)
  * binary. The EWKB has an endian byte, four bytes of type information
  * and then 4 bytes of optional SRID information. If that info is
  * there, we want to over-write it, and remove the SRID flag, to
- * generate more "standard" WKB for OGR to consume.
+ * generate more "standard" WKB for OGR to consume. The SRID
+ * goes in srid, if asked for, zero if there was none.
  */
 static size_t
-ogrEwkbStripSrid(unsigned char* wkb, size_t wkbsize)
+ogrEwkbStripSrid(unsigned char* wkb, size_t wkbsize, int* srid)
 {
 	unsigned int type = 0;
 	int has_srid = 0;
@@ -2222,9 +5344,14 @@ ogrEwkbStripSrid(unsigned char* wkb, size_t wkbsize)
 	type &= 0xDFFFFFFF;
 	memcpy(wkb + 1, &type, 4);
 
+	if (srid)
+		*srid = 0;
+
 	/* If there was an SRID number embedded, overwrite it */
 	if (has_srid)
 	{
+		if (srid)
+			memcpy(srid, wkb + 5, 4);
 		newwkbsize -= 4; /* no space for SRID number needed */
 		memmove(wkb + 5, wkb + 9, newwkbsize - 5);
 	}
@@ -2234,18 +5361,233 @@ ogrEwkbStripSrid(unsigned char* wkb, size_t wkbsize)
 
 OGRErr
 pgDatumToOgrGeometry (Datum pg_geometry, Oid pgsendfunc, OGRGeometryH* ogr_geometry)
+{
+	return pgDatumToOgrGeometrySrid(pg_geometry, pgsendfunc, ogr_geometry, NULL);
+}
+
+/*
+ * As pgDatumToOgrGeometry, also returning the SRID of the
+ * PostGIS geometry, zero when it has none.
+ */
+OGRErr
+pgDatumToOgrGeometrySrid (Datum pg_geometry, Oid pgsendfunc, OGRGeometryH* ogr_geometry, int* srid)
 {
 	OGRErr err;
 	bytea* wkb_bytea = DatumGetByteaP(OidFunctionCall1(pgsendfunc, pg_geometry));
 	unsigned char* wkb = (unsigned char*)VARDATA_ANY(wkb_bytea);
 	size_t wkbsize = VARSIZE_ANY_EXHDR(wkb_bytea);
-	wkbsize = ogrEwkbStripSrid(wkb, wkbsize);
+	wkbsize = ogrEwkbStripSrid(wkb, wkbsize, srid);
 	err = OGR_G_CreateFromWkb(wkb, NULL, ogr_geometry, wkbsize);
 	if (wkb_bytea)
 		pfree(wkb_bytea);
 	return err;
 }
 
+/*
+ * Look a PostGIS SRID up in spatial_ref_sys. SRIDs are just
+ * keys of that table, and usually but not always the EPSG
+ * code, so the system is built from its authority code when
+ * the authority is EPSG, or else from its WKT. NULL if the
+ * SRID isn't there, or makes no system GDAL knows.
+ */
+static OGRSpatialReferenceH
+ogrSridSpatialRef(int srid)
+{
+	OGRSpatialReferenceH srs = NULL;
+	Oid extoid = get_extension_oid("postgis", true);
+	MemoryContext cxt = CurrentMemoryContext;
+	char* auth_name = NULL;
+	char* auth_srid = NULL;
+	char* srtext = NULL;
+	char* nspname;
+	char* sql;
+	Oid argtypes[1] = { INT4OID };
+	Datum args[1];
+
+	if (!OidIsValid(extoid))
+		return NULL;
+	nspname = get_namespace_name(get_extension_nsp_oid(extoid));
+	if (!nspname)
+		return NULL;
+
+	sql = psprintf("SELECT auth_name, auth_srid, srtext FROM %s.spatial_ref_sys WHERE srid = $1",
+	               quote_identifier(nspname));
+	args[0] = Int32GetDatum(srid);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		return NULL;
+
+	/* The values outlive SPI_finish() in the caller's context */
+	if (SPI_execute_with_args(sql, 1, argtypes, args, NULL, true, 1) == SPI_OK_SELECT &&
+	    SPI_processed == 1)
+	{
+		HeapTuple tuple = SPI_tuptable->vals[0];
+		TupleDesc tupdesc = SPI_tuptable->tupdesc;
+		MemoryContext oldcxt = MemoryContextSwitchTo(cxt);
+
+		auth_name = SPI_getvalue(tuple, tupdesc, 1);
+		auth_srid = SPI_getvalue(tuple, tupdesc, 2);
+		srtext = SPI_getvalue(tuple, tupdesc, 3);
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	SPI_finish();
+	pfree(sql);
+
+	/*
+	 * GDAL errors only go quiet from here on, since a
+	 * PostgreSQL error in the query above would have jumped
+	 * out past the CPLPopErrorHandler(). Unknown codes are no
+	 * reason to fail the query.
+	 */
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	if (auth_name && auth_srid && pg_strcasecmp(auth_name, "EPSG") == 0)
+	{
+		srs = OSRNewSpatialReference(NULL);
+		if (OSRImportFromEPSG(srs, atoi(auth_srid)) != OGRERR_NONE)
+		{
+			OSRDestroySpatialReference(srs);
+			srs = NULL;
+		}
+	}
+	else if (srtext && *srtext)
+	{
+		char* wkt = srtext;
+
+		srs = OSRNewSpatialReference(NULL);
+		if (OSRImportFromWkt(srs, &wkt) != OGRERR_NONE)
+		{
+			OSRDestroySpatialReference(srs);
+			srs = NULL;
+		}
+	}
+	CPLPopErrorHandler();
+
+	return srs;
+}
+
+/*
+ * Find how to take coordinates in the SRID of a PostGIS
+ * geometry to the spatial reference of a geometry field of
+ * the layer. SRIDs are read through spatial_ref_sys. Returns
+ * false if there is no way to; otherwise ct is the
+ * transformation, or NULL when the coordinates are good as
+ * they are: the same system, or either of them unknown.
+ */
+bool
+ogrSridTransform(int srid, OGRLayerH lyr, int ogrfldnum, OGRCoordinateTransformationH* ct)
+{
+	OGRSpatialReferenceH lyrsrs;
+	OGRSpatialReferenceH srs;
+	bool ok = true;
+
+	*ct = NULL;
+	if (srid <= 0)
+		return true;
+
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+	{
+		OGRGeomFieldDefnH gfld = OGR_FD_GetGeomFieldDefn(OGR_L_GetLayerDefn(lyr), ogrfldnum);
+		lyrsrs = gfld ? OGR_GFld_GetSpatialRef(gfld) : NULL;
+	}
+#else
+	lyrsrs = OGR_L_GetSpatialRef(lyr);
+#endif
+	if (!lyrsrs)
+		return true;
+
+	srs = ogrSridSpatialRef(srid);
+	if (!srs)
+		return false;
+
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,0,0))
+	/* PostGIS coordinates are always easting, northing */
+	OSRSetAxisMappingStrategy(srs, OAMS_TRADITIONAL_GIS_ORDER);
+#endif
+
+	/* Systems with no way between them are no reason to fail the query */
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	if (!OSRIsSame(srs, lyrsrs))
+	{
+		*ct = OCTNewCoordinateTransformation(srs, lyrsrs);
+		ok = (*ct != NULL);
+	}
+	CPLPopErrorHandler();
+	OSRDestroySpatialReference(srs);
+
+	return ok;
+}
+
+/*
+ * Transform an envelope in place. Points along its edges
+ * go through the transformation too, so the result still
+ * covers edges that come out curved. Returns false if the
+ * envelope doesn't transform, or would wrap around the
+ * antimeridian.
+ */
+bool
+ogrTransformEnvelope(OGRCoordinateTransformationH ct, OGREnvelope* env)
+{
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,4,0))
+	double minx, miny, maxx, maxy;
+	int ok;
+
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	ok = OCTTransformBounds(ct, env->MinX, env->MinY, env->MaxX, env->MaxY,
+	                        &minx, &miny, &maxx, &maxy, OGR_FDW_DENSIFY_POINTS);
+	CPLPopErrorHandler();
+
+	if (!ok || minx > maxx)
+		return false;
+
+	env->MinX = minx;
+	env->MinY = miny;
+	env->MaxX = maxx;
+	env->MaxY = maxy;
+	return true;
+#else
+	int n = OGR_FDW_DENSIFY_POINTS + 1;
+	double x[4 * (OGR_FDW_DENSIFY_POINTS + 1)];
+	double y[4 * (OGR_FDW_DENSIFY_POINTS + 1)];
+	int success[4 * (OGR_FDW_DENSIFY_POINTS + 1)];
+	double dx = (env->MaxX - env->MinX) / n;
+	double dy = (env->MaxY - env->MinY) / n;
+	int i, ok;
+
+	/* Walk each edge from one corner, stopping short of the next */
+	for (i = 0; i < n; i++)
+	{
+		x[i] = env->MinX + i * dx;         y[i] = env->MinY;
+		x[n + i] = env->MaxX;              y[n + i] = env->MinY + i * dy;
+		x[2 * n + i] = env->MaxX - i * dx; y[2 * n + i] = env->MaxY;
+		x[3 * n + i] = env->MinX;          y[3 * n + i] = env->MaxY - i * dy;
+	}
+
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	ok = OCTTransformEx(ct, 4 * n, x, y, NULL, success);
+	CPLPopErrorHandler();
+	if (!ok)
+		return false;
+
+	for (i = 0; i < 4 * n; i++)
+	{
+		if (!success[i])
+			return false;
+	}
+
+	env->MinX = env->MaxX = x[0];
+	env->MinY = env->MaxY = y[0];
+	for (i = 1; i < 4 * n; i++)
+	{
+		env->MinX = Min(env->MinX, x[i]);
+		env->MinY = Min(env->MinY, y[i]);
+		env->MaxX = Max(env->MaxX, x[i]);
+		env->MaxY = Max(env->MaxY, y[i]);
+	}
+	return true;
+#endif
+}
+
 static OGRErr
 ogrSlotToFeature(const TupleTableSlot* slot, OGRFeatureH feat, const OgrFdwTable* tbl)
 {
@@ -2541,49 +5883,503 @@ ogrSlotToFeature(const TupleTableSlot* slot, OGRFeatureH feat, const OgrFdwTable
 				break;
 			}
 
-			case FLOAT4ARRAYOID:
-			case FLOAT8ARRAYOID:
-			{
-				ArrayType *arr = DatumGetArrayTypeP(values[i]);
-				size_t sz = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
-				Datum d;
-				bool isnull;
-				double *floats = palloc(sizeof(double) * sz);
-				int num_floats = 0;
-				ArrayIterator it = array_create_iterator(arr, 0, NULL);
-				while (array_iterate(it,  &d, &isnull))
-				{
-					if (isnull) continue;
-					floats[num_floats++] = DatumGetFloat8(d);
-				}
-				OGR_F_SetFieldDoubleList(feat, ogrfldnum, num_floats, floats);
-				pfree(floats);
-				break;
-			}
+			case FLOAT4ARRAYOID:
+			case FLOAT8ARRAYOID:
+			{
+				ArrayType *arr = DatumGetArrayTypeP(values[i]);
+				size_t sz = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+				Datum d;
+				bool isnull;
+				double *floats = palloc(sizeof(double) * sz);
+				int num_floats = 0;
+				ArrayIterator it = array_create_iterator(arr, 0, NULL);
+				while (array_iterate(it,  &d, &isnull))
+				{
+					if (isnull) continue;
+					floats[num_floats++] = DatumGetFloat8(d);
+				}
+				OGR_F_SetFieldDoubleList(feat, ogrfldnum, num_floats, floats);
+				pfree(floats);
+				break;
+			}
+
+			/* TODO: array types for string, integer, float */
+			default:
+			{
+				elog(ERROR, "OGR FDW unsupported PgSQL column type in \"%s\", %d", pgname, pgtype);
+				return OGRERR_FAILURE;
+			}
+			}
+		}
+		/* Fill in unmatched columns with NULL */
+		else if (ogrvariant == OGR_UNMATCHED)
+		{
+			OGR_F_UnsetField(feat, ogrfldnum);
+		}
+		else
+		{
+			elog(ERROR, "OGR FDW unsupported column variant in \"%s\", %d", pgname, ogrvariant);
+			return OGRERR_FAILURE;
+		}
+
+	}
+
+	/* done! */
+	return OGRERR_NONE;
+}
+
+static int
+ogrFidCmpFunc(const void* a, const void* b)
+{
+	int64 fa = *(const int64*) a;
+	int64 fb = *(const int64*) b;
+	return fa < fb ? -1 : (fa > fb ? 1 : 0);
+}
+
+static int64
+ogrDatumGetFid(Datum value, Oid type)
+{
+	switch (type)
+	{
+	case INT2OID:
+		return DatumGetInt16(value);
+	case INT4OID:
+		return DatumGetInt32(value);
+	default:
+		return DatumGetInt64(value);
+	}
+}
+
+/*
+ * Work out the FIDs of a FID lookup: in a nested loop the
+ * value changes with every outer row. They are sorted and
+ * made unique, as "fid = ANY(...)" returns each row once.
+ */
+static void
+ogrEvalFids(ForeignScanState* node, OgrFdwExecState* execstate)
+{
+	ExprContext* econtext = node->ss.ps.ps_ExprContext;
+	Oid type = exprType((Node*) execstate->fid_expr->expr);
+	MemoryContext oldcxt;
+	Datum value;
+	bool isnull;
+	int i, n;
+
+	if (execstate->fids)
+		pfree(execstate->fids);
+	execstate->fids = NULL;
+	execstate->nfids = 0;
+	execstate->fidpos = 0;
+	execstate->fids_ready = true;
+
+	oldcxt = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+	value = ExecEvalExpr(execstate->fid_expr, econtext, &isnull);
+	MemoryContextSwitchTo(oldcxt);
+
+	if (isnull)
+		return;
+
+	if (OidIsValid(get_element_type(type)))
+	{
+		ArrayType* arr = DatumGetArrayTypeP(value);
+		Oid elemtype = ARR_ELEMTYPE(arr);
+		int16 elmlen;
+		bool elmbyval;
+		char elmalign;
+		Datum* elems;
+		bool* nulls;
+		int nelems;
+
+		get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+		deconstruct_array(arr, elemtype, elmlen, elmbyval, elmalign, &elems, &nulls, &nelems);
+
+		execstate->fids = MemoryContextAlloc(node->ss.ps.state->es_query_cxt, sizeof(int64) * Max(nelems, 1));
+		for (i = 0; i < nelems; i++)
+		{
+			if (!nulls[i])
+				execstate->fids[execstate->nfids++] = ogrDatumGetFid(elems[i], elemtype);
+		}
+	}
+	else
+	{
+		execstate->fids = MemoryContextAlloc(node->ss.ps.state->es_query_cxt, sizeof(int64));
+		execstate->fids[execstate->nfids++] = ogrDatumGetFid(value, type);
+	}
+
+	qsort(execstate->fids, execstate->nfids, sizeof(int64), ogrFidCmpFunc);
+	for (i = 1, n = Min(execstate->nfids, 1); i < execstate->nfids; i++)
+	{
+		if (execstate->fids[i] != execstate->fids[n - 1])
+			execstate->fids[n++] = execstate->fids[i];
+	}
+	execstate->nfids = n;
+}
+
+/*
+ * Look up the features a constant spatial filter passes in
+ * the in-memory spatial index of the layer, for the scan to
+ * fetch by FID. Only for layers that fetch features by FID
+ * but have no spatial index to filter with themselves.
+ */
+static void
+ogrScanSpatialIndex(ForeignScanState* node, OgrFdwExecState* execstate, const OgrFdwSpatialFilter* spatial_filter)
+{
+	OGRLayerH lyr = execstate->ogr.lyr;
+	OgrFdwRtree* rtree;
+	MemoryContext oldcxt;
+
+	if (OGR_L_TestCapability(lyr, OLCFastSpatialFilter) ||
+	    !OGR_L_TestCapability(lyr, OLCRandomRead))
+		return;
+
+	rtree = ogrRtreeGet(&(execstate->ogr), spatial_filter->ogrfldnum);
+	if (!rtree)
+		return;
+
+	oldcxt = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+	execstate->nfids = ogrRtreeSearch(rtree,
+	                                  spatial_filter->minx, spatial_filter->miny,
+	                                  spatial_filter->maxx, spatial_filter->maxy,
+	                                  &(execstate->fids));
+	MemoryContextSwitchTo(oldcxt);
+
+	execstate->fidpos = 0;
+	execstate->fids_ready = true;
+	execstate->fid_index = true;
+	elog(DEBUG1, "OGR spatial index: %d features pass the spatial filter", execstate->nfids);
+}
+
+/*
+ * Fetch the next feature of a FID lookup, skipping FIDs
+ * the layer doesn't have.
+ */
+static OGRFeatureH
+ogrGetNextFidFeature(ForeignScanState* node, OgrFdwExecState* execstate)
+{
+	if (!execstate->fids_ready)
+		ogrEvalFids(node, execstate);
+
+	while (execstate->fidpos < execstate->nfids)
+	{
+		OGRFeatureH feat = OGR_L_GetFeature(execstate->ogr.lyr, execstate->fids[execstate->fidpos++]);
+		if (feat)
+			return feat;
+	}
+	return NULL;
+}
+
+/*
+ * Read the next feature of a parallel scan. Chunk n holds
+ * the FIDs from n * OGR_FDW_PARALLEL_CHUNK_SIZE up to the
+ * next chunk. The features of a chunk are read sequentially
+ * from its first FID, skipping any deleted records, until one
+ * belongs to a later chunk; then the next unclaimed chunk is
+ * taken from shared memory. Running off the end of the layer
+ * means every later chunk is empty too, so we stop.
+ */
+static OGRFeatureH
+ogrGetNextParallelFeature(OgrFdwExecState* execstate)
+{
+	OGRFeatureH feat;
+
+	while (!execstate->chunks_done)
+	{
+		if (execstate->chunk_end > 0)
+		{
+			feat = OGR_L_GetNextFeature(execstate->ogr.lyr);
+			if (!feat)
+			{
+				execstate->chunks_done = true;
+			}
+			else if (OGR_F_GetFID(feat) < execstate->chunk_end)
+			{
+				return feat;
+			}
+			else
+			{
+				/* Someone else's chunk */
+				OGR_F_Destroy(feat);
+				execstate->chunk_end = 0;
+			}
+		}
+		else
+		{
+			uint64 chunk = pg_atomic_fetch_add_u64(&(execstate->pstate->next_chunk), 1);
+			GIntBig start = (GIntBig)(chunk * OGR_FDW_PARALLEL_CHUNK_SIZE);
+
+			elog(DEBUG3, "%s: claimed chunk " UINT64_FORMAT, __func__, chunk);
+			if (OGR_L_SetNextByIndex(execstate->ogr.lyr, start) != OGRERR_NONE)
+				execstate->chunks_done = true;
+			else
+				execstate->chunk_end = start + OGR_FDW_PARALLEL_CHUNK_SIZE;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * ogrIsForeignScanParallelSafe
+ *		Reads open their own datasets in each backend, so can
+ *		be run in parallel workers, unless the data is private
+ *		to this backend: in-memory /vsimem/ files, or writes of
+ *		a GDAL transaction still open here.
+ */
+static bool
+ogrIsForeignScanParallelSafe(PlannerInfo* root, RelOptInfo* rel, RangeTblEntry* rte)
+{
+	ForeignTable* table = GetForeignTable(rte->relid);
+	ForeignServer* server = GetForeignServer(table->serverid);
+	const char* ds_str = NULL;
+	ListCell* cell;
+
+	foreach (cell, server->options)
+	{
+		DefElem* def = (DefElem*) lfirst(cell);
+		if (streq(def->defname, OPT_SOURCE))
+			ds_str = defGetString(def);
+	}
+
+	if (!ds_str || strncmp(ds_str, "/vsimem/", 8) == 0)
+		return false;
+
+	return !ogrConnCacheInTransaction(ds_str);
+}
+
+/*
+ * ogrEstimateDSMForeignScan
+ *		Parallel scans only share a chunk counter.
+ */
+static Size
+ogrEstimateDSMForeignScan(ForeignScanState* node, ParallelContext* pcxt)
+{
+	return sizeof(OgrFdwParallelState);
+}
+
+static void
+ogrInitializeDSMForeignScan(ForeignScanState* node, ParallelContext* pcxt, void* coordinate)
+{
+	OgrFdwExecState* execstate = (OgrFdwExecState*) node->fdw_state;
+	OgrFdwParallelState* pstate = (OgrFdwParallelState*) coordinate;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	pg_atomic_init_u64(&(pstate->next_chunk), 0);
+	if (execstate)
+		execstate->pstate = pstate;
+}
+
+static void
+ogrReInitializeDSMForeignScan(ForeignScanState* node, ParallelContext* pcxt, void* coordinate)
+{
+	OgrFdwParallelState* pstate = (OgrFdwParallelState*) coordinate;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	pg_atomic_write_u64(&(pstate->next_chunk), 0);
+}
+
+static void
+ogrInitializeWorkerForeignScan(ForeignScanState* node, shm_toc* toc, void* coordinate)
+{
+	OgrFdwExecState* execstate = (OgrFdwExecState*) node->fdw_state;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	if (execstate)
+		execstate->pstate = (OgrFdwParallelState*) coordinate;
+}
+
+/*
+ * Turn an aggregate result number into the type PostgreSQL
+ * gives the aggregate (sum(int4) is int8, sum(int8) numeric...).
+ * SQL engines can hand back reals for integer aggregates, so
+ * those have to be whole numbers in the range of the type,
+ * rather than be truncated into it.
+ */
+static Datum
+ogrNumberToDatum(int64 ival, double dval, bool integer, Oid pgtype)
+{
+	double min, max;
+
+	switch (pgtype)
+	{
+	case INT2OID:
+		min = PG_INT16_MIN;
+		max = -((double) PG_INT16_MIN);
+		break;
+	case INT4OID:
+		min = PG_INT32_MIN;
+		max = -((double) PG_INT32_MIN);
+		break;
+	case INT8OID:
+	case NUMERICOID:
+		min = (double) PG_INT64_MIN;
+		max = -((double) PG_INT64_MIN);
+		break;
+	case FLOAT4OID:
+		return Float4GetDatum(ogrDoubleToFloat4(integer ? (double) ival : dval));
+	case FLOAT8OID:
+		return Float8GetDatum(integer ? (double) ival : dval);
+	default:
+		elog(ERROR, "%s: unexpected aggregate type %u", __func__, pgtype);
+		return (Datum) 0;
+	}
+
+	/* Reals for integer results, or for numeric (never from real fields) */
+	if (!integer)
+	{
+		if (isnan(dval) || dval != rint(dval))
+			ereport(ERROR,
+			        (errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+			         errmsg("OGR data source returned non-integer aggregate value %g", dval)));
+		if (!(dval >= min && dval < max))
+			ereport(ERROR,
+			        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+			         errmsg("OGR data source aggregate value %g out of range for type %s", dval, format_type_be(pgtype))));
+		ival = (int64) dval;
+	}
+	/* Every int64 fits int8 and numeric, and doubles can't hold the largest */
+	else if ((pgtype == INT2OID || pgtype == INT4OID) && !(ival >= min && ival < max))
+	{
+		ereport(ERROR,
+		        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+		         errmsg("OGR data source aggregate value " OGR_FDW_FRMT_INT64 " out of range for type %s",
+		                OGR_FDW_CAST_INT64(ival), format_type_be(pgtype))));
+	}
+
+	switch (pgtype)
+	{
+	case INT2OID:
+		return Int16GetDatum((int16) ival);
+	case INT4OID:
+		return Int32GetDatum((int32) ival);
+	case INT8OID:
+		return Int64GetDatum(ival);
+	default:
+		return DirectFunctionCall1(int8_numeric, Int64GetDatum(ival));
+	}
+}
+
+/*
+ * Fill the slot from a feature of a data source query result.
+ * Table columns convert by their type, aggregates by the type
+ * of the number the SQL engine returned.
+ */
+static void
+ogrResultFeatureToSlot(OgrFdwExecState* execstate, OGRFeatureH feat, TupleTableSlot* slot)
+{
+	TupleDesc tupdesc = slot->tts_tupleDescriptor;
+	OGRFeatureDefnH dfn = OGR_F_GetDefnRef(feat);
+	int i;
 
-			/* TODO: array types for string, integer, float */
-			default:
-			{
-				elog(ERROR, "OGR FDW unsupported PgSQL column type in \"%s\", %d", pgname, pgtype);
-				return OGRERR_FAILURE;
-			}
-			}
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		const OgrFdwConvertStep* step = &(execstate->result_steps[i]);
+		int fld = step->ogrfldnum;
+		Oid pgtype = TupleDescAttr(tupdesc, i)->atttypid;
+		OGRFieldType ogrtype;
+
+		slot->tts_isnull[i] = true;
+		slot->tts_values[i] = (Datum) 0;
+
+		if (step->convert)
+		{
+			if (step->convert(feat, step, execstate, &(slot->tts_values[i]), &(slot->tts_isnull[i])) != OGRERR_NONE)
+				ogrEreportError("failure reading OGR data source query result");
+			continue;
 		}
-		/* Fill in unmatched columns with NULL */
-		else if (ogrvariant == OGR_UNMATCHED)
+
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,2,0))
+		if (!OGR_F_IsFieldSetAndNotNull(feat, fld))
+#else
+		if (!OGR_F_IsFieldSet(feat, fld))
+#endif
+			continue;
+
+		if (step->col)
 		{
-			OGR_F_UnsetField(feat, ogrfldnum);
+			slot->tts_values[i] = pgDatumFromCString(OGR_F_GetFieldAsString(feat, fld),
+			                                         step->col,
+			                                         execstate->ogr.char_encoding,
+			                                         &(slot->tts_isnull[i]));
+			continue;
 		}
+
+		ogrtype = OGR_Fld_GetType(OGR_FD_GetFieldDefn(dfn, fld));
+		slot->tts_isnull[i] = false;
+#if GDAL_VERSION_MAJOR >= 2
+		if (ogrtype == OFTInteger || ogrtype == OFTInteger64)
+			slot->tts_values[i] = ogrNumberToDatum(OGR_F_GetFieldAsInteger64(feat, fld), 0, true, pgtype);
+#else
+		if (ogrtype == OFTInteger)
+			slot->tts_values[i] = ogrNumberToDatum(OGR_F_GetFieldAsInteger(feat, fld), 0, true, pgtype);
+#endif
+		else if (ogrtype == OFTReal)
+			slot->tts_values[i] = ogrNumberToDatum(0, OGR_F_GetFieldAsDouble(feat, fld), false, pgtype);
 		else
 		{
-			elog(ERROR, "OGR FDW unsupported column variant in \"%s\", %d", pgname, ogrvariant);
-			return OGRERR_FAILURE;
+			Oid typinput, typioparam;
+			getTypeInputInfo(pgtype, &typinput, &typioparam);
+			slot->tts_values[i] = OidInputFunctionCall(typinput, (char*) OGR_F_GetFieldAsString(feat, fld), typioparam, -1);
 		}
-
 	}
+}
 
-	/* done! */
-	return OGRERR_NONE;
+/*
+ * Fill the slot with the aggregates of an aggregate scan,
+ * asking the layer for each one.
+ */
+static void
+ogrAggregatesToSlot(OgrFdwExecState* execstate, TupleTableSlot* slot)
+{
+	TupleDesc tupdesc = slot->tts_tupleDescriptor;
+	int naggs = list_length(execstate->aggs) / 2;
+	int i;
+
+	for (i = 0; i < naggs; i++)
+	{
+		int kind = list_nth_int(execstate->aggs, 2 * i);
+		int ogrfldnum = list_nth_int(execstate->aggs, 2 * i + 1);
+
+		slot->tts_isnull[i] = true;
+		slot->tts_values[i] = (Datum) 0;
+
+		if (kind == OGR_AGG_COUNT)
+		{
+			GIntBig count = OGR_L_GetFeatureCount(execstate->ogr.lyr, TRUE);
+			if (count < 0)
+				ogrEreportError("failure counting OGR layer features");
+
+			slot->tts_isnull[i] = false;
+			slot->tts_values[i] = Int64GetDatum((int64) count);
+		}
+		else if (kind == OGR_AGG_EXTENT)
+		{
+			OGREnvelope env;
+			OGRErr err;
+			Oid typinput, typioparam;
+			char* box;
+
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+			err = OGR_L_GetExtentEx(execstate->ogr.lyr, ogrfldnum, &env, TRUE);
+#else
+			err = OGR_L_GetExtent(execstate->ogr.lyr, &env, TRUE);
+#endif
+			/* No extent means no geometries, and ST_Extent() of none is NULL */
+			if (err != OGRERR_NONE)
+				continue;
+
+			box = psprintf("BOX(%.17g %.17g,%.17g %.17g)", env.MinX, env.MinY, env.MaxX, env.MaxY);
+			getTypeInputInfo(TupleDescAttr(tupdesc, i)->atttypid, &typinput, &typioparam);
+			slot->tts_isnull[i] = false;
+			slot->tts_values[i] = OidInputFunctionCall(typinput, box, typioparam, -1);
+		}
+		else
+		{
+			elog(ERROR, "%s: unknown aggregate kind %d", __func__, kind);
+		}
+	}
 }
 
 /*
@@ -2606,18 +6402,88 @@ ogrIterateForeignScan(ForeignScanState* node)
 	 */
 	ExecClearTuple(slot);
 
+	/* Under a LIMIT, stop once we have read enough */
+	if (execstate->limit >= 0 && execstate->rownum >= execstate->limit)
+		return slot;
+
+	/* Queries run by the data source return the rows of their result set */
+	if (execstate->result_lyr)
+	{
+		feat = OGR_L_GetNextFeature(execstate->result_lyr);
+		if (feat)
+		{
+			ogrResultFeatureToSlot(execstate, feat, slot);
+			ExecStoreVirtualTuple(slot);
+			execstate->rownum++;
+			OGR_F_Destroy(feat);
+		}
+		return slot;
+	}
+
+	/* Aggregate scans return their one row of answers */
+	if (execstate->aggs)
+	{
+		if (execstate->rownum == 0)
+		{
+			ogrAggregatesToSlot(execstate, slot);
+			ExecStoreVirtualTuple(slot);
+			execstate->rownum++;
+		}
+		return slot;
+	}
+
+#if PG_VERSION_NUM >= 100000
+	/* Parameterized scans filter on the values of this rescan */
+	if (execstate->refilter && !execstate->fid_expr)
+		ogrRefillFilterParams(node, execstate);
+#endif
+
+	/* Arrow streams hand back their rows from the current batch */
+	if (execstate->arrow)
+	{
+		bool found;
+
+		/* Scans over batches of keys go on to the next batch at the end of one */
+		while (!(found = ogrArrowScanNext(execstate, slot)) && ogrNextFilterBatch(execstate))
+			;
+
+		if (found)
+		{
+			ExecStoreVirtualTuple(slot);
+			execstate->rownum++;
+		}
+		return slot;
+	}
+
 	/*
 	 * First time through, reset reading. Then keep reading until
 	 * we run out of records, then return a cleared (NULL) slot, to
 	 * notify the core we're done.
 	 */
-	if (execstate->rownum == 0)
+	if (execstate->rownum == 0 && !execstate->pstate && !execstate->reader)
 	{
 		OGR_L_ResetReading(execstate->ogr.lyr);
 	}
 
-	/* If we rectreive a feature from OGR, copy it over into the slot */
-	feat = OGR_L_GetNextFeature(execstate->ogr.lyr);
+	/*
+	 * If we rectreive a feature from OGR, copy it over into the slot.
+	 * Async scans don't wait for the background reader: an empty slot
+	 * sends them back to the Append until the reader has more.
+	 */
+	do
+	{
+		if (execstate->fid_expr || execstate->fid_index)
+			feat = ogrGetNextFidFeature(node, execstate);
+		else if (execstate->reader)
+			feat = ogrReaderNext(execstate->reader, !execstate->async);
+		else if (execstate->pstate)
+			feat = ogrGetNextParallelFeature(execstate);
+		else
+			feat = OGR_L_GetNextFeature(execstate->ogr.lyr);
+	}
+	while (!feat && !execstate->async && !execstate->fid_expr && !execstate->fid_index &&
+	       ogrNextFilterBatch(execstate));
+
 	if (feat)
 	{
 		/* convert result to arrays of values and null indicators */
@@ -2649,8 +6515,24 @@ ogrReScanForeignScan(ForeignScanState* node)
 	OgrFdwExecState* execstate = (OgrFdwExecState*) node->fdw_state;
 	elog(DEBUG3, "%s: entered function", __func__);
 
+	ogrArrowScanReset(execstate);
+	if (execstate->result_lyr)
+		OGR_L_ResetReading(execstate->result_lyr);
+	/* The reader thread owns the layer until it is stopped */
+	if (execstate->reader)
+		ogrReaderStop(execstate->reader);
 	OGR_L_ResetReading(execstate->ogr.lyr);
 	execstate->rownum = 0;
+	execstate->chunk_end = 0;
+	execstate->chunks_done = false;
+
+	/* FID lookups work their FIDs out again, the spatial index's stay */
+	execstate->fids_ready = execstate->fid_index;
+	execstate->fidpos = 0;
+
+	/* New parameter values may need a new filter, and batches of keys start over */
+	if (execstate->param_exprs && (node->ss.ps.chgParam || execstate->batch_pos > 0))
+		execstate->refilter = true;
 
 	return;
 }
@@ -2667,12 +6549,158 @@ ogrEndForeignScan(ForeignScanState* node)
 	if (execstate)
 	{
 		elog(DEBUG2, "OGR FDW processed %d rows from OGR", execstate->rownum);
+		ogrArrowScanEnd(execstate);
+		if (execstate->reader)
+			ogrReaderStop(execstate->reader);
+		ogrRemoteQueryCleanup(execstate);
+		if (execstate->xform)
+			OCTDestroyCoordinateTransformation(execstate->xform);
 		ogrFinishConnection(&(execstate->ogr));
 	}
 
 	return;
 }
 
+/*
+ * ogrExplainForeignScan
+ *		Show the spatial filter the scan puts on the layer,
+ *		out of all the spatial tests of the query, and under
+ *		VERBOSE, the column it is on and the aggregates an
+ *		aggregate scan takes from the layer metadata.
+ */
+static void
+ogrExplainForeignScan(ForeignScanState* node, ExplainState* es)
+{
+	ForeignScan* fsplan = (ForeignScan*) node->ss.ps.plan;
+	List* aggs;
+	OgrFdwSpatialFilter* sf;
+
+	sf = ogrSpatialFilterFromList(list_nth(fsplan->fdw_private, OgrFdwScanPrivateSpatialFilter));
+	if (sf)
+	{
+		char* filter;
+
+		if (sf->param && sf->distance > 0)
+			filter = psprintf("BOX($%d) expanded by %g", sf->param, sf->distance);
+		else if (sf->param)
+			filter = psprintf("BOX($%d)", sf->param);
+		else
+			filter = psprintf("BOX(%g %g, %g %g)", sf->minx, sf->miny, sf->maxx, sf->maxy);
+
+		ExplainPropertyText("Spatial Filter", filter, es);
+	}
+
+	if (!es->verbose)
+		return;
+
+	if (sf)
+		ExplainPropertyText("Spatial Filter Column", sf->colname, es);
+
+	aggs = (List*) list_nth(fsplan->fdw_private, OgrFdwScanPrivateAggs);
+	if (aggs)
+	{
+		StringInfoData buf;
+		int i;
+
+		initStringInfo(&buf);
+		for (i = 0; i < list_length(aggs) / 2; i++)
+		{
+			if (i > 0)
+				appendStringInfoString(&buf, ", ");
+			if (list_nth_int(aggs, 2 * i) == OGR_AGG_COUNT)
+				appendStringInfoString(&buf, "feature count");
+			else
+				appendStringInfoString(&buf, "extent");
+		}
+		ExplainPropertyText("Layer Metadata", buf.data, es);
+	}
+}
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * ogrIsForeignPathAsyncCapable
+ *		Scans can run asynchronously if the async_capable
+ *		option says so.
+ */
+static bool
+ogrIsForeignPathAsyncCapable(ForeignPath* path)
+{
+	OgrFdwPlanState* planstate = (OgrFdwPlanState*) path->path.parent->fdw_private;
+
+	/* Aggregate and join scans don't read features, so have nothing to wait on */
+	if (path->path.parent->reloptkind != RELOPT_BASEREL &&
+	    path->path.parent->reloptkind != RELOPT_OTHER_MEMBER_REL)
+		return false;
+
+	/* Nor do FID lookups, which fetch each feature when asked */
+	if (path->fdw_private)
+		return false;
+
+	/* Parameterized scans start again for every outer row */
+	if (path->path.param_info)
+		return false;
+
+	return planstate && planstate->async_capable;
+}
+
+/*
+ * Hand the requestor a tuple if the background reader has
+ * one ready, an empty slot if the layer is finished, or
+ * otherwise ask to be called back when the reader has news.
+ * Running the node (rather than calling the iterate routine)
+ * applies the local quals and projection.
+ */
+static void
+ogrProduceTupleAsync(AsyncRequest* areq)
+{
+	ForeignScanState* node = (ForeignScanState*) areq->requestee;
+	OgrFdwExecState* execstate = (OgrFdwExecState*) node->fdw_state;
+	TupleTableSlot* result = ExecProcNode((PlanState*) node);
+
+	if (!TupIsNull(result) || ogrReaderFinished(execstate->reader))
+		ExecAsyncRequestDone(areq, result);
+	else
+		ExecAsyncRequestPending(areq);
+}
+
+static void
+ogrForeignAsyncRequest(AsyncRequest* areq)
+{
+	elog(DEBUG3, "%s: entered function", __func__);
+	ogrProduceTupleAsync(areq);
+}
+
+/*
+ * ogrForeignAsyncConfigureWait
+ *		Wait on the background reader's wakeup pipe.
+ */
+static void
+ogrForeignAsyncConfigureWait(AsyncRequest* areq)
+{
+	ForeignScanState* node = (ForeignScanState*) areq->requestee;
+	OgrFdwExecState* execstate = (OgrFdwExecState*) node->fdw_state;
+	AppendState* requestor = (AppendState*) areq->requestor;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	AddWaitEventToSet(requestor->as_eventset, WL_SOCKET_READABLE,
+	                  ogrReaderWaitFd(execstate->reader), NULL, areq);
+}
+
+static void
+ogrForeignAsyncNotify(AsyncRequest* areq)
+{
+	ForeignScanState* node = (ForeignScanState*) areq->requestee;
+	OgrFdwExecState* execstate = (OgrFdwExecState*) node->fdw_state;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	/* Empty the pipe first, so a push after this wakes us again */
+	ogrReaderDrain(execstate->reader);
+	ogrProduceTupleAsync(areq);
+}
+#endif /* PG_VERSION_NUM >= 140000 */
+
 /* ======================================================== */
 /* WRITE SUPPORT */
 /* ======================================================== */
@@ -2907,7 +6935,9 @@ ogrExecForeignUpdate(EState* estate,
 		ogrEreportError("failure populating OGR feature");
 	}
 
+	ogrBeginTransaction(&(modstate->ogr));
 	err = OGR_L_SetFeature(modstate->ogr.lyr, feat);
+	ogrRtreeInvalidate(modstate->ogr.ds_str, modstate->ogr.lyr_str);
 	if (err != OGRERR_NONE)
 	{
 		ogrEreportError("failure writing back OGR feature");
@@ -3021,20 +7051,23 @@ ogrExecForeignUpdate(EState* estate,
 //     int         location;       /* token location, or -1 if unknown */
 // } Var;
 
-static TupleTableSlot*
-ogrExecForeignInsert(EState* estate,
-                     ResultRelInfo* rinfo,
-                     TupleTableSlot* slot,
-                     TupleTableSlot* planSlot)
+/*
+ * Write the row in a slot as a new OGR feature, and put
+ * its new FID into the slot for RETURNING. One feature is
+ * re-used for all the rows, rather than built and freed
+ * for each one.
+ */
+static void
+ogrInsertSlot(OgrFdwModifyState* modstate, TupleTableSlot* slot)
 {
-	OgrFdwModifyState* modstate = rinfo->ri_FdwState;
-	OGRFeatureDefnH ogr_fd = OGR_L_GetLayerDefn(modstate->ogr.lyr);
-	OGRFeatureH feat = OGR_F_Create(ogr_fd);
+	OGRFeatureH feat;
 	int fid_column;
 	OGRErr err;
 	GIntBig fid;
 
-	elog(DEBUG3, "%s: entered function", __func__);
+	if (!modstate->feat)
+		modstate->feat = OGR_F_Create(OGR_L_GetLayerDefn(modstate->ogr.lyr));
+	feat = modstate->feat;
 
 #if PG_VERSION_NUM >= 120000
 	/*
@@ -3052,6 +7085,8 @@ ogrExecForeignInsert(EState* estate,
 		ogrEreportError("failure creating OGR feature");
 	}
 
+	/* Tables without a fid column must not repeat the last one */
+	OGR_F_SetFID(feat, OGRNullFID);
 	err = ogrSlotToFeature(slot, feat, modstate->table);
 	if (err != OGRERR_NONE)
 	{
@@ -3059,13 +7094,13 @@ ogrExecForeignInsert(EState* estate,
 	}
 
 	err = OGR_L_CreateFeature(modstate->ogr.lyr, feat);
+	ogrRtreeInvalidate(modstate->ogr.ds_str, modstate->ogr.lyr_str);
 	if (err != OGRERR_NONE)
 	{
 		ogrEreportError("failure writing OGR feature");
 	}
 
 	fid = OGR_F_GetFID(feat);
-	OGR_F_Destroy(feat);
 
 	/* Update the FID for RETURNING slot */
 	fid_column = ogrGetFidColumn(slot->tts_tupleDescriptor);
@@ -3075,10 +7110,117 @@ ogrExecForeignInsert(EState* estate,
 		slot->tts_isnull[fid_column] = false;
 		slot->tts_nvalid++;
 	}
+}
+
+static TupleTableSlot*
+ogrExecForeignInsert(EState* estate,
+                     ResultRelInfo* rinfo,
+                     TupleTableSlot* slot,
+                     TupleTableSlot* planSlot)
+{
+	OgrFdwModifyState* modstate = rinfo->ri_FdwState;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	ogrBeginTransaction(&(modstate->ogr));
+	ogrInsertSlot(modstate, slot);
 
 	return slot;
 }
 
+#if PG_VERSION_NUM >= 140000
+/*
+ * ogrGetForeignModifyBatchSize
+ * Rows are batched as the batch_size option says, except
+ * where the executor needs each row back as it goes in:
+ * for RETURNING, WITH CHECK OPTION, and row triggers.
+ */
+static int
+ogrGetForeignModifyBatchSize(ResultRelInfo* rinfo)
+{
+	OgrFdwModifyState* modstate = rinfo->ri_FdwState;
+	TriggerDesc* trigdesc = rinfo->ri_TrigDesc;
+	int batch_size;
+
+	if (modstate)
+	{
+		if (!modstate->batch_size)
+			modstate->batch_size = ogrGetBatchSize(modstate->foreigntableid);
+		batch_size = modstate->batch_size;
+	}
+	else
+	{
+		batch_size = ogrGetBatchSize(RelationGetRelid(rinfo->ri_RelationDesc));
+	}
+
+	if (rinfo->ri_projectReturning != NULL ||
+	    rinfo->ri_WithCheckOptions != NIL ||
+	    (trigdesc && (trigdesc->trig_insert_after_row || trigdesc->trig_insert_before_row)))
+		return 1;
+
+	return batch_size;
+}
+
+/*
+ * ogrExecForeignBatchInsert
+ * Write a batch of rows through the one re-used feature.
+ * Outside a transaction that spans the statement (when
+ * the dataset isn't cached), a batch still gets a GDAL
+ * transaction of its own if the driver has them, so the
+ * driver commits once per batch and not once per row.
+ */
+static TupleTableSlot**
+ogrExecForeignBatchInsert(EState* estate,
+                          ResultRelInfo* rinfo,
+                          TupleTableSlot** slots,
+                          TupleTableSlot** planSlots,
+                          int* numSlots)
+{
+	OgrFdwModifyState* modstate = rinfo->ri_FdwState;
+	bool batch_xact = false;
+	int i;
+
+	elog(DEBUG2, "%s: inserting %d rows", __func__, *numSlots);
+
+	ogrBeginTransaction(&(modstate->ogr));
+
+#if GDAL_VERSION_MAJOR >= 2
+	if (!modstate->ogr.cache_entry && *numSlots > 1 &&
+	    GDALDatasetTestCapability(modstate->ogr.ds, ODsCTransactions))
+	{
+		batch_xact = (GDALDatasetStartTransaction(modstate->ogr.ds, FALSE) == OGRERR_NONE);
+	}
+#endif
+
+	/* A row that fails takes the rows before it down too */
+	PG_TRY();
+	{
+		for (i = 0; i < *numSlots; i++)
+		{
+			ogrInsertSlot(modstate, slots[i]);
+		}
+	}
+	PG_CATCH();
+	{
+#if GDAL_VERSION_MAJOR >= 2
+		if (batch_xact)
+			GDALDatasetRollbackTransaction(modstate->ogr.ds);
+#endif
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+#if GDAL_VERSION_MAJOR >= 2
+	if (batch_xact && GDALDatasetCommitTransaction(modstate->ogr.ds) != OGRERR_NONE)
+	{
+		ogrEreportError("failure committing OGR batch insert");
+	}
+#endif
+
+	return slots;
+}
+#endif /* PG_VERSION_NUM >= 140000 */
+
 
 
 static TupleTableSlot*
@@ -3127,8 +7269,10 @@ ogrExecForeignDelete(EState* estate,
 
 	elog(DEBUG2, "ogrExecForeignDelete fid=" OGR_FDW_FRMT_INT64, OGR_FDW_CAST_INT64(fid));
 
+	ogrBeginTransaction(&(modstate->ogr));
 	/* Delete the OGR feature for this fid */
 	err = OGR_L_DeleteFeature(modstate->ogr.lyr, fid);
+	ogrRtreeInvalidate(modstate->ogr.ds_str, modstate->ogr.lyr_str);
 
 	if (err != OGRERR_NONE)
 	{
@@ -3147,6 +7291,16 @@ ogrEndForeignModify(EState* estate, ResultRelInfo* rinfo)
 
 	elog(DEBUG3, "%s: entered function", __func__);
 
+	if (modstate->feat)
+	{
+		OGR_F_Destroy(modstate->feat);
+		modstate->feat = NULL;
+	}
+
+	/* The statement's writes are done */
+	if (modstate->ogr.cache_entry && modstate->ogr.cache_entry->xact)
+		ogrConnCacheCommit(modstate->ogr.cache_entry);
+
 	ogrFinishConnection(&(modstate->ogr));
 
 	return;
@@ -3181,12 +7335,14 @@ ogrIsForeignRelUpdatable(Relation rel)
 	if (ogr.ds_updateable == OGR_UPDATEABLE_FALSE ||
 	    ogr.lyr_updateable == OGR_UPDATEABLE_FALSE)
 	{
+		ogrFinishConnection(&ogr);
 		return readonly;
 	}
 
 	/* No data source or layer objects? Readonly */
 	if (!(ogr.ds && ogr.lyr))
 	{
+		ogrFinishConnection(&ogr);
 		return readonly;
 	}
 
@@ -19,12 +19,16 @@
 #include "postgres.h"
 #include "access/heapam.h"
 #include "access/htup_details.h"
+#include "access/parallel.h"
 #include "access/reloptions.h"
 #include "access/sysattr.h"
 #include "access/transam.h"
 #include "access/tupdesc.h"
+#include "access/xact.h"
+#include "catalog/dependency.h"
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_aggregate.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_extension.h"
 #include "catalog/pg_foreign_table.h"
@@ -38,6 +42,7 @@
 #include "commands/explain.h"
 #include "commands/extension.h"
 #include "commands/vacuum.h"
+#include "executor/spi.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
 #include "mb/pg_wchar.h"
@@ -47,20 +52,38 @@
 #include "optimizer/clauses.h"
 #include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "optimizer/planmain.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
 #include "parser/parsetree.h"
+#include "port/atomics.h"
 #include "storage/ipc.h"
+#include "storage/shm_toc.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/catcache.h"
 #include "utils/date.h"
+#include "utils/datetime.h"
 #include "utils/fmgroids.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/numeric.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 #include "utils/timestamp.h"
+#include "utils/typcache.h"
+
+#if PG_VERSION_NUM >= 140000
+#include "executor/execAsync.h"
+#include "storage/latch.h"
+#endif
+
+#if PG_VERSION_NUM >= 180000
+#include "commands/explain_format.h"
+#endif
 
 #if PG_VERSION_NUM < 120000
 #include "nodes/relation.h"
@@ -68,6 +91,7 @@
 #else
 #include "executor/tuptable.h"
 #include "optimizer/appendinfo.h"
+#include "optimizer/optimizer.h"
 #endif
 
 #ifdef PACKAGE_URL
@@ -86,6 +110,47 @@
 /* hexwkb is not. */
 #define OGR_FDW_HEXWKB TRUE
 
+/* Open GDAL datasets are kept in a per-backend cache */
+/* and re-used across queries. The cache holds at most */
+/* this many datasets, and closes any that have not */
+/* been used for this many seconds. */
+#define OGR_FDW_CONNECTION_CACHE_SIZE 16
+#define OGR_FDW_CONNECTION_IDLE_SECS 300
+
+/* Background readers (prefetch and async scans) */
+/* buffer up to this many features ahead of the */
+/* backend, unless the server sets prefetch_size, */
+/* which can be at most the MAX. */
+#define OGR_FDW_READER_RING_SIZE 1024
+#define OGR_FDW_READER_RING_MAX 1048576
+
+/* Parallel scans hand out the layer to workers in */
+/* chunks of this many FIDs. */
+#define OGR_FDW_PARALLEL_CHUNK_SIZE 10000
+
+/* Fetching a feature by FID, or starting an indexed */
+/* filter, costs this much, against one for each */
+/* feature read in a scan. */
+#define OGR_FDW_LOOKUP_COST 10.0
+
+/* Long lists of keys, "col = ANY($1)", are read this */
+/* many keys at a time, unless key_batch_size says. */
+#define OGR_FDW_KEY_BATCH_SIZE 1000
+
+/* Rows inserted per call to the FDW, unless */
+/* batch_size says (PgSQL 14 and up). */
+#define OGR_FDW_BATCH_SIZE 1
+
+/* Spatial filter boxes in another coordinate system */
+/* are transformed with this many extra points along */
+/* each edge, to follow the edges as they curve. */
+#define OGR_FDW_DENSIFY_POINTS 21
+
+/* Layers with no spatial index of their own can have */
+/* one built in memory (spatial_index option). Each */
+/* backend keeps this many of them. */
+#define OGR_FDW_RTREE_CACHE_SIZE 8
+
 extern Oid GEOMETRYOID;
 
 typedef enum
@@ -103,6 +168,12 @@ typedef enum {
 	OGR_UPDATEABLE_TRY
 } OgrUpdateable;
 
+typedef enum {
+	OGR_ARROW_STREAM_UNSET,
+	OGR_ARROW_STREAM_TRUE,
+	OGR_ARROW_STREAM_FALSE
+} OgrArrowStream;
+
 typedef struct OgrFdwColumn
 {
 	/* PgSQL metadata */
@@ -144,6 +215,11 @@ typedef struct OgrFdwSpatialFilter
 {
 	int ogrfldnum;
 	double minx, miny, maxx, maxy;
+	char* hexwkb;     /* geometry features must intersect, or NULL for the box */
+	int param;        /* parameter (from one) holding the geometry, or zero */
+	double distance;  /* for a parameter, how far features can be from it */
+	bool exact;       /* for a parameter, features must intersect it */
+	char* colname;    /* geometry column filtered on, for EXPLAIN */
 } OgrFdwSpatialFilter;
 
 typedef struct OgrConnection
@@ -158,6 +234,7 @@ typedef struct OgrConnection
 	int char_encoding;   /* Is OGR layer UTF? Has user provided encoding open option? */
 	GDALDatasetH ds;      /* GDAL datasource handle */
 	OGRLayerH lyr;        /* OGR layer handle */
+	struct OgrConnCacheEntry* cache_entry; /* cache slot ds is leased from, if any */
 } OgrConnection;
 
 typedef enum
@@ -173,7 +250,6 @@ typedef struct OgrFdwState
 	Oid foreigntableid;
 	OgrConnection ogr;   /* connection object */
 	OgrFdwTable* table;
-	TupleDesc tupdesc;
 } OgrFdwState;
 
 typedef struct OgrFdwPlanState
@@ -182,24 +258,100 @@ typedef struct OgrFdwPlanState
 	Oid foreigntableid;
 	OgrConnection ogr;
 	OgrFdwTable* table;
-	TupleDesc tupdesc;
 	int nrows;           /* estimate of number of rows in file */
 	Cost startup_cost;
 	Cost total_cost;
 	bool* pushdown_clauses;
+	bool async_capable;  /* scans may run asynchronously under Append */
 } OgrFdwPlanState;
 
+/*
+ * One step of the per-scan conversion program: fill in
+ * slot attribute attnum from OGR field ogrfldnum.
+ */
+struct OgrFdwConvertStep;
+struct OgrFdwExecState;
+
+typedef OGRErr (*OgrFdwConvertFunc)(const OGRFeatureH feat,
+                                    const struct OgrFdwConvertStep* step,
+                                    const struct OgrFdwExecState* execstate,
+                                    Datum* value, bool* isnull);
+
+#define OGR_CONVERT_NULLABLE 0x01  /* skip when OGR field is unset or null */
+#define OGR_CONVERT_SETSRID  0x02  /* apply typmod SRID to geometry */
+#define OGR_CONVERT_FID      0x04  /* value is the feature FID, NULL when unset */
+#define OGR_CONVERT_INTEGER  0x08  /* source is integral (FID or integer field) */
+
+typedef struct OgrFdwConvertStep
+{
+	int attnum;               /* slot attribute (zero based) */
+	int ogrfldnum;            /* OGR field or geometry field number */
+	int flags;                /* OGR_CONVERT_* */
+	OgrFdwConvertFunc convert;
+	const OgrFdwColumn* col;  /* column metadata, owned by the table cache */
+} OgrFdwConvertStep;
+
+/*
+ * Shared state of a parallel scan, in dynamic shared memory:
+ * the next chunk of feature indexes to be claimed.
+ */
+typedef struct OgrFdwParallelState
+{
+	pg_atomic_uint64 next_chunk;
+} OgrFdwParallelState;
+
+/*
+ * Aggregates that a scan answers from layer metadata
+ * instead of reading features, see ogrGetForeignUpperPaths.
+ */
+typedef enum
+{
+	OGR_AGG_COUNT,   /* count(*), from OGR_L_GetFeatureCount */
+	OGR_AGG_EXTENT   /* ST_Extent(geom), from OGR_L_GetExtentEx */
+} OgrFdwAggKind;
+
+/* Background feature reader, ogr_fdw_reader.c */
+typedef struct OgrFdwReader OgrFdwReader;
+
 typedef struct OgrFdwExecState
 {
 	OgrFdwStateType type;
 	Oid foreigntableid;
 	OgrConnection ogr;
 	OgrFdwTable *table;
-	TupleDesc tupdesc;
 	char* sql;              /* OGR SQL for attribute filter */
+	List* param_exprs;      /* states of the parameters in the filter */
+	char* sql_params;       /* the filter with its $n parameters, to fill on rescan */
+	bool refilter;          /* parameters may have changed since the filter was set */
+	List* sql_batches;      /* filters for each batch of keys of a long list */
+	int batch_pos;          /* the batch being read */
+	int batch_param;        /* parameter read in batches, from one, or zero */
+	int batch_size;
+	OgrFdwSpatialFilter* spatial_filter; /* set from a parameter as the scan (re)starts */
+	int xform_srid;         /* SRID of the parameter geometry last transformed, or zero */
+	bool xform_ok;          /* ... and whether it transforms to the layer at all */
+	OGRCoordinateTransformationH xform; /* ... and how, NULL if it needs no transforming */
 	int rownum;             /* how many rows have we read thus far? */
+	int limit;              /* rows a LIMIT lets us return, or -1 */
 	Oid setsridfunc;        /* ST_SetSRID() */
 	Oid typmodsridfunc;     /* postgis_typmod_srid() */
+	OgrFdwConvertStep* program; /* per-column conversions, built at scan start */
+	int nsteps;
+	struct OgrFdwArrowScan* arrow; /* Arrow stream reader, if reading batches */
+	OgrFdwParallelState* pstate;   /* shared chunk counter, if scanning in parallel */
+	GIntBig chunk_end;             /* FID past our current chunk, 0 if none */
+	bool chunks_done;              /* claimed a chunk past the end of the layer */
+	OgrFdwReader* reader;          /* background reader, which then owns the layer */
+	bool async;                    /* scan is driven by an async Append */
+	List* aggs;                    /* (kind, ogrfldnum) pairs of an aggregate scan */
+	OGRLayerH result_lyr;          /* result of a query run by the data source */
+	OgrFdwConvertStep* result_steps; /* how each scan tuple column is read from the result */
+	ExprState* fid_expr;           /* FID (or FID array) to fetch, instead of reading the layer */
+	int64* fids;                   /* the FIDs, sorted and unique */
+	int nfids;
+	int fidpos;                    /* next one to fetch */
+	bool fids_ready;               /* fid_expr evaluated since the last (re)scan */
+	bool fid_index;                /* the FIDs came from the in-memory spatial index */
 } OgrFdwExecState;
 
 typedef struct OgrFdwModifyState
@@ -208,12 +360,45 @@ typedef struct OgrFdwModifyState
 	Oid foreigntableid;
 	OgrConnection ogr;     /* connection object */
 	OgrFdwTable* table;
-	TupleDesc tupdesc;
+	OGRFeatureH feat;      /* re-used for every row inserted */
+	int batch_size;        /* rows per batch insert, zero until read */
 } OgrFdwModifyState;
 
 /* Shared function signatures */
-bool ogrDeparse(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* exprs, OgrFdwState* state, List** params_list, OgrFdwSpatialFilter** sf);
+bool ogrDeparse(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* exprs, OgrFdwState* state, List** params_list, OgrFdwSpatialFilter** sf, int* batchparam);
+bool ogrDeparseAggregate(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* tlist, List* groupvars, List* exprs, OgrFdwState* state);
+List* ogrDeparseFillParams(const char* sql, int nparams, const Datum* values, const bool* nulls, const Oid* types, int batchparam, int batchsize);
+bool ogrDeparseJoin(StringInfo buf, PlannerInfo* root, RelOptInfo* outerrel, OgrFdwState* outerstate, RelOptInfo* innerrel, OgrFdwState* innerstate, List* tlist, List* joinclauses);
 Oid ogrGetGeometryOid(void);
 OGRErr pgDatumToOgrGeometry (Datum pg_geometry, Oid pgsendfunc, OGRGeometryH* ogr_geometry);
+OGRErr pgDatumToOgrGeometrySrid (Datum pg_geometry, Oid pgsendfunc, OGRGeometryH* ogr_geometry, int* srid);
+bool ogrSridTransform(int srid, OGRLayerH lyr, int ogrfldnum, OGRCoordinateTransformationH* ct);
+bool ogrTransformEnvelope(OGRCoordinateTransformationH ct, OGREnvelope* env);
+Datum pgDatumFromCString(const char* cstr, const OgrFdwColumn *col, int char_encoding, bool *is_null);
+Datum ogrWkbToGeometryDatum(const unsigned char* wkb, int wkbsize, const OgrFdwConvertStep* step, const OgrFdwExecState* execstate);
+
+/* Arrow stream reader, ogr_fdw_arrow.c */
+bool ogrArrowScanBegin(OgrFdwExecState* execstate, OgrArrowStream mode);
+bool ogrArrowScanNext(OgrFdwExecState* execstate, TupleTableSlot* slot);
+void ogrArrowScanReset(OgrFdwExecState* execstate);
+void ogrArrowScanEnd(OgrFdwExecState* execstate);
+
+/* Background feature reader, ogr_fdw_reader.c */
+bool ogrReaderAvailable(void);
+OgrFdwReader* ogrReaderCreate(OGRLayerH lyr, int size, const int* wkbfields, int nwkb);
+void ogrReaderStart(OgrFdwReader* reader);
+void ogrReaderStop(OgrFdwReader* reader);
+void ogrReaderStopAll(void);
+void ogrReaderDrain(OgrFdwReader* reader);
+int ogrReaderWaitFd(OgrFdwReader* reader);
+bool ogrReaderFinished(OgrFdwReader* reader);
+OGRFeatureH ogrReaderNext(OgrFdwReader* reader, bool wait);
+const unsigned char* ogrReaderWkb(OgrFdwReader* reader, int geomfld, int* wkbsize);
+
+/* In-memory spatial index, ogr_fdw_rtree.c */
+typedef struct OgrFdwRtree OgrFdwRtree;
+OgrFdwRtree* ogrRtreeGet(const OgrConnection* ogr, int ogrfldnum);
+void ogrRtreeInvalidate(const char* ds_str, const char* lyr_str);
+int ogrRtreeSearch(const OgrFdwRtree* rtree, double minx, double miny, double maxx, double maxy, int64** fids);
 
 #endif /* _OGR_FDW_H */
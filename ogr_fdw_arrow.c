@@ -0,0 +1,813 @@
+/*-------------------------------------------------------------------------
+ *
+ * ogr_fdw_arrow.c
+ *		  foreign-data wrapper for GIS data access.
+ *
+ * Copyright (c) 2014-2015, Paul Ramsey <pramsey@cleverelephant.ca>
+ *
+ * Alternative scan engine that reads record batches through
+ * OGR_L_GetArrowStream (GDAL 3.6+) and fills slots straight from
+ * the columnar buffers, instead of materializing one OGRFeature
+ * per row. See https://arrow.apache.org/docs/format/CDataInterface.html
+ *-------------------------------------------------------------------------
+ */
+
+/*
+ * Local structures
+ */
+#include "ogr_fdw.h"
+
+/*
+ * System
+ */
+#include <math.h>
+
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0))
+
+#include "ogr_recordbatch.h"
+
+struct OgrFdwArrowColumn;
+
+/* Converts row idx of a child array into a datum */
+typedef void (*OgrFdwArrowConvertFunc)(const struct ArrowArray* arr,
+                                       int64 idx,
+                                       const struct OgrFdwArrowColumn* acol,
+                                       const OgrFdwExecState* execstate,
+                                       Datum* value, bool* isnull);
+
+typedef struct OgrFdwArrowColumn
+{
+	const OgrFdwConvertStep* step; /* column, attnum and flags */
+	int child;                     /* index in the batch's children */
+	OgrFdwArrowConvertFunc convert;
+	int64 unit_usecs;              /* temporal unit in microseconds, 0 for nanoseconds */
+	bool has_tz;                   /* timestamp carries a time zone */
+	int tz_secs;                   /* fixed offset east of UTC, in seconds */
+} OgrFdwArrowColumn;
+
+struct OgrFdwArrowScan
+{
+	struct ArrowArrayStream stream;
+	struct ArrowArray batch;       /* release is NULL when no batch is held */
+	bool stream_open;
+	int64 row;                     /* next row to read from batch */
+	int ncols;
+	OgrFdwArrowColumn* cols;
+	char** options;                /* OGR_L_GetArrowStream() options */
+	OGRLayerH lyr;
+};
+
+/* Days and microseconds between the Unix and PgSQL epochs */
+#define OGR_ARROW_EPOCH_DAYS (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE)
+#define OGR_ARROW_EPOCH_USECS ((int64) OGR_ARROW_EPOCH_DAYS * SECS_PER_DAY * USECS_PER_SEC)
+
+/* Rows per batch when MAX_FEATURES_IN_BATCH is not given */
+#define OGR_ARROW_BATCH_SIZE 65536
+
+static inline bool
+ogrArrowIsNull(const struct ArrowArray* arr, int64 idx)
+{
+	const uint8* validity = (const uint8*) arr->buffers[0];
+	if (arr->null_count == 0 || !validity)
+		return false;
+	return !(validity[idx >> 3] & (1 << (idx & 7)));
+}
+
+static inline bool
+ogrArrowBit(const struct ArrowArray* arr, int buffer, int64 idx)
+{
+	const uint8* bits = (const uint8*) arr->buffers[buffer];
+	return (bits[idx >> 3] & (1 << (idx & 7))) != 0;
+}
+
+/*
+ * Integers, whatever their width in the batch
+ */
+static int64
+ogrArrowGetInteger(const struct ArrowArray* arr, int64 idx, char format)
+{
+	switch (format)
+	{
+		case 'c':
+			return ((const int8*) arr->buffers[1])[idx];
+		case 's':
+			return ((const int16*) arr->buffers[1])[idx];
+		case 'i':
+			return ((const int32*) arr->buffers[1])[idx];
+		case 'l':
+			return ((const int64*) arr->buffers[1])[idx];
+		case 'b':
+			return ogrArrowBit(arr, 1, idx) ? 1 : 0;
+		default:
+			elog(ERROR, "%s: unexpected Arrow integer format '%c'", __func__, format);
+			return 0;
+	}
+}
+
+#define OGR_ARROW_INTEGER_CONVERTER(name, format) \
+static void \
+name(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull) \
+{ \
+	*value = ogrArrowIntegerToDatum(ogrArrowGetInteger(arr, idx, format), acol->step->col, execstate); \
+	*isnull = false; \
+}
+
+static Datum
+ogrArrowIntegerToDatum(int64 i, const OgrFdwColumn* col, const OgrFdwExecState* execstate)
+{
+	switch (col->pgtype)
+	{
+		case BOOLOID:
+			if (i == 0 || i == 1)
+				return BoolGetDatum(i == 1);
+			break;
+		case INT2OID:
+			if (i < PG_INT16_MIN || i > PG_INT16_MAX)
+				ereport(ERROR,
+				        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				         errmsg("value \"" INT64_FORMAT "\" is out of range for type %s", i, "smallint")));
+			return Int16GetDatum((int16) i);
+		case INT4OID:
+			if (i < PG_INT32_MIN || i > PG_INT32_MAX)
+				ereport(ERROR,
+				        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				         errmsg("value \"" INT64_FORMAT "\" is out of range for type %s", i, "integer")));
+			return Int32GetDatum((int32) i);
+		case INT8OID:
+			return Int64GetDatum(i);
+		case FLOAT4OID:
+			return Float4GetDatum((float4) i);
+		case FLOAT8OID:
+			return Float8GetDatum((float8) i);
+		case NUMERICOID:
+		{
+			Datum num = DirectFunctionCall1(int8_numeric, Int64GetDatum(i));
+			if (col->pgtypmod >= 0)
+				num = DirectFunctionCall2(numeric, num, Int32GetDatum(col->pgtypmod));
+			return num;
+		}
+		default:
+			break;
+	}
+
+	/* Everything else (text types, odd booleans) goes through the input function */
+	{
+		char cstr[32];
+		bool is_null;
+		snprintf(cstr, sizeof(cstr), INT64_FORMAT, i);
+		return pgDatumFromCString(cstr, col, execstate->ogr.char_encoding, &is_null);
+	}
+}
+
+OGR_ARROW_INTEGER_CONVERTER(ogrArrowConvertInt8, 'c')
+OGR_ARROW_INTEGER_CONVERTER(ogrArrowConvertInt16, 's')
+OGR_ARROW_INTEGER_CONVERTER(ogrArrowConvertInt32, 'i')
+OGR_ARROW_INTEGER_CONVERTER(ogrArrowConvertInt64, 'l')
+OGR_ARROW_INTEGER_CONVERTER(ogrArrowConvertBool, 'b')
+
+static void
+ogrArrowConvertFloat(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	double d = ((const float*) arr->buffers[1])[idx];
+	*value = (acol->step->col->pgtype == FLOAT4OID) ? Float4GetDatum((float4) d) : Float8GetDatum(d);
+	*isnull = false;
+}
+
+static void
+ogrArrowConvertDouble(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	double d = ((const double*) arr->buffers[1])[idx];
+
+	if (acol->step->col->pgtype == FLOAT4OID)
+	{
+		float4 f = (float4) d;
+		if (isinf(f) && !isinf(d))
+			ereport(ERROR,
+			        (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+			         errmsg("\"%g\" is out of range for type real", d)));
+		*value = Float4GetDatum(f);
+	}
+	else
+	{
+		*value = Float8GetDatum(d);
+	}
+	*isnull = false;
+}
+
+/*
+ * Variable length values: strings and binaries (including WKB
+ * geometries) use 32 bit offsets, their "large" variants 64 bit.
+ */
+static inline const char*
+ogrArrowGetBytes(const struct ArrowArray* arr, int64 idx, bool large, int64* len)
+{
+	int64 start, end;
+	if (large)
+	{
+		const int64* offsets = (const int64*) arr->buffers[1];
+		start = offsets[idx];
+		end = offsets[idx + 1];
+	}
+	else
+	{
+		const int32* offsets = (const int32*) arr->buffers[1];
+		start = offsets[idx];
+		end = offsets[idx + 1];
+	}
+	*len = end - start;
+	return (const char*) arr->buffers[2] + start;
+}
+
+static void
+ogrArrowConvertString(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull, bool large)
+{
+	int64 len;
+	const char* bytes = ogrArrowGetBytes(arr, idx, large, &len);
+	char* cstr = pnstrdup(bytes, len);
+	*value = pgDatumFromCString(cstr, acol->step->col, execstate->ogr.char_encoding, isnull);
+	pfree(cstr);
+}
+
+static void
+ogrArrowConvertUtf8(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	ogrArrowConvertString(arr, idx, acol, execstate, value, isnull, false);
+}
+
+static void
+ogrArrowConvertLargeUtf8(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	ogrArrowConvertString(arr, idx, acol, execstate, value, isnull, true);
+}
+
+static void
+ogrArrowConvertBinary(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull, bool large)
+{
+	int64 len;
+	const char* bytes = ogrArrowGetBytes(arr, idx, large, &len);
+
+	if (acol->step->col->pgtype == BYTEAOID)
+	{
+		bytea* varlena = palloc(len + VARHDRSZ);
+		memcpy(VARDATA(varlena), bytes, len);
+		SET_VARSIZE(varlena, len + VARHDRSZ);
+		*value = PointerGetDatum(varlena);
+	}
+	else
+	{
+		/* Only geometry columns get mapped to non-bytea binaries */
+		*value = ogrWkbToGeometryDatum((const unsigned char*) bytes, len, acol->step, execstate);
+	}
+	*isnull = false;
+}
+
+static void
+ogrArrowConvertBytes(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	ogrArrowConvertBinary(arr, idx, acol, execstate, value, isnull, false);
+}
+
+static void
+ogrArrowConvertLargeBytes(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	ogrArrowConvertBinary(arr, idx, acol, execstate, value, isnull, true);
+}
+
+/*
+ * Dates, times and timestamps
+ */
+static void
+ogrArrowConvertDate32(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	int32 days = ((const int32*) arr->buffers[1])[idx];
+	DateADT d = days - OGR_ARROW_EPOCH_DAYS;
+
+	if (acol->step->col->pgtype == DATEOID)
+	{
+		*value = DateADTGetDatum(d);
+	}
+	else
+	{
+		/* Midnight, for timestamp and timestamptz targets */
+		*value = (acol->step->col->pgtype == TIMESTAMPOID)
+		         ? DirectFunctionCall1(date_timestamp, DateADTGetDatum(d))
+		         : DirectFunctionCall1(date_timestamptz, DateADTGetDatum(d));
+	}
+	*isnull = false;
+}
+
+static inline int64
+ogrArrowTemporalToUsecs(int64 v, const OgrFdwArrowColumn* acol)
+{
+	return acol->unit_usecs ? v * acol->unit_usecs : v / 1000;
+}
+
+static void
+ogrArrowConvertTime(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull, bool wide)
+{
+	int64 v = wide ? ((const int64*) arr->buffers[1])[idx] : ((const int32*) arr->buffers[1])[idx];
+	const OgrFdwColumn* col = acol->step->col;
+
+	*value = TimeADTGetDatum(ogrArrowTemporalToUsecs(v, acol));
+	if (col->pgtypmod >= 0)
+		*value = DirectFunctionCall2(time_scale, *value, Int32GetDatum(col->pgtypmod));
+	*isnull = false;
+}
+
+static void
+ogrArrowConvertTime32(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	ogrArrowConvertTime(arr, idx, acol, execstate, value, isnull, false);
+}
+
+static void
+ogrArrowConvertTime64(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	ogrArrowConvertTime(arr, idx, acol, execstate, value, isnull, true);
+}
+
+/*
+ * Arrow timestamps with a time zone are instants (UTC);
+ * without one they are wall clock times stored as if UTC.
+ * A timestamp column gets the wall clock time, as the feature
+ * reader does; a timestamptz column gets the instant, with
+ * wall clock times read in the session time zone.
+ */
+static void
+ogrArrowConvertTimestamp(const struct ArrowArray* arr, int64 idx, const OgrFdwArrowColumn* acol, const OgrFdwExecState* execstate, Datum* value, bool* isnull)
+{
+	const OgrFdwColumn* col = acol->step->col;
+	int64 usecs = ogrArrowTemporalToUsecs(((const int64*) arr->buffers[1])[idx], acol);
+	Timestamp ts = usecs - OGR_ARROW_EPOCH_USECS;
+
+	if (col->pgtype == TIMESTAMPOID)
+	{
+		if (acol->has_tz)
+			ts += (int64) acol->tz_secs * USECS_PER_SEC;
+
+		*value = TimestampGetDatum(ts);
+		if (col->pgtypmod >= 0)
+			*value = DirectFunctionCall2(timestamp_scale, *value, Int32GetDatum(col->pgtypmod));
+	}
+	else
+	{
+		if (!acol->has_tz)
+			ts = DatumGetTimestampTz(DirectFunctionCall1(timestamp_timestamptz, TimestampGetDatum(ts)));
+
+		*value = TimestampTzGetDatum(ts);
+		if (col->pgtypmod >= 0)
+			*value = DirectFunctionCall2(timestamptz_scale, *value, Int32GetDatum(col->pgtypmod));
+	}
+	*isnull = false;
+}
+
+/*
+ * Arrow temporal units, as microsecond multipliers,
+ * with nanoseconds flagged by zero.
+ */
+static bool
+ogrArrowTemporalUnit(char unit, int64* unit_usecs)
+{
+	switch (unit)
+	{
+		case 's': *unit_usecs = USECS_PER_SEC; return true;
+		case 'm': *unit_usecs = 1000; return true;
+		case 'u': *unit_usecs = 1; return true;
+		case 'n': *unit_usecs = 0; return true;
+		default: return false;
+	}
+}
+
+/*
+ * Arrow time zones, as OGR writes them: empty for none,
+ * "UTC", or a fixed "+HH:MM" offset.
+ */
+static bool
+ogrArrowTimeZone(const char* tz, OgrFdwArrowColumn* acol)
+{
+	int hours, minutes;
+	char sign;
+
+	acol->has_tz = (tz && *tz);
+	acol->tz_secs = 0;
+
+	if (!acol->has_tz || strcaseeq(tz, "UTC") || strcaseeq(tz, "Etc/UTC"))
+		return true;
+
+	if (sscanf(tz, "%c%d:%d", &sign, &hours, &minutes) == 3 && (sign == '+' || sign == '-'))
+	{
+		acol->tz_secs = (hours * MINS_PER_HOUR + minutes) * SECS_PER_MINUTE * (sign == '-' ? -1 : 1);
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Pick the converter for one column from its Arrow format
+ * string. Returns false for any pairing of Arrow and PgSQL
+ * types the reader does not handle, in which case the scan
+ * falls back to the feature reader.
+ */
+static bool
+ogrArrowColumnConverter(const struct ArrowSchema* schema, OgrFdwArrowColumn* acol)
+{
+	const char* fmt = schema->format;
+	const OgrFdwColumn* col = acol->step->col;
+	Oid pgtype = col->pgtype;
+	bool is_textual = (pgtype == TEXTOID || pgtype == VARCHAROID || pgtype == BPCHAROID);
+
+	/* Dictionary encoded and nested types stay on the feature reader */
+	if (schema->dictionary || schema->n_children > 0)
+		return false;
+
+	if (col->ogrvariant == OGR_GEOMETRY)
+	{
+		if (streq(fmt, "z"))
+			acol->convert = ogrArrowConvertBytes;
+		else if (streq(fmt, "Z"))
+			acol->convert = ogrArrowConvertLargeBytes;
+		else
+			return false;
+		return (pgtype == BYTEAOID || pgtype == ogrGetGeometryOid());
+	}
+
+	/* Integers, which OGR may narrow to int8/int16 subtypes or booleans */
+	if (strlen(fmt) == 1 && strchr("csilb", fmt[0]))
+	{
+		switch (fmt[0])
+		{
+			case 'c': acol->convert = ogrArrowConvertInt8; break;
+			case 's': acol->convert = ogrArrowConvertInt16; break;
+			case 'i': acol->convert = ogrArrowConvertInt32; break;
+			case 'l': acol->convert = ogrArrowConvertInt64; break;
+			case 'b': acol->convert = ogrArrowConvertBool; break;
+		}
+		return (pgtype == BOOLOID || pgtype == INT2OID || pgtype == INT4OID ||
+		        pgtype == INT8OID || pgtype == FLOAT4OID || pgtype == FLOAT8OID ||
+		        pgtype == NUMERICOID || is_textual);
+	}
+
+	/*
+	 * Reals are only read into floating point columns, since for
+	 * numeric and text OGR's string form carries the field's scale.
+	 */
+	if (streq(fmt, "f") || streq(fmt, "g"))
+	{
+		acol->convert = streq(fmt, "f") ? ogrArrowConvertFloat : ogrArrowConvertDouble;
+		return (pgtype == FLOAT4OID || pgtype == FLOAT8OID);
+	}
+
+	if (streq(fmt, "u") || streq(fmt, "U"))
+	{
+		acol->convert = streq(fmt, "u") ? ogrArrowConvertUtf8 : ogrArrowConvertLargeUtf8;
+		return (col->ogrfldtype == OFTString);
+	}
+
+	if (streq(fmt, "z") || streq(fmt, "Z"))
+	{
+		acol->convert = streq(fmt, "z") ? ogrArrowConvertBytes : ogrArrowConvertLargeBytes;
+		return (pgtype == BYTEAOID);
+	}
+
+	if (streq(fmt, "tdD"))
+	{
+		acol->convert = ogrArrowConvertDate32;
+		return (pgtype == DATEOID || pgtype == TIMESTAMPOID || pgtype == TIMESTAMPTZOID);
+	}
+
+	/* time32 (seconds, milliseconds), time64 (micro, nanoseconds) */
+	if (strlen(fmt) == 3 && strncmp(fmt, "tt", 2) == 0)
+	{
+		if (!ogrArrowTemporalUnit(fmt[2], &(acol->unit_usecs)))
+			return false;
+		acol->convert = (fmt[2] == 's' || fmt[2] == 'm') ? ogrArrowConvertTime32 : ogrArrowConvertTime64;
+		return (pgtype == TIMEOID);
+	}
+
+	/* timestamp, "ts<unit>:<timezone>" */
+	if (strlen(fmt) >= 4 && strncmp(fmt, "ts", 2) == 0 && fmt[3] == ':')
+	{
+		if (!ogrArrowTemporalUnit(fmt[2], &(acol->unit_usecs)))
+			return false;
+		if (!ogrArrowTimeZone(fmt + 4, acol))
+			return false;
+		acol->convert = ogrArrowConvertTimestamp;
+		return (pgtype == TIMESTAMPOID || pgtype == TIMESTAMPTZOID);
+	}
+
+	return false;
+}
+
+/*
+ * Name the batch uses for the data behind a conversion step:
+ * the FID column, the geometry field or the attribute field.
+ */
+static const char*
+ogrArrowColumnName(OGRLayerH lyr, const OgrFdwConvertStep* step)
+{
+	OGRFeatureDefnH dfn = OGR_L_GetLayerDefn(lyr);
+
+	if (step->col->ogrvariant == OGR_FID)
+	{
+		const char* fidname = OGR_L_GetFIDColumn(lyr);
+		return (fidname && *fidname) ? fidname : "OGC_FID";
+	}
+	else if (step->col->ogrvariant == OGR_GEOMETRY)
+	{
+		const char* geomname = OGR_GFld_GetNameRef(OGR_FD_GetGeomFieldDefn(dfn, step->ogrfldnum));
+		return (geomname && *geomname) ? geomname : "wkb_geometry";
+	}
+	else
+	{
+		return OGR_Fld_GetNameRef(OGR_FD_GetFieldDefn(dfn, step->ogrfldnum));
+	}
+}
+
+/*
+ * Map every step of the conversion program onto a child
+ * of the batch schema. On failure, explain in *reason.
+ */
+static bool
+ogrArrowMapColumns(struct OgrFdwArrowScan* scan, const OgrFdwExecState* execstate, const struct ArrowSchema* schema, const char** reason)
+{
+	int i, j;
+
+	scan->ncols = execstate->nsteps;
+	scan->cols = palloc0(sizeof(OgrFdwArrowColumn) * Max(scan->ncols, 1));
+
+	for (i = 0; i < execstate->nsteps; i++)
+	{
+		OgrFdwArrowColumn* acol = &(scan->cols[i]);
+		const char* name;
+
+		acol->step = &(execstate->program[i]);
+		acol->child = -1;
+		name = ogrArrowColumnName(scan->lyr, acol->step);
+
+		for (j = 0; j < schema->n_children; j++)
+		{
+			if (schema->children[j]->name && streq(schema->children[j]->name, name))
+			{
+				acol->child = j;
+				break;
+			}
+		}
+
+		if (acol->child < 0)
+		{
+			*reason = psprintf("column \"%s\" not found in Arrow stream", name);
+			return false;
+		}
+
+		if (!ogrArrowColumnConverter(schema->children[acol->child], acol))
+		{
+			*reason = psprintf("Arrow type \"%s\" of \"%s\" is not supported for column \"%s\"",
+			                   schema->children[acol->child]->format, name, acol->step->col->pgname);
+			return false;
+		}
+
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,8,0))
+		/* Mixed time zones come through as UTC, which a timestamp column would show */
+		if (acol->convert == ogrArrowConvertTimestamp && acol->step->col->pgtype == TIMESTAMPOID &&
+		    acol->step->col->ogrvariant == OGR_FIELD &&
+		    OGR_Fld_GetTZFlag(OGR_FD_GetFieldDefn(OGR_L_GetLayerDefn(scan->lyr), acol->step->ogrfldnum)) == OGR_TZFLAG_MIXED_TZ)
+		{
+			*reason = psprintf("field \"%s\" has mixed time zones", name);
+			return false;
+		}
+#endif
+	}
+
+	return true;
+}
+
+static void
+ogrArrowReleaseBatch(struct OgrFdwArrowScan* scan)
+{
+	if (scan->batch.release)
+		scan->batch.release(&(scan->batch));
+	scan->batch.release = NULL;
+	scan->row = 0;
+}
+
+static void
+ogrArrowCloseStream(struct OgrFdwArrowScan* scan)
+{
+	ogrArrowReleaseBatch(scan);
+	if (scan->stream_open && scan->stream.release)
+		scan->stream.release(&(scan->stream));
+	scan->stream_open = false;
+}
+
+/*
+ * Streams and batches are GDAL allocations, so make sure they
+ * are released when the executor memory goes away, even if
+ * the scan ends in an error.
+ */
+static void
+ogrArrowScanCleanup(void* arg)
+{
+	ogrArrowCloseStream((struct OgrFdwArrowScan*) arg);
+}
+
+static bool
+ogrArrowOpenStream(struct OgrFdwArrowScan* scan)
+{
+	memset(&(scan->stream), 0, sizeof(struct ArrowArrayStream));
+	scan->stream_open = OGR_L_GetArrowStream(scan->lyr, &(scan->stream), scan->options);
+	return scan->stream_open;
+}
+
+/*
+ * Decide whether a scan reads through an Arrow stream and
+ * set it up if so. Automatically used for layers that claim
+ * a fast Arrow implementation, unless the arrow_stream table
+ * option says otherwise. Returns false (and leaves the scan
+ * to the feature reader) when the stream can't be used.
+ */
+bool
+ogrArrowScanBegin(OgrFdwExecState* execstate, OgrArrowStream mode)
+{
+	struct OgrFdwArrowScan* scan;
+	struct ArrowSchema schema;
+	const char* reason = NULL;
+	bool has_fid = false;
+	MemoryContextCallback* cb;
+	int i;
+
+	elog(DEBUG3, "%s: entered function", __func__);
+
+	execstate->arrow = NULL;
+
+	if (mode == OGR_ARROW_STREAM_FALSE)
+		return false;
+
+	if (mode == OGR_ARROW_STREAM_UNSET && !OGR_L_TestCapability(execstate->ogr.lyr, OLCFastGetArrowStream))
+		return false;
+
+	scan = palloc0(sizeof(struct OgrFdwArrowScan));
+	scan->lyr = execstate->ogr.lyr;
+
+	for (i = 0; i < execstate->nsteps; i++)
+	{
+		if (execstate->program[i].flags & OGR_CONVERT_FID)
+			has_fid = true;
+	}
+	scan->options = palloc0(sizeof(char*) * 3);
+	scan->options[0] = has_fid ? "INCLUDE_FID=YES" : "INCLUDE_FID=NO";
+
+	/* Don't decode a whole default-sized batch for a small LIMIT */
+	if (execstate->limit >= 0 && execstate->limit < OGR_ARROW_BATCH_SIZE)
+		scan->options[1] = psprintf("MAX_FEATURES_IN_BATCH=%d", Max(execstate->limit, 1));
+
+	if (!ogrArrowOpenStream(scan))
+	{
+		reason = "OGR_L_GetArrowStream failed";
+	}
+	else if (scan->stream.get_schema(&(scan->stream), &schema) != 0)
+	{
+		reason = scan->stream.get_last_error(&(scan->stream));
+	}
+	else
+	{
+		ogrArrowMapColumns(scan, execstate, &schema, &reason);
+		schema.release(&schema);
+	}
+
+	if (reason)
+	{
+		ogrArrowCloseStream(scan);
+		/* Layers can't be read by features while a stream is live, so start over */
+		OGR_L_ResetReading(execstate->ogr.lyr);
+
+		if (mode == OGR_ARROW_STREAM_TRUE)
+			ereport(NOTICE,
+			        (errcode(ERRCODE_FDW_ERROR),
+			         errmsg("unable to read layer \"%s\" as an Arrow stream, reading features instead", execstate->ogr.lyr_str),
+			         errhint("%s", reason ? reason : "")));
+		else
+			elog(DEBUG2, "%s: not using Arrow stream: %s", __func__, reason);
+
+		return false;
+	}
+
+	cb = palloc0(sizeof(MemoryContextCallback));
+	cb->func = ogrArrowScanCleanup;
+	cb->arg = scan;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, cb);
+
+	elog(DEBUG2, "%s: reading layer \"%s\" as an Arrow stream", __func__, execstate->ogr.lyr_str);
+	execstate->arrow = scan;
+	return true;
+}
+
+/*
+ * Fill the slot from the next row of the stream, fetching a
+ * new batch as needed. Returns false at the end of the stream.
+ */
+bool
+ogrArrowScanNext(OgrFdwExecState* execstate, TupleTableSlot* slot)
+{
+	struct OgrFdwArrowScan* scan = execstate->arrow;
+	Datum* values = slot->tts_values;
+	bool* nulls = slot->tts_isnull;
+	int natts = slot->tts_tupleDescriptor->natts;
+	int64 row;
+	int i;
+
+	while (!scan->batch.release || scan->row >= scan->batch.length)
+	{
+		ogrArrowReleaseBatch(scan);
+
+		if (!scan->stream_open && !ogrArrowOpenStream(scan))
+			ereport(ERROR,
+			        (errcode(ERRCODE_FDW_ERROR),
+			         errmsg("unable to read layer \"%s\" as an Arrow stream", execstate->ogr.lyr_str)));
+
+		if (scan->stream.get_next(&(scan->stream), &(scan->batch)) != 0)
+		{
+			const char* ogrerr = scan->stream.get_last_error(&(scan->stream));
+			scan->batch.release = NULL;
+			ereport(ERROR,
+			        (errcode(ERRCODE_FDW_ERROR),
+			         errmsg("failure reading OGR Arrow stream"),
+			         (ogrerr && ! streq(ogrerr, "")) ? errhint("%s", ogrerr) : 0));
+		}
+
+		/* End of stream */
+		if (!scan->batch.release)
+			return false;
+	}
+
+	memset(values, 0, natts * sizeof(Datum));
+	memset(nulls, true, natts * sizeof(bool));
+
+	row = scan->batch.offset + scan->row;
+	for (i = 0; i < scan->ncols; i++)
+	{
+		const OgrFdwArrowColumn* acol = &(scan->cols[i]);
+		const struct ArrowArray* arr = scan->batch.children[acol->child];
+		int64 idx = arr->offset + row;
+		int attnum = acol->step->attnum;
+
+		if (ogrArrowIsNull(arr, idx))
+			continue;
+
+		acol->convert(arr, idx, acol, execstate, &(values[attnum]), &(nulls[attnum]));
+	}
+
+	scan->row++;
+	return true;
+}
+
+/*
+ * Start again from the top, on rescan.
+ */
+void
+ogrArrowScanReset(OgrFdwExecState* execstate)
+{
+	if (execstate->arrow)
+		ogrArrowCloseStream(execstate->arrow);
+}
+
+void
+ogrArrowScanEnd(OgrFdwExecState* execstate)
+{
+	if (execstate->arrow)
+		ogrArrowCloseStream(execstate->arrow);
+}
+
+#else /* GDAL < 3.6 */
+
+bool
+ogrArrowScanBegin(OgrFdwExecState* execstate, OgrArrowStream mode)
+{
+	execstate->arrow = NULL;
+	if (mode == OGR_ARROW_STREAM_TRUE)
+		ereport(NOTICE,
+		        (errcode(ERRCODE_FDW_ERROR),
+		         errmsg("unable to read layer \"%s\" as an Arrow stream, reading features instead", execstate->ogr.lyr_str),
+		         errhint("Arrow streams require GDAL 3.6 or higher.")));
+	return false;
+}
+
+bool
+ogrArrowScanNext(OgrFdwExecState* execstate, TupleTableSlot* slot)
+{
+	return false;
+}
+
+void
+ogrArrowScanReset(OgrFdwExecState* execstate)
+{
+	return;
+}
+
+void
+ogrArrowScanEnd(OgrFdwExecState* execstate)
+{
+	return;
+}
+
+#endif /* GDAL >= 3.6 */
@@ -25,8 +25,21 @@ typedef struct OgrDeparseCtx
 	List** params_list;       /* exprs that will become remote Params */
 	OgrFdwSpatialFilter* spatial_filter;   /* spatial filter bounds and fieldnumber */
 	OgrFdwState* state;       /* to convert local column names to OGR names */
+	bool exact;               /* only deparse what the data source evaluates exactly */
+	RelOptInfo* innerrel;     /* the other table of a join, if deparsing one */
+	OgrFdwState* innerstate;  /* and its column names */
 } OgrDeparseCtx;
 
+/*
+ * Longest IN list written out in one piece. Longer ones are
+ * split into ORed (or for NOT IN, ANDed) lists, since the
+ * OGR SQL parser stacks up every item of a list.
+ */
+#define OGR_DEPARSE_IN_CHUNK 1000
+
+/* Longest IN list pushed down at all */
+#define OGR_DEPARSE_IN_MAX 50000
+
 /* Local function signatures */
 static bool ogrDeparseExpr(Expr* node, OgrDeparseCtx* context);
 // static void ogrDeparseOpExpr(OpExpr* node, OgrDeparseCtx *context);
@@ -133,9 +146,63 @@ ogrStringFromDatum(Datum datum, Oid type)
 	return result.data;
 }
 
+/*
+ * Can ogrStringFromDatum() write a value of this type as
+ * a literal, usable in a list (so no booleans)?
+ */
+static bool
+ogrTypeIsLiteral(Oid type)
+{
+	switch (type)
+	{
+	case TEXTOID:
+	case DATEOID:
+	case TIMESTAMPOID:
+	case TIMESTAMPTZOID:
+	case CHAROID:
+	case BPCHAROID:
+	case VARCHAROID:
+	case NAMEOID:
+	case INT8OID:
+	case INT2OID:
+	case INT4OID:
+	case OIDOID:
+	case FLOAT4OID:
+	case FLOAT8OID:
+	case NUMERICOID:
+		return true;
+	default:
+		return false;
+	}
+}
+
 static bool
 ogrDeparseConst(Const* constant, OgrDeparseCtx* context)
 {
+	/*
+	 * Exact SQL leaves out values whose text form depends on
+	 * settings (DateStyle) or that OGR SQL mangles (booleans).
+	 */
+	if (context->exact)
+	{
+		switch (constant->consttype)
+		{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+		case TEXTOID:
+		case VARCHAROID:
+			if (constant->constisnull)
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+
 	/* TODO: Can OGR do anythign w/ NULL? */
 	if (constant->constisnull)
 	{
@@ -201,11 +268,38 @@ ogrDeparseConst(Const* constant, OgrDeparseCtx* context)
 }
 
 
+/*
+ * Parameters of a prepared statement are written as $n
+ * placeholders, the n-th entry of the params list, and
+ * filled in by ogrDeparseFillParams() when the scan starts.
+ * A parameter of array type stands for its list of values.
+ */
 static bool
 ogrDeparseParam(Param* node, OgrDeparseCtx* context)
 {
+	Oid type = node->paramtype;
+	Oid elemtype = get_element_type(type);
+
 	elog(DEBUG3, "got into ogrDeparseParam code");
+
+#if PG_VERSION_NUM >= 100000
+	/* The data source's own SQL is run as planned */
+	if (context->exact || !context->params_list)
+		return false;
+
+	/* Prepared statement parameters, and executor ones such as outer query columns */
+	if (node->paramkind != PARAM_EXTERN && node->paramkind != PARAM_EXEC)
+		return false;
+
+	if (!ogrTypeIsLiteral(OidIsValid(elemtype) ? elemtype : type))
+		return false;
+
+	*(context->params_list) = lappend(*(context->params_list), node);
+	appendStringInfo(context->buf, "$%d", list_length(*(context->params_list)));
+	return true;
+#else
 	return false;
+#endif
 }
 
 static bool
@@ -234,13 +328,34 @@ ogrIsLegalVarName(const char* varname)
 	return true;
 }
 
+/*
+ * State of the foreign table a Var belongs to, or NULL
+ * if it isn't one we are deparsing for.
+ */
+static OgrFdwState*
+ogrDeparseVarState(const Var* node, const OgrDeparseCtx* context)
+{
+	if (node->varlevelsup != 0)
+		return NULL;
+	if (node->varno == context->foreignrel->relid)
+		return context->state;
+	if (context->innerrel && node->varno == context->innerrel->relid)
+		return context->innerstate;
+	return NULL;
+}
+
 static bool
 ogrDeparseVarOgrColumn(const Var* node, const OgrDeparseCtx* context, OgrFdwColumn *col)
 {
 	/* Var belongs to foreign table */
 	int i;
-	OgrFdwTable* table = context->state->table;
+	OgrFdwState* state = ogrDeparseVarState(node, context);
+	OgrFdwTable* table;
+
+	if (!state)
+		return false;
 
+	table = state->table;
 	for (i = 0; i < table->ncols; i++)
 	{
 		if (table->cols[i].pgattnum == node->varattno)
@@ -256,11 +371,11 @@ static const char *
 ogrDeparseVarName(const Var* node, const OgrDeparseCtx* context)
 {
 	/* Var belongs to foreign table */
-	OGRLayerH lyr = context->state->ogr.lyr;
 	OgrFdwColumn col;
 
 	if (ogrDeparseVarOgrColumn(node, context, &col))
 	{
+		OGRLayerH lyr = ogrDeparseVarState(node, context)->ogr.lyr;
 		const char* fldname = NULL;
 		if (col.ogrvariant == OGR_FID)
 		{
@@ -283,21 +398,109 @@ ogrDeparseVarName(const Var* node, const OgrDeparseCtx* context)
 	return NULL;
 }
 
+/*
+ * Does the OGR field hold the same kind of value as the
+ * column it is read into? Numbers into numbers, strings
+ * into strings; anything else is left alone. Reals are
+ * not exact numerics, so don't match numeric columns.
+ */
+static bool
+ogrFieldTypeMatches(const OgrFdwColumn* col)
+{
+	switch (col->pgtype)
+	{
+	case NUMERICOID:
+#if GDAL_VERSION_MAJOR >= 2
+		return col->ogrfldtype == OFTInteger || col->ogrfldtype == OFTInteger64;
+#else
+		return col->ogrfldtype == OFTInteger;
+#endif
+	case INT2OID:
+	case INT4OID:
+	case INT8OID:
+	case FLOAT4OID:
+	case FLOAT8OID:
+#if GDAL_VERSION_MAJOR >= 2
+		return col->ogrfldtype == OFTInteger || col->ogrfldtype == OFTInteger64 || col->ogrfldtype == OFTReal;
+#else
+		return col->ogrfldtype == OFTInteger || col->ogrfldtype == OFTReal;
+#endif
+	case TEXTOID:
+	case VARCHAROID:
+		return col->ogrfldtype == OFTString;
+	default:
+		return true;
+	}
+}
+
+/*
+ * Append a double-quoted SQL identifier.
+ */
+static void
+ogrDeparseIdentifier(StringInfo buf, const char* name)
+{
+	const char* p;
+
+	appendStringInfoChar(buf, '"');
+	for (p = name; *p; p++)
+	{
+		if (*p == '"')
+			appendStringInfoChar(buf, '"');
+		appendStringInfoChar(buf, *p);
+	}
+	appendStringInfoChar(buf, '"');
+}
+
+/*
+ * Append a quoted column name, qualified by its table
+ * alias when deparsing a join.
+ */
+static void
+ogrDeparseColumnRef(StringInfo buf, const Var* node, const OgrDeparseCtx* context, const char* name)
+{
+	if (context->innerrel)
+		appendStringInfo(buf, "r%d.", (int) node->varno);
+	ogrDeparseIdentifier(buf, name);
+}
+
 static bool
 ogrDeparseVar(const Var* node, OgrDeparseCtx* context)
 {
 	StringInfoData* buf = context->buf;
+	OgrFdwState* state = ogrDeparseVarState(node, context);
 
 	/* varno must not be any of OUTER_VAR, INNER_VAR and INDEX_VAR. */
 	Assert(!IS_SPECIAL_VARNO(node->varno));
 
-	if (node->varno == context->foreignrel->relid && node->varlevelsup == 0)
+	if (state)
 	{
 		const char* fldname = ogrDeparseVarName(node, context);
 
 		if (fldname)
 		{
-			if (ogrIsLegalVarName(fldname))
+			if (context->exact)
+			{
+				OgrFdwColumn col;
+
+				if (!ogrDeparseVarOgrColumn(node, context, &col))
+					return false;
+
+				/* Without a named FID column, there is nothing to refer to */
+				if (col.ogrvariant == OGR_FID)
+				{
+					const char* fidcol = OGR_L_GetFIDColumn(state->ogr.lyr);
+					if (!fidcol || !*fidcol)
+						return false;
+				}
+
+				/* Values the FDW converts on the way in compare differently at the source */
+				if (col.ogrvariant == OGR_FIELD && !ogrFieldTypeMatches(&col))
+					return false;
+
+				/* Quote everything, so case-folding SQL engines keep the name */
+				ogrDeparseColumnRef(buf, node, context, fldname);
+			}
+			else if (ogrIsLegalVarName(fldname))
 			{
 				appendStringInfoString(buf, fldname);
 			}
@@ -311,9 +514,22 @@ ogrDeparseVar(const Var* node, OgrDeparseCtx* context)
 			return false;
 		}
 	}
+#if PG_VERSION_NUM >= 100000
+	else if (!context->exact && context->params_list && node->varlevelsup == 0 &&
+	         ogrTypeIsLiteral(node->vartype))
+	{
+		/*
+		 * A column of the outer side of a parameterized scan,
+		 * which becomes a nestloop parameter and is filled in
+		 * with the value of each outer row
+		 */
+		*(context->params_list) = lappend(*(context->params_list), (Var*) node);
+		appendStringInfo(buf, "$%d", list_length(*(context->params_list)));
+	}
+#endif
 	else
 	{
-		elog(ERROR, "got to param handling section of ogrDeparseVar");
+		/* Other tables (and outer queries) aren't in the data source's query */
 		return false;
 	}
 
@@ -338,48 +554,180 @@ ogrOperatorIsSupported(const char* opname)
 	return NULL != bsearch(&opname, ogrOperators, 10, sizeof(char*), ogrOperatorCmpFunc);
 }
 
-static bool ogrDeparseOpExprSpatial(OpExpr* node, OgrDeparseCtx* context)
+/*
+ * Share of the extent of its geometry field that a spatial
+ * filter passes, or one when the layer can't say cheaply.
+ */
+static double
+ogrDeparseSpatialSelectivity(const OgrFdwSpatialFilter* sf, OGRLayerH lyr)
+{
+	OGREnvelope ext;
+	OGRErr err;
+	double w, h, area;
+
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+	err = OGR_L_GetExtentEx(lyr, sf->ogrfldnum, &ext, FALSE);
+#else
+	err = OGR_L_GetExtent(lyr, &ext, FALSE);
+#endif
+	if (err != OGRERR_NONE)
+		return 1.0;
+
+	w = Min(sf->maxx, ext.MaxX) - Max(sf->minx, ext.MinX);
+	h = Min(sf->maxy, ext.MaxY) - Max(sf->miny, ext.MinY);
+	if (w < 0 || h < 0)
+		return 0.0;
+
+	area = (ext.MaxX - ext.MinX) * (ext.MaxY - ext.MinY);
+	if (area <= 0)
+		return 1.0;
+
+	return Min(w * h / area, 1.0);
+}
+
+/*
+ * Add a spatial filter to the ones already found. A row has
+ * to pass every spatial test of the clauses, so filters on
+ * the same geometry field narrow down to the intersection
+ * of their boxes, keeping the geometry of an exact filter
+ * that lies inside the other box. Only one field can be
+ * filtered on: of filters on different fields the one that
+ * passes the least of its field's extent wins. A filter from
+ * a parameter changes with every outer row, and it is why
+ * a parameterized scan is there, so it wins over constants.
+ */
+static void
+ogrDeparseAddSpatialFilter(OgrFdwSpatialFilter* sf, OGRLayerH lyr, OgrDeparseCtx* context)
+{
+	OgrFdwSpatialFilter* prev = context->spatial_filter;
+	OgrFdwSpatialFilter* both;
+
+	if (!prev)
+	{
+		context->spatial_filter = sf;
+		return;
+	}
+
+	if (prev->param || sf->param)
+	{
+		if (!prev->param)
+			context->spatial_filter = sf;
+		return;
+	}
+
+	if (prev->ogrfldnum != sf->ogrfldnum)
+	{
+		if (ogrDeparseSpatialSelectivity(sf, lyr) < ogrDeparseSpatialSelectivity(prev, lyr))
+			context->spatial_filter = sf;
+		return;
+	}
+
+	both = palloc0(sizeof(OgrFdwSpatialFilter));
+	both->ogrfldnum = sf->ogrfldnum;
+	both->colname = sf->colname;
+	both->minx = Max(prev->minx, sf->minx);
+	both->miny = Max(prev->miny, sf->miny);
+	both->maxx = Min(prev->maxx, sf->maxx);
+	both->maxy = Min(prev->maxy, sf->maxy);
+
+	/* Boxes that don't meet pass no rows, the tests will see to that */
+	if (both->minx > both->maxx || both->miny > both->maxy)
+		return;
+
+	if (prev->hexwkb && both->minx == prev->minx && both->miny == prev->miny &&
+	    both->maxx == prev->maxx && both->maxy == prev->maxy)
+		both->hexwkb = prev->hexwkb;
+	else if (sf->hexwkb && both->minx == sf->minx && both->miny == sf->miny &&
+	         both->maxx == sf->maxx && both->maxy == sf->maxy)
+		both->hexwkb = sf->hexwkb;
+
+	context->spatial_filter = both;
+}
+
+/*
+ * Set the spatial filter for a spatial test between a
+ * geometry column of the table and a geometry constant.
+ * Features further than the distance from the constant
+ * fail the test. With exact set, passing features must
+ * also intersect the constant itself, so the filter is
+ * the geometry rather than its (expanded) envelope.
+ *
+ * A parameter, or a column of the outer side of a
+ * parameterized scan, works as the constant too, with
+ * the filter set from its value as the scan (re)starts.
+ *
+ * Returns false: the test itself always stays for the
+ * local filter.
+ */
+static bool
+ogrDeparseSpatialFilter(Expr* r_arg, Expr* l_arg, double distance, bool exact, OgrDeparseCtx* context)
 {
-	Expr* r_arg = lfirst(list_head(node->args));
-	Expr* l_arg = lfirst(list_tail(node->args));
 	Expr* exprconst = NULL;
 	Const* constant = NULL;
 	Var* var = NULL;
 	OgrFdwColumn col;
+	OgrFdwSpatialFilter* sf;
 	OGRLayerH lyr;
 	OGRFeatureDefnH fdh;
 	OGRGeomFieldDefnH gfdh;
 	OGRGeometryH geom;
+	OGRCoordinateTransformationH ct;
 	OGREnvelope env;
 	OGRErr err;
 	const char* fldname;
+	int srid;
 
-	elog(DEBUG4, "%s:%d entered ogrDeparseOpExprSpatial", __FILE__, __LINE__);
+	elog(DEBUG4, "%s:%d entered ogrDeparseSpatialFilter", __FILE__, __LINE__);
 
 	/* We need a Geometry T_Const on one side and a T_Var */
 	/* column on the other side that is from the FDW relation */
 	/* Both of those implies and OGR spatial filter can be reasonably */
 	/* set. */
-	if (nodeTag(l_arg) == T_Var)
+	if (nodeTag(l_arg) == T_Var && ogrDeparseVarState((Var*)l_arg, context))
 	{
 		var = (Var*)l_arg;
 		exprconst = r_arg;
 	}
-	else if (nodeTag(r_arg) == T_Var)
+	else if (nodeTag(r_arg) == T_Var && ogrDeparseVarState((Var*)r_arg, context))
 	{
 		var = (Var*)r_arg;
 		exprconst = l_arg;
 	}
 	else return false;
 
+	if (exprType((Node*)exprconst) != ogrGetGeometryOid())
+		return false;
+
 	if (nodeTag(exprconst) == T_Const)
 	{
 		constant = (Const*)exprconst;
 	}
+#if PG_VERSION_NUM >= 100000
+	else if (!context->exact && context->params_list &&
+	         ((nodeTag(exprconst) == T_Param &&
+	           (((Param*)exprconst)->paramkind == PARAM_EXTERN || ((Param*)exprconst)->paramkind == PARAM_EXEC)) ||
+	          (nodeTag(exprconst) == T_Var && ((Var*)exprconst)->varlevelsup == 0 &&
+	           !ogrDeparseVarState((Var*)exprconst, context))))
+	{
+		/* Filled in from the parameter value as the scan runs */
+		if (!ogrDeparseVarOgrColumn(var, context, &col) || col.ogrvariant != OGR_GEOMETRY)
+			return false;
+
+		*(context->params_list) = lappend(*(context->params_list), exprconst);
+		sf = palloc0(sizeof(OgrFdwSpatialFilter));
+		sf->ogrfldnum = col.ogrfldnum;
+		sf->colname = col.pgname;
+		sf->param = list_length(*(context->params_list));
+		sf->distance = distance;
+		sf->exact = exact;
+		ogrDeparseAddSpatialFilter(sf, ogrDeparseVarState(var, context)->ogr.lyr, context);
+		return false;
+	}
+#endif
 	else return false;
 
 	/* Const isn't a geometry type? Done. */
-	if (constant->consttype != ogrGetGeometryOid() || constant->constisnull || constant->constbyval)
+	if (constant->constisnull || constant->constbyval)
 		return false;
 
 	/* Var doesn't match an OGR field? Done. */
@@ -390,31 +738,153 @@ static bool ogrDeparseOpExprSpatial(OpExpr* node, OgrDeparseCtx* context)
 	if (col.ogrvariant != OGR_GEOMETRY)
 		return false;
 
-	lyr = context->state->ogr.lyr;
+	lyr = ogrDeparseVarState(var, context)->ogr.lyr;
 	fdh = OGR_L_GetLayerDefn(lyr);
 	gfdh = OGR_FD_GetGeomFieldDefn(fdh, col.ogrfldnum);
 	fldname = OGR_GFld_GetNameRef(gfdh);
 	elog(DEBUG4, "%s:%d geometry fieldname '%s'", __FILE__, __LINE__, fldname);
 
-	err = pgDatumToOgrGeometry (constant->constvalue, col.pgsendfunc, &geom);
+	err = pgDatumToOgrGeometrySrid (constant->constvalue, col.pgsendfunc, &geom, &srid);
 	if (err != OGRERR_NONE)
 		return false;
 
 	elog(DEBUG4, "%s:%d geometry constant is %s", __FILE__, __LINE__, OGR_G_ExportToJson(geom));
 
+	/* A constant in another coordinate system needs its box transformed */
+	if (!ogrSridTransform(srid, lyr, col.ogrfldnum, &ct))
+	{
+		elog(DEBUG2, "%s: no transformation from SRID %d to the layer", __func__, srid);
+		OGR_G_DestroyGeometry(geom);
+		return false;
+	}
+
 	OGR_G_GetEnvelope(geom, &env);
+	env.MinX -= distance;
+	env.MaxX += distance;
+	env.MinY -= distance;
+	env.MaxY += distance;
+
+	if (ct && !ogrTransformEnvelope(ct, &env))
+	{
+		elog(DEBUG2, "%s: spatial filter does not transform from SRID %d to the layer", __func__, srid);
+		OCTDestroyCoordinateTransformation(ct);
+		OGR_G_DestroyGeometry(geom);
+		return false;
+	}
+
+	sf = palloc0(sizeof(OgrFdwSpatialFilter));
+	sf->minx = env.MinX;
+	sf->maxx = env.MaxX;
+	sf->miny = env.MinY;
+	sf->maxy = env.MaxY;
+	sf->ogrfldnum = col.ogrfldnum;
+	sf->colname = col.pgname;
+
+	/*
+	 * Drivers test the features against the geometry itself, where
+	 * they can. A transformed geometry only approximates the edges,
+	 * so the box of a transformed one is as exact as is safe.
+	 */
+	if (ct)
+	{
+		OCTDestroyCoordinateTransformation(ct);
+	}
+	else if (exact && !OGR_G_IsEmpty(geom))
+	{
+		int wkbsize = OGR_G_WkbSize(geom);
+		unsigned char* wkb = palloc(wkbsize);
+
+		if (OGR_G_ExportToWkb(geom, wkbNDR, wkb) == OGRERR_NONE)
+		{
+			char* hex = CPLBinaryToHex(wkbsize, wkb);
+			sf->hexwkb = pstrdup(hex);
+			CPLFree(hex);
+		}
+		pfree(wkb);
+	}
 	OGR_G_DestroyGeometry(geom);
-	context->spatial_filter = palloc(sizeof(OgrFdwSpatialFilter));
-	context->spatial_filter->minx = env.MinX;
-	context->spatial_filter->maxx = env.MaxX;
-	context->spatial_filter->miny = env.MinY;
-	context->spatial_filter->maxy = env.MaxY;
-	context->spatial_filter->ogrfldnum = col.ogrfldnum;
 
 	elog(DEBUG4, "%s:%d OGR spatial filter is (%f %f, %f %f)",
 	             __FILE__, __LINE__,
-	             env.MinX, env.MinY, env.MaxX, env.MaxY);
+	             sf->minx, sf->miny, sf->maxx, sf->maxy);
+
+	ogrDeparseAddSpatialFilter(sf, lyr, context);
+	return false;
+}
+
+static bool ogrDeparseOpExprSpatial(OpExpr* node, OgrDeparseCtx* context)
+{
+	Expr* r_arg = lfirst(list_head(node->args));
+	Expr* l_arg = lfirst(list_tail(node->args));
+
+	elog(DEBUG4, "%s:%d entered ogrDeparseOpExprSpatial", __FILE__, __LINE__);
+
+	return ogrDeparseSpatialFilter(r_arg, l_arg, 0.0, false, context);
+}
+
+/*
+ * PostGIS spatial tests that a feature can only pass by
+ * intersecting the other geometry (or, for ST_DWithin, by
+ * coming within the distance of it) give a spatial filter,
+ * like the && operator. The underscored forms are what
+ * older PostGIS versions inline these functions into.
+ */
+static bool
+ogrDeparseFuncExprSpatial(FuncExpr* node, OgrDeparseCtx* context)
+{
+	static const char* ogrSpatialTests[] = {
+		"st_contains", "st_coveredby", "st_covers", "st_intersects", "st_within",
+		"_st_contains", "_st_coveredby", "_st_covers", "_st_intersects", "_st_within",
+		NULL
+	};
+	char* funcname = get_func_name(node->funcid);
+	int nargs = list_length(node->args);
+	Oid extoid;
+	Expr* arg1;
+	Expr* arg2;
+	int i;
+
+	if (!funcname || nargs < 2 || context->exact)
+		return false;
+
+	/* Only PostGIS functions, not others of the same name */
+	extoid = get_extension_oid("postgis", true);
+	if (!OidIsValid(extoid) || getExtensionOfObject(ProcedureRelationId, node->funcid) != extoid)
+	{
+		elog(DEBUG2, "unsupported OGR FDW function, %s", funcname);
+		return false;
+	}
 
+	arg1 = linitial(node->args);
+	arg2 = lsecond(node->args);
+	if (exprType((Node*) arg1) != ogrGetGeometryOid() ||
+	    exprType((Node*) arg2) != ogrGetGeometryOid())
+	{
+		elog(DEBUG2, "unsupported OGR FDW function, %s", funcname);
+		return false;
+	}
+
+	if (nargs == 2)
+	{
+		for (i = 0; ogrSpatialTests[i]; i++)
+		{
+			if (streq(funcname, ogrSpatialTests[i]))
+				return ogrDeparseSpatialFilter(arg1, arg2, 0.0, true, context);
+		}
+	}
+	else if (nargs == 3 && (streq(funcname, "st_dwithin") || streq(funcname, "_st_dwithin")))
+	{
+		Const* dist = (Const*) lthird(node->args);
+
+		if (!IsA(dist, Const) || dist->constisnull || dist->consttype != FLOAT8OID)
+			return false;
+		if (DatumGetFloat8(dist->constvalue) < 0)
+			return false;
+
+		return ogrDeparseSpatialFilter(arg1, arg2, DatumGetFloat8(dist->constvalue), false, context);
+	}
+
+	elog(DEBUG2, "unsupported OGR FDW function, %s", funcname);
 	return false;
 }
 
@@ -446,6 +916,31 @@ ogrDeparseOpExpr(OpExpr* node, OgrDeparseCtx* context)
 		return false;
 	}
 
+	/*
+	 * Exact SQL has no bounding box filters or case-insensitive
+	 * LIKE, and only compares strings for equality, since the
+	 * data source orders them by its own collation.
+	 */
+	if (context->exact)
+	{
+		bool ordering = !(streq(opname, "=") || streq(opname, "<>") || streq(opname, "!="));
+		bool strings = false;
+
+		foreach (arg, node->args)
+		{
+			Oid argtype = exprType((Node*) lfirst(arg));
+			if (argtype == TEXTOID || argtype == VARCHAROID)
+				strings = true;
+		}
+
+		if (streq(opname, "&&") || streq(opname, "~~") || streq(opname, "~~*") ||
+		    (strings && ordering))
+		{
+			ReleaseSysCache(tuple);
+			return false;
+		}
+	}
+
 	/* Overlaps operator is special case: if one side is a */
 	/* constant (T_Const), and the other is a table column (T_Var), */
 	/* then we can pass it as a spatial filter to OGR */
@@ -511,6 +1006,7 @@ ogrDeparseBoolExpr(BoolExpr* node, OgrDeparseCtx* context)
 	int boolop = node->boolop;
 	int result_total = 0;
 	StringInfo buf = context->buf;
+	OgrFdwSpatialFilter* spatial_filter_save;
 
 	switch (boolop)
 	{
@@ -527,6 +1023,7 @@ ogrDeparseBoolExpr(BoolExpr* node, OgrDeparseCtx* context)
 	}
 
 	len_save_all = buf->len;
+	spatial_filter_save = context->spatial_filter;
 
 	appendStringInfoChar(buf, '(');
 	foreach (lc, node->args)
@@ -544,6 +1041,13 @@ ogrDeparseBoolExpr(BoolExpr* node, OgrDeparseCtx* context)
 		result = ogrDeparseExpr((Expr*) lfirst(lc), context);
 		result_total += result;
 
+		/* Exact SQL can't leave out any term */
+		if (context->exact && ! result)
+		{
+			setStringInfoLength(buf, len_save_all);
+			return false;
+		}
+
 		/* We can backtrack just this term for AND expressions */
 		if (boolop == AND_EXPR && ! result)
 		{
@@ -570,47 +1074,190 @@ ogrDeparseBoolExpr(BoolExpr* node, OgrDeparseCtx* context)
 		setStringInfoLength(buf, len_save_all);
 	}
 
+	/* Rows passing another term of an OR needn't pass a spatial test in it */
+	if (boolop == OR_EXPR)
+		context->spatial_filter = spatial_filter_save;
+
 	return result_total > 0;
 }
 
 
+/*
+ * Write "col IN (...)" for "col = ANY(array)" and "col NOT IN
+ * (...)" for "col <> ALL(array)", where the array is a constant,
+ * an ARRAY[] of constants and parameters, or an array parameter.
+ * Long lists go out in pieces.
+ */
 static bool
-ogrDeparseRelabelType(RelabelType* node, OgrDeparseCtx* context)
+ogrDeparseScalarArrayOpExpr(ScalarArrayOpExpr* node, OgrDeparseCtx* context)
 {
-	if (node->relabelformat != COERCE_IMPLICIT_CAST)
-	{
-		elog(WARNING, "Received a non-implicit relabel expression but did not handle it");
-	}
+	StringInfo buf = context->buf;
+	Expr* arg1 = linitial(node->args);
+	Expr* arg2 = lsecond(node->args);
+	char* opname = get_opname(node->opno);
+	const char* listop;
+	List* elems = NIL;
+	int nelems, i;
+
+	if (!opname)
+		return false;
 
-	return ogrDeparseExpr(node->arg, context);
-}
+	if (streq(opname, "=") && node->useOr)
+		listop = "IN";
+	else if ((streq(opname, "<>") || streq(opname, "!=")) && !node->useOr)
+		listop = "NOT IN";
+	else
+		return false;
 
-static bool
-ogrDeparseNullTest(NullTest* node, OgrDeparseCtx* context)
-{
-	StringInfo buf = context->buf;
-	/* Only push down simple "col IS NULL" tests */
-	if (nodeTag(node->arg) != T_Var)
+	/* Only columns of the table against lists of values */
+	if (IsA(arg1, RelabelType))
+		arg1 = ((RelabelType*) arg1)->arg;
+	if (!IsA(arg1, Var) || !ogrDeparseVarState((Var*) arg1, context))
 		return false;
 
-	appendStringInfoString(buf, "(");
-	if(!ogrDeparseVar((Var*)(node->arg), context))
-	{
-		stringInfoReverse(buf, 1);
+	/* Exact SQL only compares strings for equality, like in ogrDeparseOpExpr */
+	if (context->exact && (exprType((Node*) arg1) == BPCHAROID))
 		return false;
-	}
 
-	if (node->nulltesttype == IS_NULL)
-	{
-		appendStringInfoString(buf, " IS NULL)");
-	}
-	else
+	if (IsA(arg2, Const))
 	{
-		appendStringInfoString(buf, " IS NOT NULL)");
-	}
+		Const* c = (Const*) arg2;
+		ArrayType* arr;
+		Oid elemtype;
+		int16 elmlen;
+		bool elmbyval;
+		char elmalign;
+		Datum* values;
+		bool* nulls;
+		int nvalues;
+
+		if (c->constisnull)
+			return false;
 
-	return true;
-}
+		arr = DatumGetArrayTypeP(c->constvalue);
+		elemtype = ARR_ELEMTYPE(arr);
+		if (!ogrTypeIsLiteral(elemtype))
+			return false;
+
+		get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+		deconstruct_array(arr, elemtype, elmlen, elmbyval, elmalign, &values, &nulls, &nvalues);
+
+		/*
+		 * NULL items never match, so leaving them out of an IN
+		 * list only turns NULL results into false ones, which a
+		 * WHERE clause treats the same. A NOT IN with them matches
+		 * nothing, and without them would match rows, so it isn't
+		 * sent, and neither is any list with NULLs in exact SQL,
+		 * where the data source's NULL handling can't be trusted.
+		 */
+		for (i = 0; i < nvalues; i++)
+		{
+			if (nulls[i] && (!node->useOr || context->exact))
+				return false;
+			if (!nulls[i])
+				elems = lappend(elems, makeConst(elemtype, -1, c->constcollid, elmlen, values[i], false, elmbyval));
+		}
+	}
+	else if (IsA(arg2, ArrayExpr))
+	{
+		elems = ((ArrayExpr*) arg2)->elements;
+	}
+	else if (IsA(arg2, Param))
+	{
+		/* Filled in with the list of values when the scan starts */
+		appendStringInfoChar(buf, '(');
+		if (!ogrDeparseVar((Var*) arg1, context))
+			return false;
+		appendStringInfo(buf, " %s (", listop);
+		if (!ogrDeparseParam((Param*) arg2, context))
+			return false;
+		appendStringInfoString(buf, "))");
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+
+	nelems = list_length(elems);
+	if (nelems == 0 || nelems > OGR_DEPARSE_IN_MAX)
+		return false;
+
+	if (nelems > OGR_DEPARSE_IN_CHUNK)
+		appendStringInfoChar(buf, '(');
+
+	for (i = 0; i < nelems; i++)
+	{
+		Expr* elem = list_nth(elems, i);
+
+		if (i % OGR_DEPARSE_IN_CHUNK == 0)
+		{
+			if (i > 0)
+				appendStringInfo(buf, ") %s ", node->useOr ? "OR" : "AND");
+			appendStringInfoChar(buf, '(');
+			if (!ogrDeparseVar((Var*) arg1, context))
+				return false;
+			appendStringInfo(buf, " %s (", listop);
+		}
+		else
+		{
+			appendStringInfoString(buf, ", ");
+		}
+
+		/* Scalar values only, which ARRAY[] can't promise */
+		if (!(IsA(elem, Const) && !((Const*) elem)->constisnull &&
+		      ogrTypeIsLiteral(((Const*) elem)->consttype)) &&
+		    !(IsA(elem, Param) && !OidIsValid(get_element_type(((Param*) elem)->paramtype))))
+			return false;
+
+		if (!ogrDeparseExpr(elem, context))
+			return false;
+	}
+	appendStringInfoString(buf, "))");
+
+	if (nelems > OGR_DEPARSE_IN_CHUNK)
+		appendStringInfoChar(buf, ')');
+
+	return true;
+}
+
+static bool
+ogrDeparseRelabelType(RelabelType* node, OgrDeparseCtx* context)
+{
+	if (node->relabelformat != COERCE_IMPLICIT_CAST)
+	{
+		elog(WARNING, "Received a non-implicit relabel expression but did not handle it");
+	}
+
+	return ogrDeparseExpr(node->arg, context);
+}
+
+static bool
+ogrDeparseNullTest(NullTest* node, OgrDeparseCtx* context)
+{
+	StringInfo buf = context->buf;
+	/* Only push down simple "col IS NULL" tests */
+	if (nodeTag(node->arg) != T_Var)
+		return false;
+
+	appendStringInfoString(buf, "(");
+	if(!ogrDeparseVar((Var*)(node->arg), context))
+	{
+		stringInfoReverse(buf, 1);
+		return false;
+	}
+
+	if (node->nulltesttype == IS_NULL)
+	{
+		appendStringInfoString(buf, " IS NULL)");
+	}
+	else
+	{
+		appendStringInfoString(buf, " IS NOT NULL)");
+	}
+
+	return true;
+}
 
 static bool
 ogrDeparseExpr(Expr* node, OgrDeparseCtx* context)
@@ -639,9 +1286,8 @@ ogrDeparseExpr(Expr* node, OgrDeparseCtx* context)
 	case T_RelabelType:
 		return ogrDeparseRelabelType((RelabelType*) node, context);
 	case T_ScalarArrayOpExpr:
-		/* TODO: Handle this to support the "IN" operator */
-		elog(DEBUG2, "unsupported OGR FDW expression type, T_ScalarArrayOpExpr");
-		return false;
+		/* Handle "IN" and "NOT IN" lists */
+		return ogrDeparseScalarArrayOpExpr((ScalarArrayOpExpr*) node, context);
 #if PG_VERSION_NUM < 120000
 	case T_ArrayRef:
 		elog(DEBUG2, "unsupported OGR FDW expression type, T_ArrayRef");
@@ -655,8 +1301,8 @@ ogrDeparseExpr(Expr* node, OgrDeparseCtx* context)
 		elog(DEBUG2, "unsupported OGR FDW expression type, T_ArrayExpr");
 		return false;
 	case T_FuncExpr:
-		elog(DEBUG2, "unsupported OGR FDW expression type, T_FuncExpr");
-		return false;
+		/* Only spatial tests, which give a spatial filter */
+		return ogrDeparseFuncExprSpatial((FuncExpr*) node, context);
 	case T_DistinctExpr:
 		elog(DEBUG2, "unsupported OGR FDW expression type, T_DistinctExpr");
 		return false;
@@ -669,7 +1315,7 @@ ogrDeparseExpr(Expr* node, OgrDeparseCtx* context)
 
 
 bool
-ogrDeparse(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* exprs, OgrFdwState* state, List** params_list, OgrFdwSpatialFilter** sf)
+ogrDeparse(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* exprs, OgrFdwState* state, List** params_list, OgrFdwSpatialFilter** sf, int* batchparam)
 {
 	OgrDeparseCtx context;
 	ListCell* lc;
@@ -680,6 +1326,10 @@ ogrDeparse(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* expr
 	{
 		*params_list = NIL;
 	}
+	if (batchparam)
+	{
+		*batchparam = 0;
+	}
 
 	/* Set up context struct for recursion */
 	memset(&context, 0, sizeof(OgrDeparseCtx));
@@ -694,6 +1344,7 @@ ogrDeparse(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* expr
 	{
 		RestrictInfo* ri = (RestrictInfo*) lfirst(lc);
 		int len_save = buf->len;
+		int nparams_save = params_list ? list_length(*params_list) : 0;
 		bool result;
 
 		/* Connect expressions with "AND" and parenthesize each condition */
@@ -716,6 +1367,19 @@ ogrDeparse(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* expr
 		{
 			first = false;
 		}
+
+		/*
+		 * A whole clause "col IN ($n)" can be filled in with its
+		 * values a batch at a time, each row being in one batch
+		 */
+		if (result && batchparam && !*batchparam && params_list &&
+		    IsA(ri->clause, ScalarArrayOpExpr) &&
+		    ((ScalarArrayOpExpr*) ri->clause)->useOr &&
+		    IsA(lsecond(((ScalarArrayOpExpr*) ri->clause)->args), Param) &&
+		    list_length(*params_list) == nparams_save + 1)
+		{
+			*batchparam = list_length(*params_list);
+		}
 	}
 
 	if (context.spatial_filter)
@@ -724,6 +1388,566 @@ ogrDeparse(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* expr
 	return true;
 }
 
+/*
+ * Deparse every one of the clauses, ANDed together, for a
+ * data source's own SQL engine, which has to give the same
+ * result as PostgreSQL would. False if any clause can't be.
+ */
+static bool
+ogrDeparseExactClauses(List* exprs, OgrDeparseCtx* context)
+{
+	ListCell* lc;
+
+	foreach (lc, exprs)
+	{
+		RestrictInfo* ri = (RestrictInfo*) lfirst(lc);
+
+		if (lc != list_head(exprs))
+			appendStringInfoString(context->buf, " AND ");
+
+		if (!ogrDeparseExpr(ri->clause, context) || context->spatial_filter)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Aggregates that SQL engines compute the same way PostgreSQL
+ * does: count(), and min(), max() of numeric fields read into
+ * matching columns. sum() is taken for 32-bit integers, whose
+ * sums fit the 64-bit integers the engines add in, and for
+ * double precision. Sums of 64-bit integers overflow in SQLite
+ * and come back from PostgreSQL as numeric, which OGR reads as
+ * a real, and sums of reals are added in single precision here.
+ * avg() is only taken for reals, since PostgreSQL averages
+ * integers in numeric and the SQL engines in floating point.
+ */
+static bool
+ogrDeparseAggref(Aggref* agg, OgrDeparseCtx* context)
+{
+	StringInfo buf = context->buf;
+	OgrFdwColumn col;
+	Var* var;
+	char* fname;
+	bool integer, real;
+
+	if (agg->aggfilter || agg->aggdistinct || agg->aggorder ||
+	    agg->aggkind != AGGKIND_NORMAL || agg->aggsplit != AGGSPLIT_SIMPLE)
+		return false;
+
+	if (get_func_namespace(agg->aggfnoid) != PG_CATALOG_NAMESPACE)
+		return false;
+
+	fname = get_func_name(agg->aggfnoid);
+	if (!fname)
+		return false;
+
+	if (agg->aggstar)
+	{
+		if (!streq(fname, "count"))
+			return false;
+		appendStringInfoString(buf, "count(*)");
+		return true;
+	}
+
+	if (list_length(agg->args) != 1)
+		return false;
+
+	var = (Var*) ((TargetEntry*) linitial(agg->args))->expr;
+	if (!IsA(var, Var) || !ogrDeparseVarOgrColumn(var, context, &col))
+		return false;
+
+	integer = (var->vartype == INT2OID || var->vartype == INT4OID || var->vartype == INT8OID) &&
+#if GDAL_VERSION_MAJOR >= 2
+	          (col.ogrfldtype == OFTInteger || col.ogrfldtype == OFTInteger64);
+#else
+	          col.ogrfldtype == OFTInteger;
+#endif
+	real = (var->vartype == FLOAT4OID || var->vartype == FLOAT8OID) &&
+	       col.ogrfldtype == OFTReal;
+
+	if (col.ogrvariant != OGR_FIELD && !(col.ogrvariant == OGR_FID && streq(fname, "count")))
+		return false;
+
+	if (streq(fname, "count"))
+		; /* anything goes */
+	else if (streq(fname, "min") || streq(fname, "max"))
+	{
+		if (!integer && !real)
+			return false;
+	}
+	else if (streq(fname, "sum"))
+	{
+		if (!(integer && col.ogrfldtype == OFTInteger) &&
+		    !(real && var->vartype == FLOAT8OID))
+			return false;
+	}
+	else if (streq(fname, "avg"))
+	{
+		if (!real)
+			return false;
+	}
+	else
+		return false;
+
+	appendStringInfo(buf, "%s(", fname);
+	if (!ogrDeparseVar(var, context))
+		return false;
+	appendStringInfoChar(buf, ')');
+	return true;
+}
+
+/*
+ * The layer as a table name. PostgreSQL layers are named
+ * "schema.table", and need quoting part by part.
+ */
+static void
+ogrDeparseLayerName(StringInfo buf, OgrFdwState* state)
+{
+	const char* lyrname = OGR_L_GetName(state->ogr.lyr);
+	const char* drname = GDALGetDriverShortName(GDALGetDatasetDriver(state->ogr.ds));
+	const char* dot = strchr(lyrname, '.');
 
+	if (streq(drname, "PostgreSQL") && dot)
+	{
+		char* schema = pnstrdup(lyrname, dot - lyrname);
+		ogrDeparseIdentifier(buf, schema);
+		appendStringInfoChar(buf, '.');
+		ogrDeparseIdentifier(buf, dot + 1);
+		pfree(schema);
+	}
+	else
+	{
+		ogrDeparseIdentifier(buf, lyrname);
+	}
+}
 
+/*
+ * Deparse a grouped aggregate query over the layer, for the
+ * data source's own SQL engine: the target list (grouping
+ * columns and aggregates), the restriction clauses, and the
+ * grouping columns. Returns false if any part can't be
+ * computed exactly as PostgreSQL would.
+ */
+bool
+ogrDeparseAggregate(StringInfo buf, PlannerInfo* root, RelOptInfo* foreignrel, List* tlist, List* groupvars, List* exprs, OgrFdwState* state)
+{
+	OgrDeparseCtx context;
+	ListCell* lc;
 
+	memset(&context, 0, sizeof(OgrDeparseCtx));
+	context.buf = buf;
+	context.root = root;
+	context.foreignrel = foreignrel;
+	context.state = state;
+	context.exact = true;
+
+	appendStringInfoString(buf, "SELECT ");
+	foreach (lc, tlist)
+	{
+		TargetEntry* tle = (TargetEntry*) lfirst(lc);
+		Expr* expr = tle->expr;
+
+		if (lc != list_head(tlist))
+			appendStringInfoString(buf, ", ");
+
+		if (IsA(expr, Aggref))
+		{
+			if (!ogrDeparseAggref((Aggref*) expr, &context))
+				return false;
+		}
+		/* Blank-padded strings don't compare the same elsewhere */
+		else if (IsA(expr, Var) && ((Var*) expr)->vartype != BPCHAROID)
+		{
+			if (!ogrDeparseVar((Var*) expr, &context))
+				return false;
+		}
+		else
+		{
+			return false;
+		}
+
+		/* The executor finds each result field by name */
+		appendStringInfo(buf, " AS c%d", tle->resno);
+	}
+
+	appendStringInfoString(buf, " FROM ");
+	ogrDeparseLayerName(buf, state);
+
+	if (exprs)
+	{
+		appendStringInfoString(buf, " WHERE ");
+		if (!ogrDeparseExactClauses(exprs, &context))
+			return false;
+	}
+
+	foreach (lc, groupvars)
+	{
+		Var* var = (Var*) lfirst(lc);
+
+		appendStringInfoString(buf, lc == list_head(groupvars) ? " GROUP BY " : ", ");
+		if (var->vartype == BPCHAROID || !ogrDeparseVar(var, &context))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Deparse a join column for the select list. Geometry
+ * columns come back as geometries of the result layer,
+ * other fields are read back through the column type's
+ * input function, which list and binary fields don't
+ * survive.
+ */
+static bool
+ogrDeparseJoinColumn(Var* var, OgrDeparseCtx* context)
+{
+	OgrFdwColumn col;
+
+	if (!ogrDeparseVarOgrColumn(var, context, &col))
+		return false;
+
+	if (col.ogrvariant == OGR_GEOMETRY)
+	{
+		OGRLayerH lyr = ogrDeparseVarState(var, context)->ogr.lyr;
+		OGRGeomFieldDefnH gfdh = OGR_FD_GetGeomFieldDefn(OGR_L_GetLayerDefn(lyr), col.ogrfldnum);
+		const char* gname = gfdh ? OGR_GFld_GetNameRef(gfdh) : NULL;
+
+		if (!gname || !*gname)
+			return false;
+		ogrDeparseColumnRef(context->buf, var, context, gname);
+		return true;
+	}
+
+	if (col.ogrvariant == OGR_FIELD)
+	{
+		switch (col.ogrfldtype)
+		{
+		case OFTBinary:
+		case OFTIntegerList:
+		case OFTRealList:
+		case OFTStringList:
+#if GDAL_VERSION_MAJOR >= 2
+		case OFTInteger64List:
+#endif
+			return false;
+		default:
+			break;
+		}
+	}
+
+	return ogrDeparseVar(var, context);
+}
+
+/*
+ * Deparse an inner join of two layers of one data source,
+ * for its own SQL engine: the columns the join returns, the
+ * join clauses, and the restriction clauses of each table.
+ * Returns false if any part can't be computed exactly as
+ * PostgreSQL would.
+ */
+bool
+ogrDeparseJoin(StringInfo buf, PlannerInfo* root, RelOptInfo* outerrel, OgrFdwState* outerstate, RelOptInfo* innerrel, OgrFdwState* innerstate, List* tlist, List* joinclauses)
+{
+	OgrDeparseCtx context;
+	List* exprs;
+	ListCell* lc;
+
+	memset(&context, 0, sizeof(OgrDeparseCtx));
+	context.buf = buf;
+	context.root = root;
+	context.foreignrel = outerrel;
+	context.state = outerstate;
+	context.innerrel = innerrel;
+	context.innerstate = innerstate;
+	context.exact = true;
+
+	appendStringInfoString(buf, "SELECT ");
+
+	/* A join feeding only count(*) needs no columns, but SQL wants one */
+	if (!tlist)
+		appendStringInfoString(buf, "NULL");
+
+	foreach (lc, tlist)
+	{
+		TargetEntry* tle = (TargetEntry*) lfirst(lc);
+
+		if (lc != list_head(tlist))
+			appendStringInfoString(buf, ", ");
+
+		if (!IsA(tle->expr, Var) || !ogrDeparseJoinColumn((Var*) tle->expr, &context))
+			return false;
+
+		appendStringInfo(buf, " AS c%d", tle->resno);
+	}
+
+	appendStringInfoString(buf, " FROM ");
+	ogrDeparseLayerName(buf, outerstate);
+	appendStringInfo(buf, " r%d INNER JOIN ", (int) outerrel->relid);
+	ogrDeparseLayerName(buf, innerstate);
+	appendStringInfo(buf, " r%d ON ", (int) innerrel->relid);
+
+	if (!ogrDeparseExactClauses(joinclauses, &context))
+		return false;
+
+	exprs = list_concat(list_copy(outerrel->baserestrictinfo), innerrel->baserestrictinfo);
+	if (exprs)
+	{
+		appendStringInfoString(buf, " WHERE ");
+		if (!ogrDeparseExactClauses(exprs, &context))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Order the keys of a batched parameter by the comparison
+ * function of their type, to find the ones that are equal.
+ */
+static int
+ogrKeyDatumCmpFunc(const void* a, const void* b, void* arg)
+{
+	TypeCacheEntry* typentry = (TypeCacheEntry*) arg;
+
+	return DatumGetInt32(FunctionCall2Coll(&typentry->cmp_proc_finfo, typentry->typcollation,
+	                                       *(const Datum*) a, *(const Datum*) b));
+}
+
+/*
+ * Strings of the keys of a batched parameter, ordered so
+ * that keys OGR may take as equal (differing in case only)
+ * sit together, and go in the same batch.
+ */
+static int
+ogrKeyCmpFunc(const void* a, const void* b)
+{
+	const char* ka = *(const char* const*) a;
+	const char* kb = *(const char* const*) b;
+	int cmp = pg_strcasecmp(ka, kb);
+	return cmp ? cmp : strcmp(ka, kb);
+}
+
+/*
+ * Write the filter with one batch of keys standing in for
+ * the batch parameter. NULL if a value can't go in.
+ */
+static char*
+ogrDeparseFillBatch(const char* sql, int nparams, const Datum* values, const bool* nulls, const Oid* types,
+                    int batchparam, char** keys, int nkeys)
+{
+	StringInfoData buf;
+	const char* p = sql;
+	char quote = '\0';
+
+	initStringInfo(&buf);
+
+	while (*p)
+	{
+		char* end;
+		int n;
+
+		/* Literals and quoted names are copied as they are */
+		if (quote)
+		{
+			if (*p == quote)
+				quote = '\0';
+			appendStringInfoChar(&buf, *p++);
+			continue;
+		}
+		if (*p == '\'' || *p == '"')
+		{
+			quote = *p;
+			appendStringInfoChar(&buf, *p++);
+			continue;
+		}
+		if (*p != '$' || p[1] < '0' || p[1] > '9')
+		{
+			appendStringInfoChar(&buf, *p++);
+			continue;
+		}
+
+		n = (int) strtol(p + 1, &end, 10) - 1;
+		p = end;
+		if (n < 0 || n >= nparams)
+			elog(ERROR, "%s: unknown parameter $%d in \"%s\"", __func__, n + 1, sql);
+
+		if (n == batchparam - 1)
+		{
+			int i;
+			for (i = 0; i < nkeys; i++)
+			{
+				if (i > 0)
+					appendStringInfoString(&buf, ", ");
+				appendStringInfoString(&buf, keys[i]);
+			}
+			continue;
+		}
+
+		if (nulls[n])
+			return NULL;
+
+		if (OidIsValid(get_element_type(types[n])))
+		{
+			ArrayType* arr = DatumGetArrayTypeP(values[n]);
+			Oid elemtype = ARR_ELEMTYPE(arr);
+			int16 elmlen;
+			bool elmbyval;
+			char elmalign;
+			Datum* elems;
+			bool* elemnulls;
+			int nelems, i;
+			int nitems = 0;
+
+			get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+			deconstruct_array(arr, elemtype, elmlen, elmbyval, elmalign, &elems, &elemnulls, &nelems);
+
+			/* Too long to go in one piece, see OGR_DEPARSE_IN_CHUNK */
+			if (nelems > OGR_DEPARSE_IN_CHUNK)
+				return NULL;
+
+			/* NULL items are left out, as in ogrDeparseScalarArrayOpExpr() */
+			for (i = 0; i < nelems; i++)
+			{
+				char* str;
+
+				if (elemnulls[i])
+					continue;
+				str = ogrStringFromDatum(elems[i], elemtype);
+				if (!str)
+					return NULL;
+				if (nitems++ > 0)
+					appendStringInfoString(&buf, ", ");
+				appendStringInfoString(&buf, str);
+			}
+
+			if (nitems == 0)
+				return NULL;
+		}
+		else
+		{
+			char* str = ogrStringFromDatum(values[n], types[n]);
+			if (!str)
+				return NULL;
+			appendStringInfoString(&buf, str);
+		}
+	}
+
+	return buf.data;
+}
+
+/*
+ * Fill the parameter values into an attribute filter that
+ * ogrDeparse() wrote with $n placeholders. Array values
+ * become the list of their items. Returns NIL if a value
+ * can't go in (it is NULL, or an empty or very long list),
+ * in which case the scan goes without the filter.
+ *
+ * The array of the batch parameter (numbered from one, zero
+ * for none) can be any length: its distinct values are split
+ * into batches of up to batchsize, and the list returned has
+ * a filter for each batch, to be read one after the other.
+ */
+List*
+ogrDeparseFillParams(const char* sql, int nparams, const Datum* values, const bool* nulls, const Oid* types,
+                     int batchparam, int batchsize)
+{
+	char** keys = NULL;
+	int nkeys = 0;
+	List* filters = NIL;
+	int first, i;
+
+	if (batchparam > 0 && batchparam <= nparams)
+	{
+		ArrayType* arr;
+		Oid elemtype;
+		int16 elmlen;
+		bool elmbyval;
+		char elmalign;
+		TypeCacheEntry* typentry;
+		Datum* elems;
+		bool* elemnulls;
+		int nelems, nvalues;
+
+		if (nulls[batchparam - 1] || !OidIsValid(get_element_type(types[batchparam - 1])))
+			return NIL;
+
+		arr = DatumGetArrayTypeP(values[batchparam - 1]);
+		elemtype = ARR_ELEMTYPE(arr);
+		get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+		deconstruct_array(arr, elemtype, elmlen, elmbyval, elmalign, &elems, &elemnulls, &nelems);
+
+		/* NULL items are left out */
+		for (i = 0, nvalues = 0; i < nelems; i++)
+		{
+			if (!elemnulls[i])
+				elems[nvalues++] = elems[i];
+		}
+		if (nvalues == 0)
+			return NIL;
+
+		/*
+		 * Each value goes in once, or a feature matching it would
+		 * be read in more than one batch. Values are told apart
+		 * by their type, not their strings, which differ for
+		 * some equal values (0 and -0).
+		 */
+		typentry = lookup_type_cache(elemtype, TYPECACHE_CMP_PROC_FINFO);
+		if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid))
+			return NIL;
+
+		qsort_arg(elems, nvalues, sizeof(Datum), ogrKeyDatumCmpFunc, typentry);
+		for (i = 1, first = 1; i < nvalues; i++)
+		{
+			if (ogrKeyDatumCmpFunc(&elems[i], &elems[first - 1], typentry) != 0)
+				elems[first++] = elems[i];
+		}
+		nvalues = first;
+
+		keys = palloc(sizeof(char*) * nvalues);
+		for (i = 0; i < nvalues; i++)
+		{
+			keys[nkeys] = ogrStringFromDatum(elems[i], elemtype);
+			if (!keys[nkeys])
+				return NIL;
+			nkeys++;
+		}
+
+		qsort(keys, nkeys, sizeof(char*), ogrKeyCmpFunc);
+		for (i = 1, first = 1; i < nkeys; i++)
+		{
+			if (!streq(keys[i], keys[first - 1]))
+				keys[first++] = keys[i];
+		}
+		nkeys = first;
+
+		batchsize = Max(Min(batchsize, OGR_DEPARSE_IN_CHUNK), 1);
+	}
+	else
+	{
+		batchparam = 0;
+	}
+
+	/* Batches never split keys differing in case only, see ogrKeyCmpFunc() */
+	first = 0;
+	do
+	{
+		int last = batchparam ? Min(first + batchsize, nkeys) : 0;
+		char* filter;
+
+		while (last > 0 && last < nkeys && pg_strcasecmp(keys[last - 1], keys[last]) == 0)
+			last++;
+
+		filter = ogrDeparseFillBatch(sql, nparams, values, nulls, types,
+		                             batchparam, keys ? keys + first : NULL, last - first);
+		if (!filter)
+			return NIL;
+
+		filters = lappend(filters, filter);
+		first = last;
+	}
+	while (first < nkeys);
+
+	return filters;
+}
@@ -64,6 +64,8 @@
 #define GDALGetDriverShortName(dr) OGR_Dr_GetName(dr)
 #define GDALGetDatasetDriver(ds) OGR_DS_GetDriver(ds)
 #define GDALDatasetTestCapability(ds,cap) OGR_Dr_TestCapability(ds,cap)
+#define GDALDatasetExecuteSQL(ds,sql,geom,dialect) OGR_DS_ExecuteSQL(ds,sql,geom,dialect)
+#define GDALDatasetReleaseResultSet(ds,lyr) OGR_DS_ReleaseResultSet(ds,lyr)
 
 #endif /* GDAL 1 support */
 
@@ -0,0 +1,573 @@
+/*-------------------------------------------------------------------------
+ *
+ * ogr_fdw_reader.c
+ *		  foreign-data wrapper for GIS data access.
+ *
+ * Copyright (c) 2014-2015, Paul Ramsey <pramsey@cleverelephant.ca>
+ *
+ * Background reader: a thread that owns an OGR layer for the
+ * duration of a scan and reads features ahead of the backend
+ * into a bounded single-producer/single-consumer ring. The
+ * backend is woken through a pipe, so the reader can also be
+ * waited on from a WaitEventSet (asynchronous Append).
+ * The thread can also export the WKB of the geometries the
+ * scan reads, so the backend only builds datums from it.
+ *
+ * The thread only ever calls GDAL/OGR. It must not touch any
+ * PostgreSQL facility (memory contexts, elog, latches), so its
+ * errors are captured with a thread-local GDAL error handler
+ * and reported by the backend.
+ *-------------------------------------------------------------------------
+ */
+
+/*
+ * Local structures
+ */
+#include "ogr_fdw.h"
+
+#ifndef WIN32
+
+/*
+ * System
+ */
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "cpl_multiproc.h"
+#include "pgstat.h"
+#include "storage/latch.h"
+
+struct OgrFdwReader
+{
+	OGRLayerH lyr;
+	int size;                   /* ring slots */
+	OGRFeatureH* ring;
+	int nwkb;                   /* geometry fields exported to WKB */
+	int* wkbfields;
+	unsigned char** wkbring;    /* nwkb buffers per ring slot */
+	int* wkbsizes;
+	unsigned char** curwkb;     /* buffers of the feature last taken */
+	int* cursizes;
+	pg_atomic_uint64 head;      /* features produced, written by the thread */
+	pg_atomic_uint64 tail;      /* features consumed, written by the backend */
+	pg_atomic_uint32 stop;      /* backend asks the thread to finish */
+	pg_atomic_uint32 done;      /* thread has read its last feature */
+	pg_atomic_uint32 sleeping;  /* thread is waiting for ring space */
+	bool failed;                /* thread hit a GDAL error, see errmsg */
+	char errmsg[512];
+	CPLMutex* mutex;            /* only for sleeping on a full ring */
+	CPLCond* cond;
+	int pipefd[2];              /* wakes the backend when there is news */
+	CPLJoinableThread* thread;
+	bool running;
+	struct OgrFdwReader* next;  /* list of running readers */
+};
+
+/* Readers with a live thread, so backend exit can stop them */
+static OgrFdwReader* ogr_running_readers = NULL;
+
+/*
+ * Tell the backend something happened. The pipe is non-blocking,
+ * and a full pipe already means a wakeup is pending.
+ */
+static void
+ogrReaderWake(OgrFdwReader* reader)
+{
+	char c = 0;
+	if (write(reader->pipefd[1], &c, 1) < 0)
+	{
+		/* EAGAIN, the pipe is full, so a wakeup is pending anyway */
+	}
+}
+
+/*
+ * Export the geometries the scan wants from a feature into
+ * the WKB buffers of its ring slot. A geometry that fails to
+ * export is left to the backend, which reports the error.
+ */
+static void
+ogrReaderExportWkb(OgrFdwReader* reader, OGRFeatureH feat, uint64 slot)
+{
+	int i;
+
+	for (i = 0; i < reader->nwkb; i++)
+	{
+		unsigned char** wkb = &(reader->wkbring[slot * reader->nwkb + i]);
+		int* wkbsize = &(reader->wkbsizes[slot * reader->nwkb + i]);
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+		OGRGeometryH geom = OGR_F_GetGeomFieldRef(feat, reader->wkbfields[i]);
+#else
+		OGRGeometryH geom = OGR_F_GetGeometryRef(feat);
+#endif
+
+		*wkb = NULL;
+		*wkbsize = 0;
+		if (!geom)
+			continue;
+
+		*wkbsize = OGR_G_WkbSize(geom);
+		*wkb = VSIMalloc(*wkbsize);
+		if (*wkb && OGR_G_ExportToWkb(geom, wkbNDR, *wkb) != OGRERR_NONE)
+		{
+			VSIFree(*wkb);
+			*wkb = NULL;
+		}
+	}
+}
+
+static void
+ogrReaderFreeWkb(unsigned char** wkb, int nwkb)
+{
+	int i;
+	for (i = 0; i < nwkb; i++)
+	{
+		if (wkb[i])
+			VSIFree(wkb[i]);
+		wkb[i] = NULL;
+	}
+}
+
+static void
+ogrReaderThread(void* arg)
+{
+	OgrFdwReader* reader = (OgrFdwReader*) arg;
+
+	/* Never let GDAL errors reach the backend's elog() handler */
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+
+	while (!pg_atomic_read_u32(&(reader->stop)))
+	{
+		uint64 head = pg_atomic_read_u64(&(reader->head));
+		OGRFeatureH feat;
+
+		/* Ring full? Sleep until the backend takes something */
+		if (head - pg_atomic_read_u64(&(reader->tail)) >= (uint64) reader->size)
+		{
+			CPLAcquireMutex(reader->mutex, 1000.0);
+			pg_atomic_write_u32(&(reader->sleeping), 1);
+			pg_memory_barrier();
+			while (head - pg_atomic_read_u64(&(reader->tail)) >= (uint64) reader->size &&
+			       !pg_atomic_read_u32(&(reader->stop)))
+			{
+				CPLCondWait(reader->cond, reader->mutex);
+			}
+			pg_atomic_write_u32(&(reader->sleeping), 0);
+			CPLReleaseMutex(reader->mutex);
+			continue;
+		}
+
+		CPLErrorReset();
+		feat = OGR_L_GetNextFeature(reader->lyr);
+		if (!feat)
+		{
+			if (CPLGetLastErrorType() == CE_Failure || CPLGetLastErrorType() == CE_Fatal)
+			{
+				strlcpy(reader->errmsg, CPLGetLastErrorMsg(), sizeof(reader->errmsg));
+				reader->failed = true;
+			}
+			break;
+		}
+
+		reader->ring[head % reader->size] = feat;
+		ogrReaderExportWkb(reader, feat, head % reader->size);
+		pg_write_barrier();
+		pg_atomic_write_u64(&(reader->head), head + 1);
+		pg_memory_barrier();
+
+		/*
+		 * The backend only waits on an empty ring, so it only needs
+		 * waking when it had emptied the ring before this push.
+		 */
+		if (pg_atomic_read_u64(&(reader->tail)) == head)
+			ogrReaderWake(reader);
+	}
+
+	pg_write_barrier();
+	pg_atomic_write_u32(&(reader->done), 1);
+	ogrReaderWake(reader);
+
+	CPLPopErrorHandler();
+}
+
+/*
+ * Readers are torn down with the executor memory, which
+ * also covers scans that end in an error or cancel.
+ */
+static void
+ogrReaderCleanup(void* arg)
+{
+	ogrReaderStop((OgrFdwReader*) arg);
+}
+
+bool
+ogrReaderAvailable(void)
+{
+	return true;
+}
+
+/*
+ * Set up a reader of lyr with a ring of size features. The
+ * geometry fields in wkbfields are exported to WKB by the
+ * thread, see ogrReaderWkb().
+ */
+OgrFdwReader*
+ogrReaderCreate(OGRLayerH lyr, int size, const int* wkbfields, int nwkb)
+{
+	OgrFdwReader* reader = palloc0(sizeof(OgrFdwReader));
+	MemoryContextCallback* cb;
+
+	reader->lyr = lyr;
+	reader->size = Max(size, 1);
+	reader->ring = palloc0(sizeof(OGRFeatureH) * reader->size);
+	reader->nwkb = nwkb;
+	if (nwkb > 0)
+	{
+		reader->wkbfields = palloc(sizeof(int) * nwkb);
+		memcpy(reader->wkbfields, wkbfields, sizeof(int) * nwkb);
+		reader->wkbring = palloc0(sizeof(unsigned char*) * nwkb * reader->size);
+		reader->wkbsizes = palloc0(sizeof(int) * nwkb * reader->size);
+		reader->curwkb = palloc0(sizeof(unsigned char*) * nwkb);
+		reader->cursizes = palloc0(sizeof(int) * nwkb);
+	}
+	reader->pipefd[0] = reader->pipefd[1] = -1;
+	pg_atomic_init_u64(&(reader->head), 0);
+	pg_atomic_init_u64(&(reader->tail), 0);
+	pg_atomic_init_u32(&(reader->stop), 0);
+	pg_atomic_init_u32(&(reader->done), 0);
+	pg_atomic_init_u32(&(reader->sleeping), 0);
+
+	cb = palloc0(sizeof(MemoryContextCallback));
+	cb->func = ogrReaderCleanup;
+	cb->arg = reader;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, cb);
+
+	return reader;
+}
+
+/*
+ * Start reading from the current position of the layer.
+ */
+void
+ogrReaderStart(OgrFdwReader* reader)
+{
+	sigset_t all_signals, old_signals;
+
+	if (reader->running)
+		return;
+
+	if (pipe(reader->pipefd) != 0 ||
+	    fcntl(reader->pipefd[0], F_SETFL, O_NONBLOCK) != 0 ||
+	    fcntl(reader->pipefd[1], F_SETFL, O_NONBLOCK) != 0)
+	{
+		ereport(ERROR,
+		        (errcode(ERRCODE_FDW_ERROR),
+		         errmsg("could not create pipe for OGR reader: %m")));
+	}
+
+	pg_atomic_write_u64(&(reader->head), 0);
+	pg_atomic_write_u64(&(reader->tail), 0);
+	pg_atomic_write_u32(&(reader->stop), 0);
+	pg_atomic_write_u32(&(reader->done), 0);
+	pg_atomic_write_u32(&(reader->sleeping), 0);
+	reader->failed = false;
+	reader->errmsg[0] = '\0';
+
+	reader->mutex = CPLCreateMutex();
+	CPLReleaseMutex(reader->mutex); /* created locked */
+	reader->cond = CPLCreateCond();
+
+	/* Signals belong to the backend, so the thread starts with them all blocked */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	reader->thread = CPLCreateJoinableThread(ogrReaderThread, reader);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (!reader->thread)
+	{
+		close(reader->pipefd[0]);
+		close(reader->pipefd[1]);
+		reader->pipefd[0] = reader->pipefd[1] = -1;
+		CPLDestroyCond(reader->cond);
+		CPLDestroyMutex(reader->mutex);
+		ereport(ERROR,
+		        (errcode(ERRCODE_FDW_ERROR),
+		         errmsg("could not start OGR reader thread")));
+	}
+
+	reader->running = true;
+	reader->next = ogr_running_readers;
+	ogr_running_readers = reader;
+}
+
+/*
+ * Stop the thread, wait for it, and throw away anything it
+ * read that nobody consumed. Safe to call more than once.
+ */
+void
+ogrReaderStop(OgrFdwReader* reader)
+{
+	OgrFdwReader** prev;
+	uint64 i, head;
+
+	if (!reader->running)
+		return;
+
+	pg_atomic_write_u32(&(reader->stop), 1);
+	pg_memory_barrier();
+	CPLAcquireMutex(reader->mutex, 1000.0);
+	CPLCondSignal(reader->cond);
+	CPLReleaseMutex(reader->mutex);
+
+	/* The thread notices at its next feature boundary */
+	CPLJoinThread(reader->thread);
+	reader->thread = NULL;
+
+	pg_read_barrier();
+	head = pg_atomic_read_u64(&(reader->head));
+	for (i = pg_atomic_read_u64(&(reader->tail)); i < head; i++)
+	{
+		OGR_F_Destroy(reader->ring[i % reader->size]);
+		if (reader->nwkb > 0)
+			ogrReaderFreeWkb(&(reader->wkbring[(i % reader->size) * reader->nwkb]), reader->nwkb);
+	}
+	if (reader->nwkb > 0)
+		ogrReaderFreeWkb(reader->curwkb, reader->nwkb);
+
+	CPLDestroyCond(reader->cond);
+	CPLDestroyMutex(reader->mutex);
+	close(reader->pipefd[0]);
+	close(reader->pipefd[1]);
+	reader->pipefd[0] = reader->pipefd[1] = -1;
+	reader->running = false;
+
+	for (prev = &ogr_running_readers; *prev; prev = &((*prev)->next))
+	{
+		if (*prev == reader)
+		{
+			*prev = reader->next;
+			break;
+		}
+	}
+	reader->next = NULL;
+}
+
+/*
+ * Stop every reader still running, before the datasets
+ * they read from are closed at backend exit.
+ */
+void
+ogrReaderStopAll(void)
+{
+	while (ogr_running_readers)
+		ogrReaderStop(ogr_running_readers);
+}
+
+/*
+ * Empty the wakeup pipe. Call before looking at the ring.
+ */
+void
+ogrReaderDrain(OgrFdwReader* reader)
+{
+	char buf[64];
+	while (read(reader->pipefd[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+int
+ogrReaderWaitFd(OgrFdwReader* reader)
+{
+	return reader->pipefd[0];
+}
+
+/*
+ * True once the thread has stopped and every feature it
+ * read has been taken.
+ */
+bool
+ogrReaderFinished(OgrFdwReader* reader)
+{
+	if (!pg_atomic_read_u32(&(reader->done)))
+		return false;
+	pg_read_barrier();
+	return pg_atomic_read_u64(&(reader->tail)) == pg_atomic_read_u64(&(reader->head));
+}
+
+static OGRFeatureH
+ogrReaderTake(OgrFdwReader* reader)
+{
+	uint64 tail = pg_atomic_read_u64(&(reader->tail));
+	OGRFeatureH feat;
+
+	if (tail == pg_atomic_read_u64(&(reader->head)))
+		return NULL;
+
+	pg_read_barrier();
+	feat = reader->ring[tail % reader->size];
+
+	/* The slot's WKB now goes with the feature being returned */
+	if (reader->nwkb > 0)
+	{
+		size_t slot = (tail % reader->size) * reader->nwkb;
+		ogrReaderFreeWkb(reader->curwkb, reader->nwkb);
+		memcpy(reader->curwkb, &(reader->wkbring[slot]), sizeof(unsigned char*) * reader->nwkb);
+		memcpy(reader->cursizes, &(reader->wkbsizes[slot]), sizeof(int) * reader->nwkb);
+	}
+
+	pg_atomic_write_u64(&(reader->tail), tail + 1);
+	pg_memory_barrier();
+
+	/* Let a thread waiting on a full ring carry on */
+	if (pg_atomic_read_u32(&(reader->sleeping)))
+	{
+		CPLAcquireMutex(reader->mutex, 1000.0);
+		CPLCondSignal(reader->cond);
+		CPLReleaseMutex(reader->mutex);
+	}
+
+	return feat;
+}
+
+/*
+ * Take the next feature the thread has read. With wait, block
+ * until there is one (or the layer is exhausted); without,
+ * return NULL straight away when the ring is empty, and let the
+ * caller tell "not yet" from "no more" with ogrReaderFinished().
+ */
+OGRFeatureH
+ogrReaderNext(OgrFdwReader* reader, bool wait)
+{
+	OGRFeatureH feat;
+
+	if (!reader->running)
+		ogrReaderStart(reader);
+
+	for (;;)
+	{
+		feat = ogrReaderTake(reader);
+		if (feat)
+			return feat;
+
+		if (pg_atomic_read_u32(&(reader->done)))
+		{
+			/* The last pushes may have landed after our look */
+			pg_read_barrier();
+			feat = ogrReaderTake(reader);
+			if (feat)
+				return feat;
+
+			if (reader->failed)
+				ereport(ERROR,
+				        (errcode(ERRCODE_FDW_ERROR),
+				         errmsg("failure reading OGR data source"),
+				         errhint("%s", reader->errmsg)));
+			return NULL;
+		}
+
+		if (!wait)
+			return NULL;
+
+		(void) WaitLatchOrSocket(MyLatch,
+#if PG_VERSION_NUM >= 120000
+		                         WL_LATCH_SET | WL_SOCKET_READABLE | WL_EXIT_ON_PM_DEATH,
+#else
+		                         WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH,
+#endif
+		                         reader->pipefd[0], -1L, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+		ogrReaderDrain(reader);
+	}
+}
+
+/*
+ * WKB the thread exported for geometry field geomfld of the
+ * feature last returned by ogrReaderNext(), or NULL if it
+ * was not exported (no geometry, or not asked for). Valid
+ * until the next call to ogrReaderNext() or ogrReaderStop().
+ */
+const unsigned char*
+ogrReaderWkb(OgrFdwReader* reader, int geomfld, int* wkbsize)
+{
+	int i;
+
+	for (i = 0; i < reader->nwkb; i++)
+	{
+		if (reader->wkbfields[i] == geomfld)
+		{
+			*wkbsize = reader->cursizes[i];
+			return reader->curwkb[i];
+		}
+	}
+	return NULL;
+}
+
+#else /* WIN32 */
+
+/*
+ * WaitEventSets only handle sockets on Windows, so there is
+ * no background reader there.
+ */
+bool
+ogrReaderAvailable(void)
+{
+	return false;
+}
+
+OgrFdwReader*
+ogrReaderCreate(OGRLayerH lyr, int size, const int* wkbfields, int nwkb)
+{
+	elog(ERROR, "%s: background reader is not supported on this platform", __func__);
+	return NULL;
+}
+
+void
+ogrReaderStart(OgrFdwReader* reader)
+{
+	return;
+}
+
+void
+ogrReaderStop(OgrFdwReader* reader)
+{
+	return;
+}
+
+void
+ogrReaderStopAll(void)
+{
+	return;
+}
+
+void
+ogrReaderDrain(OgrFdwReader* reader)
+{
+	return;
+}
+
+int
+ogrReaderWaitFd(OgrFdwReader* reader)
+{
+	return -1;
+}
+
+bool
+ogrReaderFinished(OgrFdwReader* reader)
+{
+	return true;
+}
+
+OGRFeatureH
+ogrReaderNext(OgrFdwReader* reader, bool wait)
+{
+	return NULL;
+}
+
+const unsigned char*
+ogrReaderWkb(OgrFdwReader* reader, int geomfld, int* wkbsize)
+{
+	return NULL;
+}
+
+#endif /* WIN32 */
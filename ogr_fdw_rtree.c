@@ -0,0 +1,488 @@
+/*-------------------------------------------------------------------------
+ *
+ * ogr_fdw_rtree.c
+ *		  foreign-data wrapper for GIS data access.
+ *
+ * Copyright (c) 2014-2015, Paul Ramsey <pramsey@cleverelephant.ca>
+ *
+ * In-memory spatial index: a packed Hilbert R-tree of the FID
+ * and bounding box of every feature of a layer, for formats
+ * that have no spatial index of their own (GeoJSON, KML, GML
+ * and the like), where a spatial filter still means parsing
+ * and testing every feature. A scan with a spatial filter
+ * looks the matching FIDs up in the tree and fetches only
+ * those features.
+ *
+ * Trees are built by the first scan that wants one, and kept
+ * by the backend for later scans, until the files they were
+ * built from change size or modification time, or the layer
+ * is written to through the FDW.
+ *-------------------------------------------------------------------------
+ */
+
+/*
+ * Local structures
+ */
+#include "ogr_fdw.h"
+
+#include "cpl_vsi.h"
+
+/* Children of each node of the tree */
+#define OGR_RTREE_NODE_SIZE 16
+
+/* Hilbert curve over a grid of this many cells a side */
+#define OGR_RTREE_HILBERT_MAX 0xFFFF
+
+struct OgrFdwRtree
+{
+	int nitems;        /* features indexed, the leaves of the tree */
+	int nlevels;       /* leaves are level zero, the root is the last */
+	int* levelends;    /* index one past the last box of each level */
+	double* boxes;     /* minx, miny, maxx, maxy of leaves, then nodes level by level */
+	int64* fids;       /* FIDs of the leaves */
+};
+
+/*
+ * Trees kept by the backend, most recently used first. Each
+ * one lives in a memory context of its own under the cache's.
+ */
+typedef struct OgrFdwRtreeEntry
+{
+	char* ds_str;
+	char* lyr_str;
+	int ogrfldnum;
+	GIntBig mtime;     /* latest of the files the tree was built from */
+	GIntBig size;      /* total of the files */
+	MemoryContext cxt;
+	OgrFdwRtree* rtree;
+	struct OgrFdwRtreeEntry* next;
+} OgrFdwRtreeEntry;
+
+static MemoryContext ogr_rtree_cxt = NULL;
+static OgrFdwRtreeEntry* ogr_rtree_cache = NULL;
+
+typedef struct OgrFdwRtreeItem
+{
+	uint32 hilbert;
+	int64 fid;
+	OGREnvelope env;
+} OgrFdwRtreeItem;
+
+/*
+ * Distance along the Hilbert curve of a cell of the grid.
+ */
+static uint32
+ogrRtreeHilbert(uint32 x, uint32 y)
+{
+	uint32 d = 0;
+	uint32 s;
+
+	for (s = (OGR_RTREE_HILBERT_MAX + 1) / 2; s > 0; s /= 2)
+	{
+		uint32 rx = (x & s) > 0;
+		uint32 ry = (y & s) > 0;
+
+		d += s * s * ((3 * rx) ^ ry);
+
+		/* Rotate the quadrant */
+		if (ry == 0)
+		{
+			uint32 t;
+			if (rx == 1)
+			{
+				x = OGR_RTREE_HILBERT_MAX - x;
+				y = OGR_RTREE_HILBERT_MAX - y;
+			}
+			t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return d;
+}
+
+static int
+ogrRtreeItemCmpFunc(const void* a, const void* b)
+{
+	uint32 ha = ((const OgrFdwRtreeItem*) a)->hilbert;
+	uint32 hb = ((const OgrFdwRtreeItem*) b)->hilbert;
+	return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+static int
+ogrRtreeFidCmpFunc(const void* a, const void* b)
+{
+	int64 fa = *(const int64*) a;
+	int64 fb = *(const int64*) b;
+	return fa < fb ? -1 : (fa > fb ? 1 : 0);
+}
+
+/*
+ * Read every feature of the layer for its FID and the box of
+ * its geometry in the field, and pack them into a tree, in
+ * the current memory context. Features with no geometry can't
+ * pass a spatial filter, so are left out. Returns NULL if the
+ * layer doesn't give its features FIDs.
+ */
+static OgrFdwRtree*
+ogrRtreeBuild(OGRLayerH lyr, int ogrfldnum)
+{
+	OgrFdwRtree* rtree;
+	OgrFdwRtreeItem* items;
+	OGRFeatureH feat;
+	OGREnvelope ext;
+	int maxitems = 1024;
+	int nitems = 0;
+	int nboxes, pos, start, end, level;
+	double w, h;
+	int i;
+
+	items = MemoryContextAllocHuge(CurrentMemoryContext, sizeof(OgrFdwRtreeItem) * maxitems);
+
+	OGR_L_SetSpatialFilter(lyr, NULL);
+	OGR_L_SetAttributeFilter(lyr, NULL);
+	OGR_L_ResetReading(lyr);
+
+	while ((feat = OGR_L_GetNextFeature(lyr)))
+	{
+#if (GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(1,11,0))
+		OGRGeometryH geom = OGR_F_GetGeomFieldRef(feat, ogrfldnum);
+#else
+		OGRGeometryH geom = OGR_F_GetGeometryRef(feat);
+#endif
+		GIntBig fid = OGR_F_GetFID(feat);
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (fid == OGRNullFID)
+		{
+			OGR_F_Destroy(feat);
+			pfree(items);
+			return NULL;
+		}
+
+		if (geom && !OGR_G_IsEmpty(geom))
+		{
+			if (nitems == maxitems)
+			{
+				maxitems *= 2;
+				items = repalloc_huge(items, sizeof(OgrFdwRtreeItem) * maxitems);
+			}
+			items[nitems].fid = fid;
+			OGR_G_GetEnvelope(geom, &(items[nitems].env));
+			nitems++;
+		}
+		OGR_F_Destroy(feat);
+	}
+	OGR_L_ResetReading(lyr);
+
+	/* Order the features along a Hilbert curve over their extent */
+	memset(&ext, 0, sizeof(OGREnvelope));
+	if (nitems > 0)
+		ext = items[0].env;
+	for (i = 1; i < nitems; i++)
+	{
+		ext.MinX = Min(ext.MinX, items[i].env.MinX);
+		ext.MinY = Min(ext.MinY, items[i].env.MinY);
+		ext.MaxX = Max(ext.MaxX, items[i].env.MaxX);
+		ext.MaxY = Max(ext.MaxY, items[i].env.MaxY);
+	}
+	w = ext.MaxX - ext.MinX;
+	h = ext.MaxY - ext.MinY;
+	for (i = 0; i < nitems; i++)
+	{
+		double cx = (items[i].env.MinX + items[i].env.MaxX) / 2;
+		double cy = (items[i].env.MinY + items[i].env.MaxY) / 2;
+		uint32 x = w > 0 ? (uint32) (OGR_RTREE_HILBERT_MAX * (cx - ext.MinX) / w) : 0;
+		uint32 y = h > 0 ? (uint32) (OGR_RTREE_HILBERT_MAX * (cy - ext.MinY) / h) : 0;
+		items[i].hilbert = ogrRtreeHilbert(x, y);
+	}
+	qsort(items, nitems, sizeof(OgrFdwRtreeItem), ogrRtreeItemCmpFunc);
+
+	/* Count the boxes of every level, up to a single root */
+	rtree = palloc0(sizeof(OgrFdwRtree));
+	rtree->nitems = nitems;
+	rtree->nlevels = 1;
+	nboxes = nitems;
+	for (end = nitems; end > 1; end = (end + OGR_RTREE_NODE_SIZE - 1) / OGR_RTREE_NODE_SIZE)
+	{
+		nboxes += (end + OGR_RTREE_NODE_SIZE - 1) / OGR_RTREE_NODE_SIZE;
+		rtree->nlevels++;
+	}
+
+	rtree->levelends = palloc(sizeof(int) * rtree->nlevels);
+	rtree->boxes = MemoryContextAllocHuge(CurrentMemoryContext, sizeof(double) * 4 * Max(nboxes, 1));
+	rtree->fids = MemoryContextAllocHuge(CurrentMemoryContext, sizeof(int64) * Max(nitems, 1));
+
+	for (i = 0; i < nitems; i++)
+	{
+		rtree->fids[i] = items[i].fid;
+		rtree->boxes[4 * i] = items[i].env.MinX;
+		rtree->boxes[4 * i + 1] = items[i].env.MinY;
+		rtree->boxes[4 * i + 2] = items[i].env.MaxX;
+		rtree->boxes[4 * i + 3] = items[i].env.MaxY;
+	}
+	pfree(items);
+
+	/* Each node covers the boxes of its children on the level below */
+	rtree->levelends[0] = nitems;
+	pos = nitems;
+	start = 0;
+	end = nitems;
+	for (level = 1; level < rtree->nlevels; level++)
+	{
+		for (i = start; i < end; i += OGR_RTREE_NODE_SIZE)
+		{
+			double* node = &(rtree->boxes[4 * pos]);
+			int j, last = Min(i + OGR_RTREE_NODE_SIZE, end);
+
+			memcpy(node, &(rtree->boxes[4 * i]), sizeof(double) * 4);
+			for (j = i + 1; j < last; j++)
+			{
+				double* child = &(rtree->boxes[4 * j]);
+				node[0] = Min(node[0], child[0]);
+				node[1] = Min(node[1], child[1]);
+				node[2] = Max(node[2], child[2]);
+				node[3] = Max(node[3], child[3]);
+			}
+			pos++;
+		}
+		start = end;
+		end = pos;
+		rtree->levelends[level] = end;
+	}
+
+	return rtree;
+}
+
+/*
+ * Total size and latest modification time of the files a
+ * dataset reads, or false if it reads none. The data source
+ * string itself may be a directory, whose time doesn't
+ * change when a file in it is rewritten, so the files are
+ * the ones the driver lists.
+ */
+static bool
+ogrRtreeStat(const OgrConnection* ogr, GIntBig* mtime, GIntBig* size)
+{
+	VSIStatBufL st;
+	bool found = false;
+
+	*mtime = 0;
+	*size = 0;
+
+#if GDAL_VERSION_MAJOR >= 2
+	{
+		char** files = GDALGetFileList(ogr->ds);
+		char** file;
+
+		for (file = files; file && *file; file++)
+		{
+			if (VSIStatL(*file, &st) != 0 || VSI_ISDIR(st.st_mode))
+				continue;
+			*mtime = Max(*mtime, (GIntBig) st.st_mtime);
+			*size += (GIntBig) st.st_size;
+			found = true;
+		}
+		CSLDestroy(files);
+	}
+#endif
+
+	if (!found && VSIStatL(ogr->ds_str, &st) == 0 && !VSI_ISDIR(st.st_mode))
+	{
+		*mtime = (GIntBig) st.st_mtime;
+		*size = (GIntBig) st.st_size;
+		found = true;
+	}
+
+	return found;
+}
+
+static void
+ogrRtreeEntryFree(OgrFdwRtreeEntry* entry)
+{
+	MemoryContextDelete(entry->cxt);
+}
+
+/*
+ * The spatial index of a geometry field of the layer of a
+ * connection, built now if there is none yet or the file has
+ * changed since. Returns NULL for data sources that aren't
+ * files, and for layers whose features have no FIDs.
+ * Building reads the whole layer, clearing its filters.
+ */
+OgrFdwRtree*
+ogrRtreeGet(const OgrConnection* ogr, int ogrfldnum)
+{
+	OgrFdwRtreeEntry** prev;
+	OgrFdwRtreeEntry* entry;
+	MemoryContext cxt, oldcxt;
+	OgrFdwRtree* rtree;
+	GIntBig mtime, size;
+	int n;
+
+	if (!ogrRtreeStat(ogr, &mtime, &size))
+		return NULL;
+
+	for (prev = &ogr_rtree_cache; *prev; prev = &((*prev)->next))
+	{
+		entry = *prev;
+		if (entry->ogrfldnum != ogrfldnum ||
+		    !streq(entry->ds_str, ogr->ds_str) ||
+		    !streq(entry->lyr_str, ogr->lyr_str))
+			continue;
+
+		*prev = entry->next;
+		if (entry->mtime == mtime && entry->size == size)
+		{
+			/* Most recently used goes first */
+			entry->next = ogr_rtree_cache;
+			ogr_rtree_cache = entry;
+			return entry->rtree;
+		}
+
+		elog(DEBUG2, "%s: '%s' has changed, rebuilding its spatial index", __func__, ogr->ds_str);
+		ogrRtreeEntryFree(entry);
+		break;
+	}
+
+	if (!ogr_rtree_cxt)
+		ogr_rtree_cxt = AllocSetContextCreate(TopMemoryContext,
+		                                      "OGR FDW spatial indexes",
+		                                      ALLOCSET_DEFAULT_SIZES);
+
+	/* Only join the cache once built, so an error leaves nothing behind */
+	cxt = AllocSetContextCreate(CurrentMemoryContext,
+	                            "OGR FDW spatial index",
+	                            ALLOCSET_DEFAULT_SIZES);
+	oldcxt = MemoryContextSwitchTo(cxt);
+	rtree = ogrRtreeBuild(ogr->lyr, ogrfldnum);
+	MemoryContextSwitchTo(oldcxt);
+
+	if (!rtree)
+	{
+		MemoryContextDelete(cxt);
+		return NULL;
+	}
+
+	elog(DEBUG2, "%s: indexed %d features of layer '%s'", __func__, rtree->nitems, ogr->lyr_str);
+
+	MemoryContextSetParent(cxt, ogr_rtree_cxt);
+	entry = MemoryContextAllocZero(cxt, sizeof(OgrFdwRtreeEntry));
+	entry->ds_str = MemoryContextStrdup(cxt, ogr->ds_str);
+	entry->lyr_str = MemoryContextStrdup(cxt, ogr->lyr_str);
+	entry->ogrfldnum = ogrfldnum;
+	entry->mtime = mtime;
+	entry->size = size;
+	entry->cxt = cxt;
+	entry->rtree = rtree;
+	entry->next = ogr_rtree_cache;
+	ogr_rtree_cache = entry;
+
+	/* Drop the least recently used trees past the cache size */
+	for (n = 0, prev = &ogr_rtree_cache; *prev; n++)
+	{
+		if (n < OGR_FDW_RTREE_CACHE_SIZE)
+		{
+			prev = &((*prev)->next);
+			continue;
+		}
+		entry = *prev;
+		*prev = entry->next;
+		ogrRtreeEntryFree(entry);
+	}
+
+	return rtree;
+}
+
+/*
+ * Drop the trees of a layer after writes to it, which can
+ * land within the second of the file's modification time,
+ * or not reach the file yet at all. A NULL layer drops the
+ * trees of every layer of the data source.
+ */
+void
+ogrRtreeInvalidate(const char* ds_str, const char* lyr_str)
+{
+	OgrFdwRtreeEntry** prev = &ogr_rtree_cache;
+
+	while (*prev)
+	{
+		OgrFdwRtreeEntry* entry = *prev;
+
+		if (streq(entry->ds_str, ds_str) &&
+		    (!lyr_str || streq(entry->lyr_str, lyr_str)))
+		{
+			elog(DEBUG2, "%s: dropping the spatial index of layer '%s'", __func__, entry->lyr_str);
+			*prev = entry->next;
+			ogrRtreeEntryFree(entry);
+			continue;
+		}
+		prev = &(entry->next);
+	}
+}
+
+/*
+ * Find the features whose boxes meet the box, returning how
+ * many, and their FIDs in ascending order (so the layer is
+ * read from front to back) in a palloc'ed array.
+ */
+int
+ogrRtreeSearch(const OgrFdwRtree* rtree, double minx, double miny, double maxx, double maxy, int64** fids)
+{
+	int* stack;
+	int* levels;
+	int nstack = 0;
+	int maxfids = 64;
+	int nfids = 0;
+
+	*fids = palloc(sizeof(int64) * maxfids);
+	if (rtree->nitems == 0)
+		return 0;
+
+	/* Each node visited leaves at most its children behind on the way down */
+	stack = palloc(sizeof(int) * (rtree->nlevels * OGR_RTREE_NODE_SIZE + 1));
+	levels = palloc(sizeof(int) * (rtree->nlevels * OGR_RTREE_NODE_SIZE + 1));
+
+	/* Start from the root */
+	stack[nstack] = rtree->levelends[rtree->nlevels - 1] - 1;
+	levels[nstack++] = rtree->nlevels - 1;
+
+	while (nstack > 0)
+	{
+		int i = stack[--nstack];
+		int level = levels[nstack];
+		const double* box = &(rtree->boxes[4 * i]);
+		int levelstart, childstart, first, last, j;
+
+		if (box[0] > maxx || box[1] > maxy || box[2] < minx || box[3] < miny)
+			continue;
+
+		if (level == 0)
+		{
+			if (nfids == maxfids)
+			{
+				maxfids *= 2;
+				*fids = repalloc_huge(*fids, sizeof(int64) * maxfids);
+			}
+			(*fids)[nfids++] = rtree->fids[i];
+			continue;
+		}
+
+		levelstart = rtree->levelends[level - 1];
+		childstart = level > 1 ? rtree->levelends[level - 2] : 0;
+		first = childstart + (i - levelstart) * OGR_RTREE_NODE_SIZE;
+		last = Min(first + OGR_RTREE_NODE_SIZE, levelstart);
+		for (j = first; j < last; j++)
+		{
+			stack[nstack] = j;
+			levels[nstack++] = level - 1;
+		}
+	}
+
+	pfree(stack);
+	pfree(levels);
+
+	qsort(*fids, nfids, sizeof(int64), ogrRtreeFidCmpFunc);
+	return nfids;
+}